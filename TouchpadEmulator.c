@@ -17,31 +17,135 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <string.h>
 
 #include <errno.h>
 #include <dbus/dbus.h>
 #include <dbus/dbus-glib.h>
+#include <glib.h>
+#include <dirent.h>
 #include <fcntl.h>
 #include <linux/input.h>
 #include <linux/uinput.h>
-#include <poll.h>
-#include <pthread.h>
+#include <math.h>
 #include <unistd.h>
 #include <signal.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
 #include <time.h>
 
 /*---------------------------------------------------------*\
 | Event Codes                                               |
 \*---------------------------------------------------------*/
 #define ABS_SLIDER              34
-#define EVENT_TYPE              EV_ABS
-#define EVENT_CODE_X            ABS_X
-#define EVENT_CODE_ALT_X        ABS_MT_POSITION_X
-#define EVENT_CODE_Y            ABS_Y
-#define EVENT_CODE_ALT_Y        ABS_MT_POSITION_Y
 #define EVENT_CODE_SLIDER       ABS_SLIDER
 
+#ifndef REL_WHEEL_HI_RES
+#define REL_WHEEL_HI_RES        0x0b
+#define REL_HWHEEL_HI_RES       0x0c
+#endif
+
+/*---------------------------------------------------------*\
+| SensorProxy D-Bus names                                   |
+\*---------------------------------------------------------*/
+#define SENSOR_PROXY_NAME       "net.hadess.SensorProxy"
+#define SENSOR_PROXY_PATH       "/net/hadess/SensorProxy"
+#define DBUS_PROPERTIES_NAME    "org.freedesktop.DBus.Properties"
+#define DBUS_CALL_TIMEOUT_MS    1000
+
+/*---------------------------------------------------------*\
+| On-screen keyboard D-Bus names.  The GSettings key is     |
+| written through dconf's writer service, which is what     |
+| gsettings itself talks to                                 |
+\*---------------------------------------------------------*/
+#define DCONF_WRITER_NAME       "ca.desrt.dconf"
+#define DCONF_WRITER_PATH       "/ca/desrt/dconf/Writer/user"
+#define DCONF_WRITER_INTERFACE  "ca.desrt.dconf.Writer"
+#define OSK_ENABLED_KEY         "/org/gnome/desktop/a11y/applications/screen-keyboard-enabled"
+#define OSK_NAME                "sm.puri.OSK0"
+#define OSK_PATH                "/sm/puri/OSK0"
+#define OSK_STATE_UNKNOWN       -1
+
+/*---------------------------------------------------------*\
+| Industrial I/O accelerometer, read directly when          |
+| SensorProxy is not available.  A new orientation must     |
+| lie within IIO_SECTOR_DEG of its center, with the device  |
+| tilted at least asin(IIO_MIN_TILT) out of the flat, for   |
+| IIO_SETTLE_USEC before rotation follows it                |
+\*---------------------------------------------------------*/
+#define IIO_DEVICES_PATH        "/sys/bus/iio/devices"
+#define IIO_POLL_USEC           250000
+#define IIO_SETTLE_USEC         200000
+#define IIO_SECTOR_DEG          30.0f
+#define IIO_MIN_TILT            0.5f
+#define IIO_MAX_FRAME_BYTES     64
+#define IIO_READ_FRAMES         16
+#define IIO_MAX_SCAN_ELEMENTS   32
+
+typedef struct
+{
+    int                 raw_fd;
+    int                 index;
+    int                 offset;
+    int                 bytes;
+    int                 bits;
+    int                 shift;
+    bool                is_signed;
+    bool                big_endian;
+} iio_channel_type;
+
+typedef struct
+{
+    char                name[64];
+    bool                enabled;
+} iio_scan_element_type;
+
+typedef struct
+{
+    char                    path[512];
+    char                    device[256];
+    iio_channel_type        channels[3];
+    float                   mount[9];
+    int                     dev_fd;
+    bool                    buffered;
+    int                     frame_bytes;
+    int                     candidate;
+    struct timespec         candidate_time;
+    iio_scan_element_type   saved_scan[IIO_MAX_SCAN_ELEMENTS];
+    int                     saved_scan_count;
+    bool                    set_trigger;
+} iio_accel_type;
+
+/*---------------------------------------------------------*\
+| Number of input events read from a device per read()      |
+\*---------------------------------------------------------*/
+#define EVENT_BUFFER_SIZE       64
+
+/*---------------------------------------------------------*\
+| Input device nodes, scanned at startup and watched for    |
+| hotplug afterwards                                        |
+\*---------------------------------------------------------*/
+#define INPUT_DEV_PATH          "/dev/input"
+#define MAX_INPUT_DEVICES       256
+
+/*---------------------------------------------------------*\
+| Startup device cache, relative to $XDG_CACHE_HOME or      |
+| ~/.cache, and the number of threads probing event nodes   |
+| when it cannot be used                                    |
+\*---------------------------------------------------------*/
+#define DEVICE_CACHE_FILE       "TouchpadEmulator/devices"
+#define PROBE_THREADS           4
+
 /*---------------------------------------------------------*\
 | Macros (adapted from evtest.c)                            |
 \*---------------------------------------------------------*/
@@ -53,6 +157,11 @@
 
 /*---------------------------------------------------------*\
 | List of known devices' input event names                  |
+|                                                           |
+|   Built into the device database after the entries read   |
+|   from its file.  The panel diagonal is used to derive    |
+|   the touchscreen resolution when the driver does not     |
+|   report one                                              |
 \*---------------------------------------------------------*/
 typedef struct
 {
@@ -61,845 +170,7975 @@ typedef struct
     char *  button_1;
     char *  slider;
     char *  device;
+    float   diagonal_mm;
 } event_names_type;
 
 #define NUM_KNOWN_DEVICES 7
 
 static const event_names_type known_devices[NUM_KNOWN_DEVICES] =
 {
-    { "Goodix Capacitive TouchScreen",  "1c21800.lradc",    "",             "",             "PINE64 PinePhone"      },
-    { "Goodix Capacitive TouchScreen",  "adc-keys",         "",             "",             "PINE64 PinePhone Pro"  },
-    { "Synaptics S3706B",               "Volume keys",      "",             "Alert slider", "OnePlus 6T"            },
-    { "NVTCapacitiveTouchScreen",       "gpio-keys",        "pm8941_resin", "",             "Xiaomi Pad 5 Pro"      },
-    { "Synaptics S3706B",               "gpio-keys",        "pm8941_resin", "",             "Google Pixel 3a"       },
-    { "nvt-ts",                         "gpio-keys",        "pm8941_resin", "",             "Xiaomi Poco F1"        },
-    { "Synaptics PLG218",               "gpio-keys",        "",             "",             "LG Google Nexus 5"     },
+    { "Goodix Capacitive TouchScreen",  "1c21800.lradc",    "",             "",             "PINE64 PinePhone",         151.1f  },
+    { "Goodix Capacitive TouchScreen",  "adc-keys",         "",             "",             "PINE64 PinePhone Pro",     152.4f  },
+    { "Synaptics S3706B",               "Volume keys",      "",             "Alert slider", "OnePlus 6T",               162.8f  },
+    { "NVTCapacitiveTouchScreen",       "gpio-keys",        "pm8941_resin", "",             "Xiaomi Pad 5 Pro",         279.4f  },
+    { "Synaptics S3706B",               "gpio-keys",        "pm8941_resin", "",             "Google Pixel 3a",          142.2f  },
+    { "nvt-ts",                         "gpio-keys",        "pm8941_resin", "",             "Xiaomi Poco F1",           157.0f  },
+    { "Synaptics PLG218",               "gpio-keys",        "",             "",             "LG Google Nexus 5",        125.7f  },
 };
 
 /*---------------------------------------------------------*\
-| Button Events                                             |
+| Physical Units                                            |
+|                                                           |
+|   Motion and gesture distances are in millimetres on the  |
+|   panel so they feel the same on every device.  Panels    |
+|   with no reported or known size are assumed to be a 6    |
+|   inch phone                                              |
 \*---------------------------------------------------------*/
-enum
-{
-    BUTTON_EVENT_DO_NOTHING,
-    BUTTON_EVENT_ENABLE_TOUCHPAD,
-    BUTTON_EVENT_DISABLE_TOUCHPAD_TOGGLE_KEYBOARD,
-    BUTTON_EVENT_CLOSE,
-    BUTTON_EVENT_EMIT_VOLUMEUP,
-    BUTTON_EVENT_EMIT_VOLUMEDOWN,
-    BUTTON_EVENT_CHANGE_ORIENTATION,
-    BUTTON_EVENT_DISABLE_TOUCHPAD_ENABLE_KEYBOARD,
-    BUTTON_EVENT_DISABLE_TOUCHPAD_DISABLE_KEYBOARD,
-};
+#define DEFAULT_DIAGONAL_MM     152.4f
+
+#define POINTER_PIXELS_PER_MM   10.0f
+#define TOUCH_SLOP_MM           0.5f
 
 /*---------------------------------------------------------*\
-| Global Variables                                          |
+| Output Frame                                              |
+|                                                           |
+|   Events destined for a uinput device are collected here  |
+|   and written out together once per SYN_REPORT            |
 \*---------------------------------------------------------*/
-char    query_buf[64]       = "";
-int     rotation            = 0;
+#define OUTPUT_FRAME_SIZE       32
 
-bool    no_keyboard         = false;
+typedef struct
+{
+    int                 count;
+    struct input_event  events[OUTPUT_FRAME_SIZE];
+} output_frame_type;
 
-int     button_0_fd         = 0;
-int     button_1_fd         = 0;
-int     slider_fd           = 0;
-int     touchscreen_fd      = 0;
-int     virtual_buttons_fd  = 0;
-int     virtual_mouse_fd    = 0;
+/*---------------------------------------------------------*\
+| Output Scheduler                                          |
+|                                                           |
+|   Optionally limits the virtual mouse to a target report  |
+|   rate.  Pointer and wheel deltas from input frames that  |
+|   arrive within one output period are summed and sent     |
+|   together when the period is up.  Frames carrying button |
+|   transitions are always sent at once, preceded by any    |
+|   motion still pending                                    |
+\*---------------------------------------------------------*/
+typedef struct
+{
+    int                 rate;           /* Hz, 0 for every frame    */
+    unsigned int        period_usec;
+    int                 pending[REL_CNT];
+    bool                pending_any;
+    bool                timer_armed;
+    struct timespec     last_output;
+} output_scheduler_type;
 
-int     close_flag          = 0;
-int     touchpad_enable     = 0;
-int     keyboard_enable     = 0;
+/*---------------------------------------------------------*\
+| Multitouch Slot Table                                     |
+|                                                           |
+|   One entry per kernel multitouch slot, updated as the    |
+|   frame's events arrive and evaluated once at SYN_REPORT. |
+|   active_id is the tracking ID as of the last evaluated   |
+|   frame, so lifts and new contacts are found by comparing |
+|   it with tracking_id                                     |
+\*---------------------------------------------------------*/
+#define MAX_TOUCH_SLOTS         10
 
-int     dragging            = 0;
-int     check_for_dragging  = 0;
+enum
+{
+    SLOT_DIRTY_TRACKING_ID      = (1 << 0),
+    SLOT_DIRTY_POSITION         = (1 << 1),
+};
 
 /*---------------------------------------------------------*\
-| emit                                                      |
+| Jitter Filter                                             |
 |                                                           |
-| Emits an input event                                      |
+|   1 Euro filter run on each contact's position once per   |
+|   frame.  The low-pass cutoff rises with the contact's    |
+|   filtered speed from min_cutoff by beta per mm/s, so a   |
+|   resting finger is smoothed heavily while fast motion    |
+|   passes through with almost no lag                       |
 \*---------------------------------------------------------*/
+typedef struct
+{
+    bool                    enable;
+    float                   min_cutoff;     /* Hz                       */
+    float                   beta;           /* Hz per mm/s              */
+    float                   d_cutoff;       /* Hz, for the speed        */
+} jitter_filter_settings_type;
 
-void emit(int fd, int type, int code, int val)
+typedef struct
 {
-    struct input_event ie;
+    bool                    initialized;
+    float                   x;              /* device units             */
+    float                   y;
+    float                   speed_x;        /* mm per second            */
+    float                   speed_y;
+    struct timeval          time;
+} jitter_filter_type;
 
-    ie.type = type;
-    ie.code = code;
-    ie.value = val;
-    ie.input_event_sec = 0;
-    ie.input_event_usec = 0;
+typedef struct
+{
+    int                     tracking_id;
+    int                     active_id;
+    int                     x;
+    int                     y;
+    unsigned int            dirty;
+    struct timeval          time_down;
+    jitter_filter_type      filter;
+    float                   screen_x;       /* mm, screen axes          */
+    float                   screen_y;
+} touch_slot_type;
 
-    write(fd, &ie, sizeof(ie));
-}
+typedef struct
+{
+    touch_slot_type         slots[MAX_TOUCH_SLOTS];
+    int                     num_slots;
+    int                     current_slot;
+    int                     primary_slot;
+    int                     btn_touch;
+    bool                    single_touch;
+    bool                    syn_dropped;
+} touch_state_type;
 
 /*---------------------------------------------------------*\
-| disable_keyboard                                          |
+| Touch Transform                                           |
 |                                                           |
-| Disable the on screen keyboard                            |
+|   Contact positions are mapped to millimetres along the   |
+|   screen's current axes by one affine transform, built    |
+|   from three 2x3 matrices in normalized [0, 1] panel      |
+|   coordinates, applied in order:                          |
+|                                                           |
+|     calibration   panel to display, like a libinput       |
+|                   calibration matrix, for mirrored or     |
+|                   offset panels                           |
+|     orientation   display to screen for the rotation      |
+|     scale         normalized units to mm                  |
+|                                                           |
+|   The result is rebuilt only when the rotation changes    |
 \*---------------------------------------------------------*/
+typedef struct
+{
+    float                   m[6];           /* a b c / d e f            */
+} transform_type;
 
-void disable_keyboard()
+static const transform_type orientation_matrices[4] =
 {
-    if(!no_keyboard)
-    {
-        system("gsettings set org.gnome.desktop.a11y.applications screen-keyboard-enabled false");
-    }
-    keyboard_enable = 0;
-}
+    { {  1.0f,  0.0f,  0.0f,     0.0f,  1.0f,  0.0f } },   /* 0         */
+    { {  0.0f,  1.0f,  0.0f,    -1.0f,  0.0f,  1.0f } },   /* 90        */
+    { { -1.0f,  0.0f,  1.0f,     0.0f, -1.0f,  1.0f } },   /* 180       */
+    { {  0.0f, -1.0f,  1.0f,     1.0f,  0.0f,  0.0f } },   /* 270       */
+};
 
 /*---------------------------------------------------------*\
-| enable_keyboard                                           |
+| Pointer Acceleration                                      |
 |                                                           |
-| Enable the on screen keyboard                             |
+|   Single-finger motion is scaled by a factor chosen from  |
+|   the contact's velocity over a short window of recent    |
+|   frames.  The flat profile always applies the base speed |
+|   while the adaptive profile ramps up to max_factor times |
+|   the base speed above threshold.  Motion comes in as mm  |
+|   and leaves as pixels; fractions of a pixel left over    |
+|   after rounding carry into the next frame                |
 \*---------------------------------------------------------*/
+#define ACCEL_HISTORY_SIZE      8
+#define ACCEL_WINDOW_USEC       50000
 
-void enable_keyboard()
+enum
 {
-    if(!no_keyboard)
-    {
-        system("gsettings set org.gnome.desktop.a11y.applications screen-keyboard-enabled true");
-        system("busctl call --user sm.puri.OSK0 /sm/puri/OSK0 sm.puri.OSK0 SetVisible b true");
-    }
-    keyboard_enable = 1;
-}
+    ACCEL_PROFILE_FLAT,
+    ACCEL_PROFILE_ADAPTIVE,
+};
+
+typedef struct
+{
+    float                   delta_x;
+    float                   delta_y;
+    struct timeval          time;
+} motion_sample_type;
+
+typedef struct
+{
+    int                     profile;
+    float                   speed;          /* base factor              */
+    float                   threshold;      /* mm per millisecond       */
+    float                   incline;        /* factor per mm/ms above   */
+    float                   max_factor;     /* cap, times speed         */
+
+    motion_sample_type      history[ACCEL_HISTORY_SIZE];
+    int                     history_head;
+    int                     history_count;
+    float                   remainder_x;
+    float                   remainder_y;
+    float                   last_factor;
+} pointer_accel_type;
 
 /*---------------------------------------------------------*\
-| open_uinput                                               |
+| Motion Prediction                                         |
 |                                                           |
-| Creates the virtual mouse device                          |
+|   Optionally moves the pointer ahead of the finger by the |
+|   distance it is expected to travel over the next horizon |
+|   milliseconds, from its velocity and acceleration.  The  |
+|   lead is never longer than straight-line extrapolation   |
+|   and is dropped when the finger reverses, stops or       |
+|   lifts, by moving the pointer back by what was shown.    |
+|   A finger at rest sends no events, so the lead is also   |
+|   dropped if no motion follows within PREDICT_SETTLE_USEC |
 \*---------------------------------------------------------*/
+#define PREDICT_MIN_SPEED       0.02f       /* mm per millisecond       */
+#define PREDICT_SETTLE_USEC     30000
 
-void open_uinput(int* fd)
+typedef struct
 {
-    /*-----------------------------------------------------*\
-    | If virtual mouse is already opened, return            |
-    \*-----------------------------------------------------*/
-    if(*fd != 0)
-    {
-        return;
-    }
+    float                   horizon;        /* ms, 0 to disable         */
 
-    /*-----------------------------------------------------*\
-    | Open the uinput device                                |
-    \*-----------------------------------------------------*/
-    *fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+    bool                    have_velocity;
+    float                   velocity_x;     /* mm per millisecond       */
+    float                   velocity_y;
+    struct timeval          time;
+    int                     shown_x;        /* lead already sent, px    */
+    int                     shown_y;
+} motion_prediction_type;
 
-    /*-----------------------------------------------------*\
-    | Virtual mouse provides left and right keys; x, y, and |
-    | wheel axes and has direct property                    |
-    \*-----------------------------------------------------*/
-    ioctl(*fd, UI_SET_EVBIT,  EV_KEY);
-    ioctl(*fd, UI_SET_KEYBIT, BTN_LEFT);
-    ioctl(*fd, UI_SET_KEYBIT, BTN_RIGHT);
+/*---------------------------------------------------------*\
+| Scrolling                                                 |
+|                                                           |
+|   Two-finger motion is sent on both screen axes as high   |
+|   resolution wheel events, 120 units per detent, and the  |
+|   legacy wheel clicks are derived from their running sum. |
+|   Fractions of a high resolution unit carry over between  |
+|   frames.  With axis locking, the first axis to travel    |
+|   SCROLL_LOCK_MM is the only one scrolled until the       |
+|   fingers lift.                                           |
+|                                                           |
+|   When the fingers lift while still moving, scrolling     |
+|   continues from a periodic timer at the release velocity |
+|   measured over the last KINETIC_WINDOW_USEC, decaying by |
+|   exp(-friction * t) until it drops below the stop speed  |
+|   or the touchscreen is touched again                     |
+\*---------------------------------------------------------*/
+#define SCROLL_STEP_MM          1.0f
+#define SCROLL_LOCK_MM          1.0f
+#define SCROLL_HI_RES_PER_DETENT 120
 
-    ioctl(*fd, UI_SET_EVBIT,  EV_REL);
-    ioctl(*fd, UI_SET_RELBIT, REL_X);
-    ioctl(*fd, UI_SET_RELBIT, REL_Y);
-    ioctl(*fd, UI_SET_RELBIT, REL_WHEEL);
+#define KINETIC_WINDOW_USEC     100000
+#define KINETIC_INTERVAL_USEC   16667
+#define KINETIC_START_SPEED     0.1f        /* mm per millisecond       */
+#define KINETIC_STOP_SPEED      0.02f       /* mm per millisecond       */
 
-    ioctl(*fd, UI_SET_PROPBIT, INPUT_PROP_DIRECT);
+enum
+{
+    SCROLL_AXIS_NONE,
+    SCROLL_AXIS_VERTICAL,
+    SCROLL_AXIS_HORIZONTAL,
+};
 
-    /*-----------------------------------------------------*\
-    | Set up virtual mouse device.  Use fake USB ID and name|
-    | it "Touchpad Emulator"                                |
-    \*-----------------------------------------------------*/
-    struct uinput_setup usetup;
+typedef struct
+{
+    bool                    lock_axis;
+    int                     locked_axis;
+    float                   travel_v;
+    float                   travel_h;
+
+    float                   remainder_v;
+    float                   remainder_h;
+    int                     detent_v;
+    int                     detent_h;
+
+    motion_sample_type      history[ACCEL_HISTORY_SIZE];
+    int                     history_head;
+    int                     history_count;
+
+    bool                    kinetic_enable;
+    bool                    kinetic;
+    float                   friction;       /* per second               */
+    float                   velocity_v;     /* mm per millisecond       */
+    float                   velocity_h;
+    struct timeval          release_time;
+    struct timespec         kinetic_time;
+} scroll_state_type;
 
-    memset(&usetup, 0, sizeof(usetup));
+/*---------------------------------------------------------*\
+| Gesture Recognizer                                        |
+|                                                           |
+|   Tap to click, double tap and hold to drag, hold to drag |
+|   and two finger tap to right click are one state machine |
+|   per touchpad.  Each frame's contacts are reduced to     |
+|   inputs, timed against the touchpad's gesture timings,   |
+|   and every input looks up a single transition giving the |
+|   next state and the actions to emit.  Inputs with no     |
+|   transition in a state are ignored.  Leaving a state     |
+|   cancels the timer it armed                              |
+\*---------------------------------------------------------*/
+#define DEFAULT_TAP_USEC        150000
+#define DEFAULT_TAP_DRAG_USEC   150000
+#define DEFAULT_HOLD_DRAG_USEC  1000000
 
-    usetup.id.bustype = BUS_USB;
-    usetup.id.vendor  = 0x1234;
-    usetup.id.product = 0x5678;
-    strcpy(usetup.name, "Touchpad Emulator");
+enum
+{
+    GESTURE_STATE_IDLE,                 /* no touch, nothing pending            */
+    GESTURE_STATE_TOUCH,                /* one still contact, may tap or hold   */
+    GESTURE_STATE_TAP_WAIT,             /* lifted, a touch now starts a drag    */
+    GESTURE_STATE_DRAG,                 /* left button held, contact still      */
+    GESTURE_STATE_DRAG_MOVED,           /* left button held, contact moved      */
+    GESTURE_STATE_POINTER,              /* moving or several contacts           */
+    NUM_GESTURE_STATES
+};
 
-    ioctl(*fd, UI_DEV_SETUP, &usetup);
+enum
+{
+    GESTURE_INPUT_TOUCH_DOWN,           /* touchscreen pressed by one contact   */
+    GESTURE_INPUT_TOUCH_DOWN_MULTI,     /* pressed by several at once           */
+    GESTURE_INPUT_TAP_UP,               /* released within the tap time         */
+    GESTURE_INPUT_TOUCH_UP,             /* released after the tap time          */
+    GESTURE_INPUT_FINGER_DOWN,          /* another contact landed               */
+    GESTURE_INPUT_FINGER_TAP_UP,        /* one of two lifted within tap time    */
+    GESTURE_INPUT_FINGER_UP,            /* a contact lifted, others remain      */
+    GESTURE_INPUT_MOVE,                 /* primary contact moved past the slop  */
+    GESTURE_INPUT_HOLD_TIMEOUT,         /* hold to drag time passed             */
+    GESTURE_INPUT_TAP_TIMEOUT,          /* tap to drag window closed            */
+    GESTURE_INPUT_CANCEL,               /* contacts lost, taps not trusted      */
+    GESTURE_INPUT_RESET,                /* touchscreen gone or released         */
+    NUM_GESTURE_INPUTS
+};
 
-    /*-----------------------------------------------------*\
-    | Create the virtual mouse.  The cursor should appear   |
-    | on screen after this call.                            |
-    \*-----------------------------------------------------*/
-    ioctl(*fd, UI_DEV_CREATE);
-}
+#define GESTURE_ACTION_CLICK            (1 << 0)
+#define GESTURE_ACTION_RIGHT_CLICK      (1 << 1)
+#define GESTURE_ACTION_BUTTON_DOWN      (1 << 2)
+#define GESTURE_ACTION_BUTTON_UP        (1 << 3)
+#define GESTURE_ACTION_START_HOLD       (1 << 4)
+#define GESTURE_ACTION_START_TAP_WAIT   (1 << 5)
 
+typedef struct
+{
+    bool                    valid;
+    unsigned char           next_state;
+    unsigned char           actions;
+} gesture_transition_type;
 
-void open_virtual_buttons(int* fd)
+#define GESTURE_TO(state, actions)  { true, (state), (actions) }
+
+static const gesture_transition_type gesture_transitions[NUM_GESTURE_STATES][NUM_GESTURE_INPUTS] =
 {
-    /*-----------------------------------------------------*\
-    | If virtual buttons is already opened, return          |
-    \*-----------------------------------------------------*/
-    if(*fd != 0)
+    [GESTURE_STATE_IDLE] =
     {
-        return;
-    }
+        [GESTURE_INPUT_TOUCH_DOWN]          = GESTURE_TO(GESTURE_STATE_TOUCH,       GESTURE_ACTION_START_HOLD),
+        [GESTURE_INPUT_TOUCH_DOWN_MULTI]    = GESTURE_TO(GESTURE_STATE_POINTER,     0),
+        [GESTURE_INPUT_FINGER_TAP_UP]       = GESTURE_TO(GESTURE_STATE_IDLE,        GESTURE_ACTION_RIGHT_CLICK),
+    },
 
-    /*-----------------------------------------------------*\
-    | Open the uinput device                                |
-    \*-----------------------------------------------------*/
-    *fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+    [GESTURE_STATE_TOUCH] =
+    {
+        [GESTURE_INPUT_TAP_UP]              = GESTURE_TO(GESTURE_STATE_TAP_WAIT,    GESTURE_ACTION_CLICK | GESTURE_ACTION_START_TAP_WAIT),
+        [GESTURE_INPUT_TOUCH_UP]            = GESTURE_TO(GESTURE_STATE_TAP_WAIT,    GESTURE_ACTION_START_TAP_WAIT),
+        [GESTURE_INPUT_FINGER_DOWN]         = GESTURE_TO(GESTURE_STATE_POINTER,     0),
+        [GESTURE_INPUT_FINGER_TAP_UP]       = GESTURE_TO(GESTURE_STATE_POINTER,     GESTURE_ACTION_RIGHT_CLICK),
+        [GESTURE_INPUT_FINGER_UP]           = GESTURE_TO(GESTURE_STATE_POINTER,     0),
+        [GESTURE_INPUT_MOVE]                = GESTURE_TO(GESTURE_STATE_POINTER,     0),
+        [GESTURE_INPUT_HOLD_TIMEOUT]        = GESTURE_TO(GESTURE_STATE_DRAG,        GESTURE_ACTION_BUTTON_DOWN),
+        [GESTURE_INPUT_CANCEL]              = GESTURE_TO(GESTURE_STATE_POINTER,     0),
+        [GESTURE_INPUT_RESET]               = GESTURE_TO(GESTURE_STATE_IDLE,        0),
+    },
+
+    [GESTURE_STATE_TAP_WAIT] =
+    {
+        [GESTURE_INPUT_TOUCH_DOWN]          = GESTURE_TO(GESTURE_STATE_DRAG,        GESTURE_ACTION_BUTTON_DOWN),
+        [GESTURE_INPUT_TOUCH_DOWN_MULTI]    = GESTURE_TO(GESTURE_STATE_POINTER,     0),
+        [GESTURE_INPUT_FINGER_DOWN]         = GESTURE_TO(GESTURE_STATE_IDLE,        0),
+        [GESTURE_INPUT_FINGER_TAP_UP]       = GESTURE_TO(GESTURE_STATE_IDLE,        GESTURE_ACTION_RIGHT_CLICK),
+        [GESTURE_INPUT_FINGER_UP]           = GESTURE_TO(GESTURE_STATE_IDLE,        0),
+        [GESTURE_INPUT_TAP_TIMEOUT]         = GESTURE_TO(GESTURE_STATE_IDLE,        0),
+        [GESTURE_INPUT_CANCEL]              = GESTURE_TO(GESTURE_STATE_IDLE,        0),
+        [GESTURE_INPUT_RESET]               = GESTURE_TO(GESTURE_STATE_IDLE,        0),
+    },
+
+    [GESTURE_STATE_DRAG] =
+    {
+        [GESTURE_INPUT_TAP_UP]              = GESTURE_TO(GESTURE_STATE_TAP_WAIT,    GESTURE_ACTION_BUTTON_UP | GESTURE_ACTION_START_TAP_WAIT),
+        [GESTURE_INPUT_TOUCH_UP]            = GESTURE_TO(GESTURE_STATE_TAP_WAIT,    GESTURE_ACTION_BUTTON_UP | GESTURE_ACTION_START_TAP_WAIT),
+        [GESTURE_INPUT_FINGER_DOWN]         = GESTURE_TO(GESTURE_STATE_DRAG_MOVED,  0),
+        [GESTURE_INPUT_FINGER_TAP_UP]       = GESTURE_TO(GESTURE_STATE_DRAG_MOVED,  GESTURE_ACTION_RIGHT_CLICK),
+        [GESTURE_INPUT_FINGER_UP]           = GESTURE_TO(GESTURE_STATE_DRAG_MOVED,  0),
+        [GESTURE_INPUT_MOVE]                = GESTURE_TO(GESTURE_STATE_DRAG_MOVED,  0),
+        [GESTURE_INPUT_CANCEL]              = GESTURE_TO(GESTURE_STATE_DRAG_MOVED,  0),
+        [GESTURE_INPUT_RESET]               = GESTURE_TO(GESTURE_STATE_IDLE,        GESTURE_ACTION_BUTTON_UP),
+    },
+
+    [GESTURE_STATE_DRAG_MOVED] =
+    {
+        [GESTURE_INPUT_TAP_UP]              = GESTURE_TO(GESTURE_STATE_IDLE,        GESTURE_ACTION_BUTTON_UP),
+        [GESTURE_INPUT_TOUCH_UP]            = GESTURE_TO(GESTURE_STATE_IDLE,        GESTURE_ACTION_BUTTON_UP),
+        [GESTURE_INPUT_FINGER_TAP_UP]       = GESTURE_TO(GESTURE_STATE_DRAG_MOVED,  GESTURE_ACTION_RIGHT_CLICK),
+        [GESTURE_INPUT_RESET]               = GESTURE_TO(GESTURE_STATE_IDLE,        GESTURE_ACTION_BUTTON_UP),
+    },
 
-    /*-----------------------------------------------------*\
-    | Virtual buttons provides volume up and down keys      |
-    \*-----------------------------------------------------*/
-    ioctl(*fd, UI_SET_EVBIT,  EV_KEY);
-    ioctl(*fd, UI_SET_KEYBIT, KEY_VOLUMEUP);
-    ioctl(*fd, UI_SET_KEYBIT, KEY_VOLUMEDOWN);
+    [GESTURE_STATE_POINTER] =
+    {
+        [GESTURE_INPUT_TAP_UP]              = GESTURE_TO(GESTURE_STATE_IDLE,        0),
+        [GESTURE_INPUT_TOUCH_UP]            = GESTURE_TO(GESTURE_STATE_IDLE,        0),
+        [GESTURE_INPUT_FINGER_TAP_UP]       = GESTURE_TO(GESTURE_STATE_POINTER,     GESTURE_ACTION_RIGHT_CLICK),
+        [GESTURE_INPUT_RESET]               = GESTURE_TO(GESTURE_STATE_IDLE,        0),
+    },
+};
 
-    /*-----------------------------------------------------*\
-    | Set up virtual buttons device.  Use fake USB ID and   |
-    |name it "Touchpad Emulator Buttons"                    |
-    \*-----------------------------------------------------*/
-    struct uinput_setup usetup;
+typedef struct
+{
+    unsigned int            tap_usec;
+    unsigned int            tap_drag_usec;
+    unsigned int            hold_drag_usec;
+    float                   slop_mm;
+
+    int                     state;
+    struct timeval          touch_time;
+    struct timeval          two_finger_time;
+    float                   down_x;
+    float                   down_y;
+} gesture_type;
 
-    memset(&usetup, 0, sizeof(usetup));
+/*---------------------------------------------------------*\
+| Event Sources                                             |
+|                                                           |
+|   Every file descriptor the main loop waits on (input     |
+|   devices, timers and signals) is an event source with a  |
+|   handler that is called when it becomes readable.  Input |
+|   sources also have a handler for their device going away |
+\*---------------------------------------------------------*/
+#define MAX_EPOLL_EVENTS        16
 
-    usetup.id.bustype = BUS_USB;
-    usetup.id.vendor  = 0x1234;
-    usetup.id.product = 0x5678;
-    strcpy(usetup.name, "Touchpad Emulator Buttons");
+typedef struct event_source event_source_type;
 
-    ioctl(*fd, UI_DEV_SETUP, &usetup);
+typedef void (*event_handler_type)(event_source_type* source);
+typedef void (*event_processor_type)(event_source_type* source, struct input_event* events, int count);
 
-    /*-----------------------------------------------------*\
-    | Create the virtual buttons                            |
-    \*-----------------------------------------------------*/
-    ioctl(*fd, UI_DEV_CREATE);
-}
+struct event_source
+{
+    int                     fd;
+    event_handler_type      handler;
+    event_processor_type    process;
+    event_handler_type      removed;
+    bool                    syn_dropped;
+};
 
 /*---------------------------------------------------------*\
-| close_uinput                                              |
+| Input Device Roles                                        |
 |                                                           |
-| Closes the virtual mouse device                           |
+|   The devices opened at startup, each kept in its role's  |
+|   global fd.  A role whose device goes away is filled     |
+|   again by the next device that matches it                |
 \*---------------------------------------------------------*/
-
-void close_uinput(int* fd)
+enum
 {
-    /*-----------------------------------------------------*\
-    | Destroy the virtual mouse.  The cursor should         |
-    | disappear from the screen after this call if no other |
-    | mice are present.                                     |
-    \*-----------------------------------------------------*/
-    ioctl(*fd, UI_DEV_DESTROY);
-    close(*fd);
+    INPUT_ROLE_TOUCHSCREEN,
+    INPUT_ROLE_BUTTON_0,
+    INPUT_ROLE_BUTTON_1,
+    INPUT_ROLE_SLIDER,
+    NUM_INPUT_ROLES
+};
 
-    *fd = 0;
-}
+typedef struct
+{
+    const char*             label;
+    int*                    fd;
+    event_source_type*      source;
+    event_processor_type    process;
+} input_role_type;
 
 /*---------------------------------------------------------*\
-| disable_touchpad                                          |
+| Kernel Event Masks                                        |
 |                                                           |
-| Disable the emulated touchpad                             |
+|   Event codes each input device is asked to deliver,      |
+|   installed with EVIOCSMASK so that the kernel drops all  |
+|   other events without waking the main loop.  While the   |
+|   touchpad is disabled the touchscreen delivers nothing.  |
+|   The button devices are not masked, as everything they   |
+|   send besides the volume keys is forwarded               |
 \*---------------------------------------------------------*/
+typedef struct
+{
+    unsigned int            type;
+    unsigned int            code;
+} event_code_type;
 
-void disable_touchpad()
+#define NUM_EVENT_CODES(codes)  (sizeof(codes) / sizeof((codes)[0]))
+
+static const unsigned int event_mask_types[] =
 {
-    if(touchpad_enable)
-    {
-        ioctl(touchscreen_fd, EVIOCGRAB, 0);
-        close_uinput(&virtual_mouse_fd);
-    }
-    touchpad_enable = 0;
-}
+    EV_SYN, EV_KEY, EV_REL, EV_ABS, EV_MSC, EV_SW, EV_LED, EV_SND, EV_FF
+};
 
-/*---------------------------------------------------------*\
-| enable_touchpad                                           |
-|                                                           |
-| Enable the emulated touchpad                              |
-\*---------------------------------------------------------*/
+static const event_code_type touchscreen_event_codes[] =
+{
+    { EV_SYN,   SYN_REPORT          },
+    { EV_SYN,   SYN_DROPPED         },
+    { EV_KEY,   BTN_TOUCH           },
+    { EV_ABS,   ABS_X               },
+    { EV_ABS,   ABS_Y               },
+    { EV_ABS,   ABS_MT_SLOT         },
+    { EV_ABS,   ABS_MT_TRACKING_ID  },
+    { EV_ABS,   ABS_MT_POSITION_X   },
+    { EV_ABS,   ABS_MT_POSITION_Y   },
+};
 
-void enable_touchpad()
+static const event_code_type slider_event_codes[] =
 {
-    if(!touchpad_enable)
-    {
-        ioctl(touchscreen_fd, EVIOCGRAB, 1);
-        open_uinput(&virtual_mouse_fd);
-    }
-    touchpad_enable = 1;
-}
+    { EV_SYN,   SYN_REPORT          },
+    { EV_SYN,   SYN_DROPPED         },
+    { EV_ABS,   EVENT_CODE_SLIDER   },
+};
 
 /*---------------------------------------------------------*\
-| query_accelerometer_orientation                           |
+| io_uring I/O Backend                                      |
 |                                                           |
-| Query DBus for the AccelerometerOrientation property of   |
-| SensorProxy                                               |
+|   Optional alternative to reading input devices and       |
+|   writing uinput devices through epoll and read/write.    |
+|   Requests are tracked in a fixed pool, each with its own |
+|   event buffer                                            |
 \*---------------------------------------------------------*/
+#define URING_ENTRIES           32
+#define URING_MAX_REQUESTS      16
 
-char* query_accelerometer_orientation()
+enum
 {
-    DBusMessageIter     args;
-    DBusMessageIter     args_variant;
-    DBusConnection*     conn;
-    DBusError           err;
+    URING_REQUEST_FREE,
+    URING_REQUEST_QUEUED,
+    URING_REQUEST_IN_FLIGHT,
+};
+
+enum
+{
+    URING_REQUEST_READ,
+    URING_REQUEST_WRITE,
+    URING_REQUEST_POLL,
+};
+
+typedef struct
+{
+    int                     state;
+    int                     type;
+    int                     fd;
+    int                     count;
+    unsigned int            sequence;
+    event_source_type*      source;
+    struct input_event      events[EVENT_BUFFER_SIZE];
+} uring_request_type;
+
+typedef struct
+{
+    int                     ring_fd;
+    unsigned int*           sq_head;
+    unsigned int*           sq_tail;
+    unsigned int*           sq_mask;
+    unsigned int            sq_entries;
+    unsigned int*           sq_array;
+    struct io_uring_sqe*    sqes;
+    unsigned int*           cq_head;
+    unsigned int*           cq_tail;
+    unsigned int*           cq_mask;
+    struct io_uring_cqe*    cqes;
+    unsigned int            to_submit;
+} uring_type;
+
+/*---------------------------------------------------------*\
+| Button Events                                             |
+\*---------------------------------------------------------*/
+enum
+{
+    BUTTON_EVENT_DO_NOTHING,
+    BUTTON_EVENT_ENABLE_TOUCHPAD,
+    BUTTON_EVENT_DISABLE_TOUCHPAD_TOGGLE_KEYBOARD,
+    BUTTON_EVENT_CLOSE,
+    BUTTON_EVENT_EMIT_VOLUMEUP,
+    BUTTON_EVENT_EMIT_VOLUMEDOWN,
+    BUTTON_EVENT_CHANGE_ORIENTATION,
+    BUTTON_EVENT_DISABLE_TOUCHPAD_ENABLE_KEYBOARD,
+    BUTTON_EVENT_DISABLE_TOUCHPAD_DISABLE_KEYBOARD,
+};
+
+/*---------------------------------------------------------*\
+| Volume Buttons                                            |
+|                                                           |
+|   Press-time state of each volume key.  A key whose click |
+|   emits a volume key passes it through as soon as it is   |
+|   pressed and repeats it while held.  Hold actions fire   |
+|   as soon as their threshold passes, releasing the passed |
+|   through key first                                       |
+\*---------------------------------------------------------*/
+#define DEFAULT_SHORT_HOLD_USEC 500000
+#define DEFAULT_LONG_HOLD_USEC  4000000
+#define DEFAULT_REPEAT_DELAY    250000
+#define DEFAULT_REPEAT_PERIOD   33000
+
+enum
+{
+    HOLD_STAGE_NONE,
+    HOLD_STAGE_SHORT,
+    HOLD_STAGE_LONG,
+};
+
+typedef struct
+{
+    int                     key;
+    int*                    click_event;
+    int*                    short_hold_event;
+    int*                    long_hold_event;
+    int                     pressed;
+    int                     hold_stage;
+    int                     passthrough_key;
+    unsigned int            held_usec;
+    unsigned int            next_usec;
+    event_source_type       timer;
+} volume_button_type;
+
+#define VOLUME_BUTTON_OF(source) \
+    ((volume_button_type*)((char*)(source) - offsetof(volume_button_type, timer)))
+
+/*---------------------------------------------------------*\
+| Device Database                                           |
+|                                                           |
+|   Each supported device is a set of input devices by role |
+|   and its tuning.  A role matches an event node by name   |
+|   prefix, by bus, vendor and product from EVIOCGID where  |
+|   given, and always by the capabilities the role is read  |
+|   for.  Entries come from the database file, then the     |
+|   built-in known_devices table, and are indexed by name   |
+|   so one pass over the event nodes finds every candidate. |
+|   The file holds one section per device:                  |
+|                                                           |
+|     [Device Name]                                         |
+|     touchscreen         = Goodix Capacitive TouchScreen   |
+|     touchscreen_id      = 0018:*:*                        |
+|     button_0            = gpio-keys                       |
+|     button_1            = pm8941_resin                    |
+|     slider              = Alert slider                    |
+|     diagonal_mm         = 151.1                           |
+|     resolution          = 10.5                            |
+|     orientation         = 90                              |
+|     calibration_matrix  = 1 0 0 0 1 0                     |
+|     accel_speed         = 1.2                             |
+|     button_0_click      = volume-up                       |
+|     tap_time            = 150                             |
+|                                                           |
+|   Roles and their IDs (bus:vendor:product in hex, * for   |
+|   any) are button_0, button_1, slider and touchscreen.    |
+|   Button actions are set with button_N_click,             |
+|   button_N_short_hold and button_N_long_hold.  Gesture    |
+|   timings in milliseconds are set with tap_time,          |
+|   tap_drag_time and hold_drag_time, and the distance a    |
+|   tap may move with touch_slop_mm                         |
+\*---------------------------------------------------------*/
+#define DEVICE_DB_PATH          "/etc/TouchpadEmulator/devices.conf"
+#define MAX_DB_DEVICES          64
+#define MAX_DEVICE_NAME         64
+#define DEVICE_INDEX_SIZE       256
+#define DEVICE_ID_ANY           -1
+
+typedef struct
+{
+    char                name[MAX_DEVICE_NAME];
+    int                 bustype;
+    int                 vendor;
+    int                 product;
+} device_match_type;
+
+typedef struct
+{
+    char                device[MAX_DEVICE_NAME];
+    device_match_type   roles[NUM_INPUT_ROLES];
+    float               diagonal_mm;
+    float               resolution;
+    int                 orientation;
+    bool                has_calibration;
+    transform_type      calibration;
+    float               accel_speed;
+    int                 button_events[2][3];
+    unsigned int        tap_usec;
+    unsigned int        tap_drag_usec;
+    unsigned int        hold_drag_usec;
+    float               slop_mm;
+} device_entry_type;
+
+typedef struct
+{
+    int                 entry;
+    int                 role;
+    int                 next;
+} device_index_node_type;
+
+/*---------------------------------------------------------*\
+| Input Probe                                               |
+|                                                           |
+|   What one event node reported when it was opened at      |
+|   startup.  Nodes are probed in parallel, since opening   |
+|   some touchscreens powers them up and takes a while, and |
+|   the probes are then matched against the database        |
+\*---------------------------------------------------------*/
+typedef struct
+{
+    int                 event_id;
+    int                 fd;
+    char                name[256];
+    struct input_id     id;
+    unsigned long       capabilities[EV_MAX][NBITS(KEY_MAX)];
+} input_probe_type;
+
+/*---------------------------------------------------------*\
+| Touchpad Context                                          |
+|                                                           |
+|   Everything belonging to one emulated touchpad: its      |
+|   touchscreen and virtual mouse, the contacts, transform, |
+|   gesture, scroll and output state, and its timers.  The  |
+|   first touchpad is the device's own touchscreen, and     |
+|   with --all-touchscreens every other touchscreen found   |
+|   gets one as well.  Each touchpad has its own mode and   |
+|   rotation.  The buttons, slider and accelerometer drive  |
+|   the first, the others stay in touchpad mode at a fixed  |
+|   rotation.  Event handlers find their context from the   |
+|   event source and make it the current touchpad           |
+\*---------------------------------------------------------*/
+#define MAX_TOUCHPADS           4
+
+#define TOUCHPAD_OF(source, member) \
+    ((touchpad_type*)((char*)(source) - offsetof(touchpad_type, member)))
+
+typedef struct
+{
+    int                     touchscreen_fd;
+    int                     virtual_mouse_fd;
+    event_source_type       touchscreen_source;
+
+    /*-----------------------------------------------------*\
+    | Whether the touchscreen is emulating a touchpad, and  |
+    | the rotation of the display it is mounted on          |
+    \*-----------------------------------------------------*/
+    int                     enabled;
+    int                     rotation;
+
+    /*-----------------------------------------------------*\
+    | Touchscreen limits and multitouch slot table          |
+    \*-----------------------------------------------------*/
+    struct input_absinfo    max_x;
+    struct input_absinfo    max_y;
+    float                   units_per_mm_x;
+    float                   units_per_mm_y;
+    touch_state_type        touch;
+
+    /*-----------------------------------------------------*\
+    | Panel size and resolution, used to derive             |
+    | units_per_mm when the driver does not report it       |
+    \*-----------------------------------------------------*/
+    float                   panel_diagonal_mm;
+    float                   resolution_override;
+
+    /*-----------------------------------------------------*\
+    | Touch transform, device units to screen millimetres,  |
+    | and the rotation it was built for                     |
+    \*-----------------------------------------------------*/
+    transform_type          calibration_matrix;
+    transform_type          touch_transform;
+    int                     touch_transform_rotation;
+
+    /*-----------------------------------------------------*\
+    | Pointer acceleration, prediction and two-finger       |
+    | scroll settings and state                             |
+    \*-----------------------------------------------------*/
+    pointer_accel_type      pointer_accel;
+    motion_prediction_type  prediction;
+    scroll_state_type       scroll;
+
+    /*-----------------------------------------------------*\
+    | Virtual mouse pointer tracking variables              |
+    \*-----------------------------------------------------*/
+    float                   prev_x;
+    float                   prev_y;
+
+    int                     init_prev;
+    int                     init_prev_wheel;
+
+    int                     touch_active;
+    int                     fingers;
+
+    /*-----------------------------------------------------*\
+    | Gesture timings and recognizer state                  |
+    \*-----------------------------------------------------*/
+    gesture_type            gesture;
+
+    /*-----------------------------------------------------*\
+    | Hold-to-drag, tap-to-drag, kinetic scrolling, output  |
+    | scheduler and prediction timers                       |
+    \*-----------------------------------------------------*/
+    event_source_type       drag_timer;
+    event_source_type       tap_timer;
+    event_source_type       kinetic_timer;
+    event_source_type       output_timer;
+    event_source_type       prediction_timer;
+
+    /*-----------------------------------------------------*\
+    | Output frame and scheduler for the virtual mouse      |
+    \*-----------------------------------------------------*/
+    output_frame_type       mouse_frame;
+    output_scheduler_type   output_scheduler;
+} touchpad_type;
+
+/*---------------------------------------------------------*\
+| Global Variables                                          |
+\*---------------------------------------------------------*/
+char    query_buf[64]       = "";
+
+bool    no_keyboard         = false;
+
+int     button_0_fd         = 0;
+int     button_1_fd         = 0;
+int     slider_fd           = 0;
+int     virtual_buttons_fd  = 0;
+
+int     close_flag          = 0;
+int     keyboard_enable     = 0;
+
+/*---------------------------------------------------------*\
+| Button behaviors                                          |
+\*---------------------------------------------------------*/
+int     button_0_long_hold_event    = BUTTON_EVENT_CLOSE;
+int     button_0_short_hold_event   = BUTTON_EVENT_ENABLE_TOUCHPAD;
+int     button_0_click_event        = BUTTON_EVENT_EMIT_VOLUMEUP;
+int     button_1_long_hold_event    = BUTTON_EVENT_CLOSE;
+int     button_1_short_hold_event   = BUTTON_EVENT_DISABLE_TOUCHPAD_TOGGLE_KEYBOARD;
+int     button_1_click_event        = BUTTON_EVENT_EMIT_VOLUMEDOWN;
+
+/*---------------------------------------------------------*\
+| Settings every touchpad starts from, set by the command   |
+| line, then the touchpads and the one being processed      |
+\*---------------------------------------------------------*/
+touchpad_type   touchpad_settings =
+{
+    .touchscreen_fd             = -1,
+    .units_per_mm_x             = 1.0f,
+    .units_per_mm_y             = 1.0f,
+    .calibration_matrix         = { { 1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f } },
+    .touch_transform_rotation   = -1,
+
+    .pointer_accel =
+    {
+        .profile    = ACCEL_PROFILE_ADAPTIVE,
+        .speed      = 1.0f,
+        .threshold  = 0.05f,
+        .incline    = 10.0f,
+        .max_factor = 3.0f,
+    },
+
+    .scroll =
+    {
+        .kinetic_enable = true,
+        .friction       = 3.0f,
+    },
+
+    .gesture =
+    {
+        .tap_usec       = DEFAULT_TAP_USEC,
+        .tap_drag_usec  = DEFAULT_TAP_DRAG_USEC,
+        .hold_drag_usec = DEFAULT_HOLD_DRAG_USEC,
+        .slop_mm        = TOUCH_SLOP_MM,
+    },
+};
+
+touchpad_type   touchpads[MAX_TOUCHPADS];
+int             num_touchpads       = 0;
+touchpad_type*  touchpad            = &touchpads[0];
+bool            all_touchscreens    = false;
+int             extra_rotation      = 0;
+
+jitter_filter_settings_type jitter_filter =
+{
+    .enable     = true,
+    .min_cutoff = 1.0f,
+    .beta       = 0.2f,
+    .d_cutoff   = 5.0f,
+};
+
+/*---------------------------------------------------------*\
+| Volume key state (up, down), hold thresholds and repeat   |
+| timing                                                    |
+\*---------------------------------------------------------*/
+volume_button_type volume_buttons[2] =
+{
+    { KEY_VOLUMEUP,     &button_0_click_event, &button_0_short_hold_event, &button_0_long_hold_event },
+    { KEY_VOLUMEDOWN,   &button_1_click_event, &button_1_short_hold_event, &button_1_long_hold_event },
+};
+
+unsigned int    short_hold_usec     = DEFAULT_SHORT_HOLD_USEC;
+unsigned int    long_hold_usec      = DEFAULT_LONG_HOLD_USEC;
+unsigned int    repeat_delay_usec   = DEFAULT_REPEAT_DELAY;
+unsigned int    repeat_period_usec  = DEFAULT_REPEAT_PERIOD;
+
+/*---------------------------------------------------------*\
+| Key and switch state last forwarded from the button       |
+| devices to the virtual buttons device                     |
+\*---------------------------------------------------------*/
+unsigned long   forwarded_key_state[NBITS(KEY_CNT)];
+unsigned long   forwarded_sw_state[NBITS(SW_CNT)];
+
+/*---------------------------------------------------------*\
+| Event loop and its event sources                          |
+\*---------------------------------------------------------*/
+int                 epoll_fd            = -1;
+
+event_source_type   button_0_source;
+event_source_type   button_1_source;
+event_source_type   slider_source;
+event_source_type   signal_source;
+event_source_type   dbus_source;
+
+/*---------------------------------------------------------*\
+| Hotplug state: the database entry the roles were matched  |
+| by, NULL when detected by capabilities, the roles opened  |
+| at startup and the /dev/input watch                       |
+\*---------------------------------------------------------*/
+const device_entry_type*    input_device_entry = NULL;
+bool                        input_role_wanted[NUM_INPUT_ROLES];
+event_source_type           hotplug_source;
+
+/*---------------------------------------------------------*\
+| Device database and its name index.  Each bucket chains   |
+| the roles whose name prefix hashes to it, and the index   |
+| is probed once per distinct prefix length                 |
+\*---------------------------------------------------------*/
+device_entry_type           device_db[MAX_DB_DEVICES];
+int                         num_db_devices      = 0;
+
+int                         device_index[DEVICE_INDEX_SIZE];
+device_index_node_type      device_index_nodes[MAX_DB_DEVICES * NUM_INPUT_ROLES];
+int                         device_name_lengths[MAX_DB_DEVICES * NUM_INPUT_ROLES];
+int                         num_device_name_lengths = 0;
+
+/*---------------------------------------------------------*\
+| Event nodes probed at startup, the next one for a probe   |
+| thread to take and the device cache file                  |
+\*---------------------------------------------------------*/
+input_probe_type*           input_probes        = NULL;
+int                         num_input_probes    = 0;
+int                         next_input_probe    = 0;
+char                        device_cache_path[512] = "";
+
+/*---------------------------------------------------------*\
+| System bus connection, kept open to receive orientation   |
+| changes from SensorProxy                                  |
+\*---------------------------------------------------------*/
+DBusConnection*     system_bus          = NULL;
+
+/*---------------------------------------------------------*\
+| Initial orientation query, answered in the event loop or  |
+| given up on when orientation_timer expires, and whether   |
+| to keep autorotation on without an initial orientation    |
+\*---------------------------------------------------------*/
+DBusPendingCall*    orientation_query   = NULL;
+event_source_type   orientation_timer;
+bool                force_autorotation  = false;
+
+/*---------------------------------------------------------*\
+| Session bus connection for on-screen keyboard control,    |
+| and the keyboard state last set or reported.  Calls that  |
+| would not change it are skipped                           |
+\*---------------------------------------------------------*/
+DBusConnection*     session_bus         = NULL;
+event_source_type   session_bus_source;
+int                 osk_enabled         = OSK_STATE_UNKNOWN;
+int                 osk_visible         = OSK_STATE_UNKNOWN;
+int                 osk_changes_pending = 0;
+char                osk_change_tag[64]  = "";
+
+/*---------------------------------------------------------*\
+| Direct IIO accelerometer, used instead of SensorProxy     |
+| when it is unavailable or --iio-accel is given            |
+\*---------------------------------------------------------*/
+char                iio_root[256]       = IIO_DEVICES_PATH;
+bool                use_iio_accel       = false;
+bool                iio_accel_active    = false;
+iio_accel_type      iio_accel;
+event_source_type   iio_source;
+event_source_type   iio_timer;
+
+/*---------------------------------------------------------*\
+| Input event buffer                                        |
+\*---------------------------------------------------------*/
+struct input_event  events[EVENT_BUFFER_SIZE];
+
+/*---------------------------------------------------------*\
+| io_uring backend state                                    |
+\*---------------------------------------------------------*/
+bool                use_io_uring        = false;
+uring_type          uring;
+uring_request_type  uring_requests[URING_MAX_REQUESTS];
+uring_request_type  uring_poll_request;
+unsigned int        uring_write_sequence = 0;
+
+/*---------------------------------------------------------*\
+| Output frame for the virtual buttons                      |
+\*---------------------------------------------------------*/
+output_frame_type   buttons_frame;
+
+/*---------------------------------------------------------*\
+| add_event_source                                          |
+|                                                           |
+| Registers a file descriptor with the event loop.  The     |
+| handler is called from the main loop whenever the file    |
+| descriptor becomes readable                               |
+\*---------------------------------------------------------*/
+
+void add_event_source(event_source_type* source, int fd, event_handler_type handler)
+{
+    struct epoll_event ev;
+
+    source->fd      = fd;
+    source->handler = handler;
+
+    if(fd < 0)
+    {
+        return;
+    }
+
+    ev.events       = EPOLLIN;
+    ev.data.ptr     = source;
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/*---------------------------------------------------------*\
+| remove_event_source                                       |
+|                                                           |
+| Unregisters a file descriptor from the event loop         |
+\*---------------------------------------------------------*/
+
+void remove_event_source(event_source_type* source)
+{
+    if(source->fd >= 0)
+    {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, source->fd, NULL);
+    }
+}
+
+/*---------------------------------------------------------*\
+| dispatch_events                                           |
+|                                                           |
+| Waits for event sources to become ready, up to timeout    |
+| milliseconds (-1 waits forever), and calls the handler of |
+| each ready source                                         |
+\*---------------------------------------------------------*/
+
+void dispatch_events(int timeout)
+{
+    struct epoll_event epoll_events[MAX_EPOLL_EVENTS];
+
+    int count = epoll_wait(epoll_fd, epoll_events, MAX_EPOLL_EVENTS, timeout);
+
+    for(int epoll_idx = 0; epoll_idx < count; epoll_idx++)
+    {
+        event_source_type* source = (event_source_type*)epoll_events[epoll_idx].data.ptr;
+
+        source->handler(source);
+    }
+}
+
+/*---------------------------------------------------------*\
+| create_timer                                              |
+|                                                           |
+| Creates a stopped one-shot timer in the event loop        |
+\*---------------------------------------------------------*/
+
+void create_timer(event_source_type* source, event_handler_type handler)
+{
+    add_event_source(source, timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC), handler);
+}
+
+/*---------------------------------------------------------*\
+| start_timer                                               |
+|                                                           |
+| (Re)arms a timer to expire once after the given number of |
+| microseconds                                              |
+\*---------------------------------------------------------*/
+
+void start_timer(event_source_type* source, unsigned int usec)
+{
+    struct itimerspec itime;
+
+    itime.it_value.tv_sec       = usec / 1000000;
+    itime.it_value.tv_nsec      = (usec % 1000000) * 1000;
+    itime.it_interval.tv_sec    = 0;
+    itime.it_interval.tv_nsec   = 0;
+
+    timerfd_settime(source->fd, 0, &itime, NULL);
+}
+
+/*---------------------------------------------------------*\
+| start_periodic_timer                                      |
+|                                                           |
+| (Re)arms a timer to expire every given number of          |
+| microseconds, starting one period from now                |
+\*---------------------------------------------------------*/
+
+void start_periodic_timer(event_source_type* source, unsigned int usec)
+{
+    struct itimerspec itime;
+
+    itime.it_value.tv_sec       = usec / 1000000;
+    itime.it_value.tv_nsec      = (usec % 1000000) * 1000;
+    itime.it_interval           = itime.it_value;
+
+    timerfd_settime(source->fd, 0, &itime, NULL);
+}
+
+/*---------------------------------------------------------*\
+| stop_timer                                                |
+|                                                           |
+| Disarms a timer.  An expiration that has not yet been     |
+| dispatched is discarded by read_timer                     |
+\*---------------------------------------------------------*/
+
+void stop_timer(event_source_type* source)
+{
+    struct itimerspec itime;
+
+    memset(&itime, 0, sizeof(itime));
+
+    timerfd_settime(source->fd, 0, &itime, NULL);
+}
+
+/*---------------------------------------------------------*\
+| read_timer                                                |
+|                                                           |
+| Acknowledges a timer expiration.  Returns false if the    |
+| timer was stopped or restarted before it was dispatched   |
+\*---------------------------------------------------------*/
+
+bool read_timer(event_source_type* source)
+{
+    uint64_t expirations;
+
+    return(read(source->fd, &expirations, sizeof(expirations)) == sizeof(expirations));
+}
+
+/*---------------------------------------------------------*\
+| read_events                                               |
+|                                                           |
+| Drains the pending events of an input device into the     |
+| event buffer with a single read().  Returns the number    |
+| of events read, or -1 on error                            |
+\*---------------------------------------------------------*/
+
+int read_events(int fd, struct input_event* events, int max_events)
+{
+    ssize_t ret = read(fd, events, max_events * sizeof(struct input_event));
+
+    if(ret < 0)
+    {
+        return(-1);
+    }
+
+    return(ret / sizeof(struct input_event));
+}
+
+/*---------------------------------------------------------*\
+| handle_input                                              |
+|                                                           |
+| Drain the events of an input device.  Each read() pulls   |
+| everything the kernel has buffered, which is usually one  |
+| or more complete frames, and hands the events to the      |
+| source's processing function in order.  A device that was |
+| unplugged fails with ENODEV                               |
+\*---------------------------------------------------------*/
+
+void handle_input(event_source_type* source)
+{
+    int count;
+
+    do
+    {
+        count = read_events(source->fd, events, EVENT_BUFFER_SIZE);
+
+        if(count < 0)
+        {
+            if(errno == ENODEV && source->removed != NULL)
+            {
+                source->removed(source);
+            }
+            return;
+        }
+
+        source->process(source, events, count);
+    } while(count == EVENT_BUFFER_SIZE);
+}
+
+/*---------------------------------------------------------*\
+| uring_setup                                               |
+|                                                           |
+| Creates the io_uring instance used by the io_uring I/O    |
+| backend and maps its rings.  Returns false if the kernel  |
+| does not support io_uring or the operations we need       |
+\*---------------------------------------------------------*/
+
+bool uring_setup()
+{
+    struct io_uring_params  params;
+    struct io_uring_probe*  probe;
+
+    memset(&params, 0, sizeof(params));
+
+    uring.ring_fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+
+    if(uring.ring_fd < 0)
+    {
+        return false;
+    }
+
+    /*-----------------------------------------------------*\
+    | Probe for read, write and poll support (Linux 5.6+)   |
+    \*-----------------------------------------------------*/
+    size_t probe_size = sizeof(struct io_uring_probe) + (256 * sizeof(struct io_uring_probe_op));
+
+    probe = calloc(1, probe_size);
+
+    bool supported = (syscall(__NR_io_uring_register, uring.ring_fd, IORING_REGISTER_PROBE, probe, 256) == 0)
+                  && (probe->last_op >= IORING_OP_READ)
+                  && (probe->ops[IORING_OP_READ].flags     & IO_URING_OP_SUPPORTED)
+                  && (probe->ops[IORING_OP_WRITE].flags    & IO_URING_OP_SUPPORTED)
+                  && (probe->ops[IORING_OP_POLL_ADD].flags & IO_URING_OP_SUPPORTED);
+
+    free(probe);
+
+    if(!supported)
+    {
+        close(uring.ring_fd);
+        uring.ring_fd = -1;
+        return false;
+    }
+
+    /*-----------------------------------------------------*\
+    | Map the submission and completion rings.  Newer       |
+    | kernels share a single mapping for both               |
+    \*-----------------------------------------------------*/
+    size_t sq_size = params.sq_off.array + (params.sq_entries * sizeof(unsigned int));
+    size_t cq_size = params.cq_off.cqes  + (params.cq_entries * sizeof(struct io_uring_cqe));
+
+    if(params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if(cq_size > sq_size)
+        {
+            sq_size = cq_size;
+        }
+        cq_size = sq_size;
+    }
+
+    char* sq_ptr = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring.ring_fd, IORING_OFF_SQ_RING);
+    char* cq_ptr = sq_ptr;
+
+    if(!(params.features & IORING_FEAT_SINGLE_MMAP) && sq_ptr != MAP_FAILED)
+    {
+        cq_ptr = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring.ring_fd, IORING_OFF_CQ_RING);
+    }
+
+    uring.sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring.ring_fd, IORING_OFF_SQES);
+
+    if(sq_ptr == MAP_FAILED || cq_ptr == MAP_FAILED || uring.sqes == MAP_FAILED)
+    {
+        if(uring.sqes != MAP_FAILED)
+        {
+            munmap(uring.sqes, params.sq_entries * sizeof(struct io_uring_sqe));
+        }
+
+        if(cq_ptr != MAP_FAILED && cq_ptr != sq_ptr)
+        {
+            munmap(cq_ptr, cq_size);
+        }
+
+        if(sq_ptr != MAP_FAILED)
+        {
+            munmap(sq_ptr, sq_size);
+        }
+
+        close(uring.ring_fd);
+        uring.ring_fd = -1;
+        return false;
+    }
+
+    uring.sq_head    = (unsigned int*)(sq_ptr + params.sq_off.head);
+    uring.sq_tail    = (unsigned int*)(sq_ptr + params.sq_off.tail);
+    uring.sq_mask    = (unsigned int*)(sq_ptr + params.sq_off.ring_mask);
+    uring.sq_entries = params.sq_entries;
+    uring.sq_array   = (unsigned int*)(sq_ptr + params.sq_off.array);
+    uring.cq_head    = (unsigned int*)(cq_ptr + params.cq_off.head);
+    uring.cq_tail    = (unsigned int*)(cq_ptr + params.cq_off.tail);
+    uring.cq_mask    = (unsigned int*)(cq_ptr + params.cq_off.ring_mask);
+    uring.cqes       = (struct io_uring_cqe*)(cq_ptr + params.cq_off.cqes);
+    uring.to_submit  = 0;
+
+    return true;
+}
+
+/*---------------------------------------------------------*\
+| uring_prep                                                |
+|                                                           |
+| Fills in the next submission queue entry.  If the ring is |
+| full, the pending entries are submitted first.  Returns   |
+| false if the kernel did not take them, leaving no room    |
+\*---------------------------------------------------------*/
+
+bool uring_prep(int opcode, int fd, void* buf, unsigned int len, void* user_data)
+{
+    unsigned int tail = *uring.sq_tail;
+
+    /*-----------------------------------------------------*\
+    | Entries the kernel has not taken are still in their   |
+    | slots, so wait for the head to move past them         |
+    \*-----------------------------------------------------*/
+    while(tail - __atomic_load_n(uring.sq_head, __ATOMIC_ACQUIRE) >= uring.sq_entries)
+    {
+        int ret = syscall(__NR_io_uring_enter, uring.ring_fd, uring.to_submit, 0, 0, NULL, 0);
+
+        if(ret > 0)
+        {
+            uring.to_submit -= ret;
+        }
+        else if(ret == 0 || (errno != EINTR && errno != EAGAIN))
+        {
+            return false;
+        }
+    }
+
+    unsigned int         index = tail & *uring.sq_mask;
+    struct io_uring_sqe* sqe   = &uring.sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+
+    sqe->opcode    = opcode;
+    sqe->fd        = fd;
+    sqe->addr      = (unsigned long)buf;
+    sqe->len       = len;
+    sqe->off       = -1;
+    sqe->user_data = (unsigned long)user_data;
+
+    if(opcode == IORING_OP_POLL_ADD)
+    {
+        sqe->poll32_events = POLLIN;
+    }
+
+    uring.sq_array[index] = index;
+
+    __atomic_store_n(uring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    uring.to_submit++;
+
+    return true;
+}
+
+/*---------------------------------------------------------*\
+| uring_post                                                |
+|                                                           |
+| Puts a request's operation into the ring.  If there is no |
+| room, the request stays queued and the next uring_submit  |
+| tries again                                               |
+\*---------------------------------------------------------*/
+
+void uring_post(uring_request_type* request)
+{
+    bool posted = false;
+
+    switch(request->type)
+    {
+        case URING_REQUEST_READ:
+            posted = uring_prep(IORING_OP_READ, request->fd, request->events, sizeof(request->events), request);
+            break;
+
+        case URING_REQUEST_WRITE:
+            posted = uring_prep(IORING_OP_WRITE, request->fd, request->events, request->count * sizeof(struct input_event), request);
+            break;
+
+        case URING_REQUEST_POLL:
+            posted = uring_prep(IORING_OP_POLL_ADD, epoll_fd, NULL, 0, request);
+            break;
+    }
+
+    request->state = posted ? URING_REQUEST_IN_FLIGHT : URING_REQUEST_QUEUED;
+}
+
+/*---------------------------------------------------------*\
+| uring_write_blocked                                       |
+|                                                           |
+| Check if a queued write must wait for an earlier write to |
+| the same device.  io_uring does not keep writes to a      |
+| character device in order, so each device has only one    |
+| in flight at a time, oldest first                         |
+\*---------------------------------------------------------*/
+
+bool uring_write_blocked(uring_request_type* write_request)
+{
+    for(int request_idx = 0; request_idx < URING_MAX_REQUESTS; request_idx++)
+    {
+        uring_request_type* request = &uring_requests[request_idx];
+
+        if(request == write_request
+        || request->type != URING_REQUEST_WRITE
+        || request->fd != write_request->fd)
+        {
+            continue;
+        }
+
+        if(request->state == URING_REQUEST_IN_FLIGHT
+        || (request->state == URING_REQUEST_QUEUED && (int)(request->sequence - write_request->sequence) < 0))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*---------------------------------------------------------*\
+| uring_submit                                              |
+|                                                           |
+| Submits all prepared requests with one io_uring_enter()   |
+| call, optionally waiting for at least one completion      |
+\*---------------------------------------------------------*/
+
+void uring_submit(bool wait)
+{
+    unsigned int flags = wait ? IORING_ENTER_GETEVENTS : 0;
+
+    /*-----------------------------------------------------*\
+    | Move any queued uinput writes, and any requests that  |
+    | found the ring full, into the ring first so they go   |
+    | out in the same submission                            |
+    \*-----------------------------------------------------*/
+    for(int request_idx = 0; request_idx < URING_MAX_REQUESTS; request_idx++)
+    {
+        uring_request_type* request = &uring_requests[request_idx];
+
+        if(request->state == URING_REQUEST_QUEUED
+        && !(request->type == URING_REQUEST_WRITE && uring_write_blocked(request)))
+        {
+            uring_post(request);
+        }
+    }
+
+    if(uring_poll_request.state == URING_REQUEST_QUEUED)
+    {
+        uring_post(&uring_poll_request);
+    }
+
+    if(uring.to_submit == 0 && !wait)
+    {
+        return;
+    }
+
+    int ret = syscall(__NR_io_uring_enter, uring.ring_fd, uring.to_submit, wait ? 1 : 0, flags, NULL, 0);
+
+    if(ret >= 0)
+    {
+        uring.to_submit -= ret;
+    }
+}
+
+/*---------------------------------------------------------*\
+| uring_drain_writes                                        |
+|                                                           |
+| Wait until every pending write to a device has completed. |
+| Their completions are consumed in place, while those of   |
+| other requests stay in the ring for the main loop         |
+\*---------------------------------------------------------*/
+
+void uring_drain_writes(int fd)
+{
+    bool pending = true;
+
+    while(pending)
+    {
+        pending = false;
+
+        for(int request_idx = 0; request_idx < URING_MAX_REQUESTS; request_idx++)
+        {
+            uring_request_type* request = &uring_requests[request_idx];
+
+            if(request->type == URING_REQUEST_WRITE && request->fd == fd && request->state != URING_REQUEST_FREE)
+            {
+                pending = true;
+            }
+        }
+
+        if(!pending)
+        {
+            return;
+        }
+
+        uring_submit(false);
+
+        syscall(__NR_io_uring_enter, uring.ring_fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+
+        unsigned int head = *uring.cq_head;
+        unsigned int tail = __atomic_load_n(uring.cq_tail, __ATOMIC_ACQUIRE);
+
+        for(; head != tail; head++)
+        {
+            struct io_uring_cqe*    cqe     = &uring.cqes[head & *uring.cq_mask];
+            uring_request_type*     request = (uring_request_type*)(unsigned long)cqe->user_data;
+
+            if(request != NULL && request->type == URING_REQUEST_WRITE && request->fd == fd)
+            {
+                request->state  = URING_REQUEST_FREE;
+                cqe->user_data  = 0;
+            }
+        }
+    }
+}
+
+/*---------------------------------------------------------*\
+| uring_start_read                                          |
+|                                                           |
+| Posts a read for an input device.  Reads stay armed while |
+| the device is idle and complete as soon as the kernel has |
+| events, delivering the whole buffered queue at once       |
+\*---------------------------------------------------------*/
+
+void uring_start_read(event_source_type* source)
+{
+    for(int request_idx = 0; request_idx < URING_MAX_REQUESTS; request_idx++)
+    {
+        uring_request_type* request = &uring_requests[request_idx];
+
+        if(request->state == URING_REQUEST_FREE)
+        {
+            request->type   = URING_REQUEST_READ;
+            request->fd     = source->fd;
+            request->source = source;
+
+            uring_post(request);
+            return;
+        }
+    }
+}
+
+/*---------------------------------------------------------*\
+| uring_queue_write                                         |
+|                                                           |
+| Appends a frame to the pending write for a uinput device. |
+| All frames for a device produced during one pass of the   |
+| loop go out in one write, submitted together with the     |
+| re-armed reads.  Returns false if no buffer is available, |
+| in which case the caller writes the frame directly once   |
+| the device's pending writes have finished                 |
+\*---------------------------------------------------------*/
+
+bool uring_queue_write(int fd, struct input_event* events, int count)
+{
+    uring_request_type* last_request = NULL;
+    uring_request_type* free_request = NULL;
+
+    for(int request_idx = 0; request_idx < URING_MAX_REQUESTS; request_idx++)
+    {
+        uring_request_type* request = &uring_requests[request_idx];
+
+        if(request->state == URING_REQUEST_QUEUED && request->type == URING_REQUEST_WRITE && request->fd == fd
+        && (last_request == NULL || (int)(request->sequence - last_request->sequence) > 0))
+        {
+            last_request = request;
+        }
+
+        if(free_request == NULL && request->state == URING_REQUEST_FREE)
+        {
+            free_request = request;
+        }
+    }
+
+    /*-----------------------------------------------------*\
+    | Frames join the device's newest queued write, so they |
+    | go out in the order they were produced                |
+    \*-----------------------------------------------------*/
+    if(last_request != NULL && last_request->count + count <= EVENT_BUFFER_SIZE)
+    {
+        memcpy(&last_request->events[last_request->count], events, count * sizeof(struct input_event));
+        last_request->count += count;
+        return true;
+    }
+
+    /*-----------------------------------------------------*\
+    | A direct write must not overtake the device's pending |
+    | writes, so let them finish first                      |
+    \*-----------------------------------------------------*/
+    if(free_request == NULL)
+    {
+        uring_drain_writes(fd);
+        return false;
+    }
+
+    free_request->state    = URING_REQUEST_QUEUED;
+    free_request->type     = URING_REQUEST_WRITE;
+    free_request->fd       = fd;
+    free_request->count    = count;
+    free_request->sequence = uring_write_sequence++;
+
+    memcpy(free_request->events, events, count * sizeof(struct input_event));
+
+    /*-----------------------------------------------------*\
+    | If the device's previous write filled up, start the   |
+    | write now rather than at the end of the pass          |
+    \*-----------------------------------------------------*/
+    if(last_request != NULL)
+    {
+        uring_submit(false);
+    }
+
+    return true;
+}
+
+/*---------------------------------------------------------*\
+| uring_complete                                            |
+|                                                           |
+| Handles one completion.  Finished reads are processed and |
+| re-armed, finished writes release their buffer, and the   |
+| epoll poll dispatches the timer and signal sources        |
+\*---------------------------------------------------------*/
+
+void uring_complete(struct io_uring_cqe* cqe)
+{
+    uring_request_type* request = (uring_request_type*)(unsigned long)cqe->user_data;
+
+    /*-----------------------------------------------------*\
+    | Writes already finished by uring_drain_writes         |
+    \*-----------------------------------------------------*/
+    if(request == NULL)
+    {
+        return;
+    }
+
+    switch(request->type)
+    {
+        case URING_REQUEST_READ:
+            if(cqe->res > 0)
+            {
+                request->source->process(request->source, request->events, cqe->res / sizeof(struct input_event));
+            }
+
+            /*---------------------------------------------*\
+            | Keep the read armed unless the device is gone |
+            \*---------------------------------------------*/
+            if(cqe->res > 0 || cqe->res == -EAGAIN || cqe->res == -EINTR)
+            {
+                uring_post(request);
+            }
+            else
+            {
+                request->state = URING_REQUEST_FREE;
+
+                if(cqe->res == -ENODEV && request->source->removed != NULL)
+                {
+                    request->source->removed(request->source);
+                }
+            }
+            break;
+
+        case URING_REQUEST_WRITE:
+            request->state = URING_REQUEST_FREE;
+            break;
+
+        case URING_REQUEST_POLL:
+            dispatch_events(0);
+            uring_post(request);
+            break;
+    }
+}
+
+/*---------------------------------------------------------*\
+| run_uring_loop                                            |
+|                                                           |
+| Main loop of the io_uring backend.  Input device reads    |
+| and uinput writes go through the ring, while the epoll    |
+| instance carrying the timers and signals is itself polled |
+| through the ring, so one io_uring_enter() per pass both   |
+| submits the pass's work and waits for the next            |
+\*---------------------------------------------------------*/
+
+void run_uring_loop()
+{
+    uring_poll_request.type = URING_REQUEST_POLL;
+
+    uring_post(&uring_poll_request);
+
+    while(!close_flag)
+    {
+        uring_submit(true);
+
+        unsigned int head = *uring.cq_head;
+        unsigned int tail = __atomic_load_n(uring.cq_tail, __ATOMIC_ACQUIRE);
+
+        while(head != tail && !close_flag)
+        {
+            uring_complete(&uring.cqes[head & *uring.cq_mask]);
+
+            head++;
+
+            __atomic_store_n(uring.cq_head, head, __ATOMIC_RELEASE);
+        }
+    }
+
+    /*-----------------------------------------------------*\
+    | Send out anything still queued before shutting down   |
+    \*-----------------------------------------------------*/
+    for(int request_idx = 0; request_idx < URING_MAX_REQUESTS; request_idx++)
+    {
+        if(uring_requests[request_idx].type == URING_REQUEST_WRITE)
+        {
+            uring_drain_writes(uring_requests[request_idx].fd);
+        }
+    }
+}
+
+/*---------------------------------------------------------*\
+| add_input_source                                          |
+|                                                           |
+| Registers an input device with the active I/O backend.    |
+| The processing function receives the device's events in   |
+| batches as they are read                                  |
+\*---------------------------------------------------------*/
+
+void add_input_source(event_source_type* source, int fd, event_processor_type process)
+{
+    source->process = process;
+
+    if(use_io_uring && fd >= 0)
+    {
+        /*-------------------------------------------------*\
+        | io_uring returns -EAGAIN for reads on O_NONBLOCK  |
+        | files instead of waiting for data, so clear it    |
+        \*-------------------------------------------------*/
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+
+        source->fd      = fd;
+        source->handler = NULL;
+
+        uring_start_read(source);
+    }
+    else
+    {
+        add_event_source(source, fd, handle_input);
+    }
+}
+
+/*---------------------------------------------------------*\
+| queue_event                                               |
+|                                                           |
+| Adds an input event to an output frame.  Relative events  |
+| with a zero value carry no motion and are dropped         |
+\*---------------------------------------------------------*/
+
+void queue_event(output_frame_type* frame, int type, int code, int val)
+{
+    if(type == EV_REL && val == 0)
+    {
+        return;
+    }
+
+    /*-----------------------------------------------------*\
+    | Always leave room for the closing SYN_REPORT          |
+    \*-----------------------------------------------------*/
+    if(frame->count >= (OUTPUT_FRAME_SIZE - 1))
+    {
+        return;
+    }
+
+    struct input_event* ie = &frame->events[frame->count++];
+
+    ie->type = type;
+    ie->code = code;
+    ie->value = val;
+    ie->input_event_sec = 0;
+    ie->input_event_usec = 0;
+}
+
+/*---------------------------------------------------------*\
+| queue_sync                                                |
+|                                                           |
+| Closes the events queued so far with a SYN_REPORT so they |
+| are delivered as their own report, such as the press half |
+| of a click                                                |
+\*---------------------------------------------------------*/
+
+void queue_sync(output_frame_type* frame)
+{
+    if(frame->count == 0 || frame->events[frame->count - 1].type == EV_SYN)
+    {
+        return;
+    }
+
+    queue_event(frame, EV_SYN, SYN_REPORT, 0);
+}
+
+/*---------------------------------------------------------*\
+| flush_frame                                               |
+|                                                           |
+| Writes an output frame to a uinput device with a single   |
+| writev(), terminated with a SYN_REPORT.  Empty frames are |
+| not written at all                                        |
+\*---------------------------------------------------------*/
+
+void flush_frame(output_frame_type* frame, int fd)
+{
+    static const struct input_event syn_report = { .type = EV_SYN, .code = SYN_REPORT, .value = 0 };
+
+    struct iovec iov[2];
+    int          iov_count = 1;
+
+    if(frame->count == 0)
+    {
+        return;
+    }
+
+    iov[0].iov_base = frame->events;
+    iov[0].iov_len  = frame->count * sizeof(struct input_event);
+
+    if(frame->events[frame->count - 1].type != EV_SYN)
+    {
+        iov[1].iov_base = (void*)&syn_report;
+        iov[1].iov_len  = sizeof(syn_report);
+        iov_count       = 2;
+    }
+
+    /*-----------------------------------------------------*\
+    | With the io_uring backend, the frame is queued and    |
+    | submitted with the rest of this pass's I/O            |
+    \*-----------------------------------------------------*/
+    if(use_io_uring && fd > 0)
+    {
+        if(iov_count == 2)
+        {
+            frame->events[frame->count++] = syn_report;
+        }
+
+        if(uring_queue_write(fd, frame->events, frame->count))
+        {
+            frame->count = 0;
+            return;
+        }
+
+        iov[0].iov_len = frame->count * sizeof(struct input_event);
+        iov_count      = 1;
+    }
+
+    if(fd > 0)
+    {
+        writev(fd, iov, iov_count);
+    }
+
+    frame->count = 0;
+}
+
+/*---------------------------------------------------------*\
+| queue_motion                                              |
+|                                                           |
+| Adds a relative pointer or wheel delta to the mouse       |
+| output, summing it with other pending deltas when the     |
+| output scheduler is enabled                               |
+\*---------------------------------------------------------*/
+
+void queue_motion(int code, int val)
+{
+    if(touchpad->output_scheduler.rate == 0)
+    {
+        queue_event(&touchpad->mouse_frame, EV_REL, code, val);
+        return;
+    }
+
+    if(val != 0)
+    {
+        touchpad->output_scheduler.pending[code] += val;
+        touchpad->output_scheduler.pending_any    = true;
+    }
+}
+
+/*---------------------------------------------------------*\
+| clear_pending_motion                                      |
+|                                                           |
+| Drops motion waiting for the next output period           |
+\*---------------------------------------------------------*/
+
+void clear_pending_motion()
+{
+    memset(touchpad->output_scheduler.pending, 0, sizeof(touchpad->output_scheduler.pending));
+
+    touchpad->output_scheduler.pending_any = false;
+
+    if(touchpad->output_scheduler.timer_armed)
+    {
+        touchpad->output_scheduler.timer_armed = false;
+        stop_timer(&touchpad->output_timer);
+    }
+}
+
+/*---------------------------------------------------------*\
+| output_mouse_frame                                        |
+|                                                           |
+| Sends the mouse output frame, or holds its motion back    |
+| until the current output period ends                      |
+\*---------------------------------------------------------*/
+
+void output_mouse_frame()
+{
+    struct timespec now;
+
+    if(touchpad->output_scheduler.rate == 0)
+    {
+        flush_frame(&touchpad->mouse_frame, touchpad->virtual_mouse_fd);
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    unsigned long elapsed_usec = ((now.tv_sec - touchpad->output_scheduler.last_output.tv_sec) * 1000000UL)
+                               + ((now.tv_nsec - touchpad->output_scheduler.last_output.tv_nsec) / 1000);
+
+    /*-----------------------------------------------------*\
+    | Only motion that has not waited a full period yet is  |
+    | held back; button frames are never delayed            |
+    \*-----------------------------------------------------*/
+    if(touchpad->mouse_frame.count == 0 && elapsed_usec < touchpad->output_scheduler.period_usec)
+    {
+        if(touchpad->output_scheduler.pending_any && !touchpad->output_scheduler.timer_armed)
+        {
+            touchpad->output_scheduler.timer_armed = true;
+            start_timer(&touchpad->output_timer, touchpad->output_scheduler.period_usec - elapsed_usec);
+        }
+        return;
+    }
+
+    if(!touchpad->output_scheduler.pending_any && touchpad->mouse_frame.count == 0)
+    {
+        return;
+    }
+
+    /*-----------------------------------------------------*\
+    | Place the pending motion ahead of the frame's own     |
+    | events so it lands before any button transition       |
+    \*-----------------------------------------------------*/
+    output_frame_type frame;
+
+    frame.count = 0;
+
+    for(int code = 0; code < REL_CNT; code++)
+    {
+        queue_event(&frame, EV_REL, code, touchpad->output_scheduler.pending[code]);
+    }
+
+    for(int event_idx = 0; event_idx < touchpad->mouse_frame.count && frame.count < (OUTPUT_FRAME_SIZE - 1); event_idx++)
+    {
+        frame.events[frame.count++] = touchpad->mouse_frame.events[event_idx];
+    }
+
+    touchpad->mouse_frame = frame;
+
+    memset(touchpad->output_scheduler.pending, 0, sizeof(touchpad->output_scheduler.pending));
+
+    touchpad->output_scheduler.pending_any = false;
+    touchpad->output_scheduler.last_output = now;
+
+    if(touchpad->output_scheduler.timer_armed)
+    {
+        touchpad->output_scheduler.timer_armed = false;
+        stop_timer(&touchpad->output_timer);
+    }
+
+    flush_frame(&touchpad->mouse_frame, touchpad->virtual_mouse_fd);
+}
+
+/*---------------------------------------------------------*\
+| set_event_mask                                            |
+|                                                           |
+| Ask the kernel to deliver only the given event codes from |
+| an input device.  Kernels without EVIOCSMASK keep sending |
+| everything, which the event processors then ignore        |
+\*---------------------------------------------------------*/
+
+bool set_event_mask(int fd, const event_code_type* codes, int num_codes)
+{
+    unsigned long code_bits[NBITS(KEY_CNT)];
+
+    if(fd < 0)
+    {
+        return false;
+    }
+
+    for(unsigned int type_idx = 0; type_idx < NUM_EVENT_CODES(event_mask_types); type_idx++)
+    {
+        struct input_mask mask;
+
+        memset(code_bits, 0, sizeof(code_bits));
+
+        for(int code_idx = 0; code_idx < num_codes; code_idx++)
+        {
+            if(codes[code_idx].type == event_mask_types[type_idx])
+            {
+                code_bits[LONG(codes[code_idx].code)] |= BIT(codes[code_idx].code);
+            }
+        }
+
+        mask.type       = event_mask_types[type_idx];
+        mask.codes_size = sizeof(code_bits);
+        mask.codes_ptr  = (__u64)(unsigned long)code_bits;
+
+        if(ioctl(fd, EVIOCSMASK, &mask) < 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*---------------------------------------------------------*\
+| dispatch_dbus                                             |
+|                                                           |
+| Read whatever arrived on a bus connection and dispatch    |
+| every complete message to the filters and pending calls   |
+\*---------------------------------------------------------*/
+
+void dispatch_dbus(DBusConnection* conn)
+{
+    dbus_connection_read_write(conn, 0);
+
+    while(dbus_connection_dispatch(conn) == DBUS_DISPATCH_DATA_REMAINS)
+    {
+    }
+}
+
+/*---------------------------------------------------------*\
+| handle_osk_reply                                          |
+|                                                           |
+| Called from the event loop when a keyboard call returns.  |
+| A failed call leaves the keyboard state unknown, so the   |
+| next switch sends it again                                |
+\*---------------------------------------------------------*/
+
+void handle_osk_reply(DBusPendingCall* pending, void* user_data)
+{
+    int*            state = (int*)user_data;
+    DBusMessage*    reply = dbus_pending_call_steal_reply(pending);
+
+    if(state == &osk_enabled)
+    {
+        osk_changes_pending--;
+    }
+
+    if(NULL == reply)
+    {
+        return;
+    }
+
+    if(dbus_message_get_type(reply) == DBUS_MESSAGE_TYPE_ERROR)
+    {
+        fprintf(stderr, "On-screen keyboard call failed: %s\n", dbus_message_get_error_name(reply));
+        *state = OSK_STATE_UNKNOWN;
+    }
+    else if(state == &osk_enabled)
+    {
+        const char* tag;
+
+        if(dbus_message_get_args(reply, NULL, DBUS_TYPE_STRING, &tag, DBUS_TYPE_INVALID))
+        {
+            snprintf(osk_change_tag, sizeof(osk_change_tag), "%s", tag);
+        }
+    }
+
+    dbus_message_unref(reply);
+}
+
+/*---------------------------------------------------------*\
+| send_osk_call                                             |
+|                                                           |
+| Send a keyboard call without waiting for its reply, which |
+| is handled by the event loop.  Takes ownership of msg     |
+\*---------------------------------------------------------*/
+
+bool send_osk_call(DBusMessage* msg, int* state)
+{
+    DBusPendingCall* pending = NULL;
+
+    if(!dbus_connection_send_with_reply(session_bus, msg, &pending, DBUS_CALL_TIMEOUT_MS) || NULL == pending)
+    {
+        dbus_message_unref(msg);
+        return(false);
+    }
+
+    dbus_pending_call_set_notify(pending, handle_osk_reply, state, NULL);
+    dbus_pending_call_unref(pending);
+    dbus_message_unref(msg);
+
+    /*-----------------------------------------------------*\
+    | Write the call out now rather than on the next wakeup |
+    \*-----------------------------------------------------*/
+    dbus_connection_read_write(session_bus, 0);
+
+    return(true);
+}
+
+/*---------------------------------------------------------*\
+| set_osk_enabled                                           |
+|                                                           |
+| Set the screen-keyboard-enabled GSettings key by sending  |
+| dconf's writer the same change gsettings would, an        |
+| a{smv} GVariant holding the key and Just <enabled>        |
+\*---------------------------------------------------------*/
+
+void set_osk_enabled(bool enabled)
+{
+    GVariantBuilder         builder;
+    GVariant*               changeset;
+    const unsigned char*    data;
+    DBusMessage*            msg;
+    bool                    appended;
+
+    if(NULL == session_bus || osk_enabled == enabled)
+    {
+        return;
+    }
+
+    msg = dbus_message_new_method_call(DCONF_WRITER_NAME, DCONF_WRITER_PATH, DCONF_WRITER_INTERFACE, "Change");
+
+    if(NULL == msg)
+    {
+        return;
+    }
+
+    /*-----------------------------------------------------*\
+    | The writer takes the changeset in its serialized      |
+    | form, as a byte array                                 |
+    \*-----------------------------------------------------*/
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a{smv}"));
+    g_variant_builder_add(&builder, "{smv}", OSK_ENABLED_KEY, g_variant_new_boolean(enabled));
+
+    changeset   = g_variant_ref_sink(g_variant_new("a{smv}", &builder));
+    data        = g_variant_get_data(changeset);
+    appended    = dbus_message_append_args(msg, DBUS_TYPE_ARRAY, DBUS_TYPE_BYTE, &data, (int)g_variant_get_size(changeset), DBUS_TYPE_INVALID);
+
+    g_variant_unref(changeset);
+
+    if(!appended)
+    {
+        dbus_message_unref(msg);
+        return;
+    }
+
+    if(send_osk_call(msg, &osk_enabled))
+    {
+        osk_enabled = enabled;
+        osk_changes_pending++;
+    }
+}
+
+/*---------------------------------------------------------*\
+| set_osk_visible                                           |
+|                                                           |
+| Show or hide the on-screen keyboard through OSK0          |
+\*---------------------------------------------------------*/
+
+void set_osk_visible(bool visible)
+{
+    dbus_bool_t     value = visible;
+    DBusMessage*    msg;
+
+    if(NULL == session_bus || osk_visible == visible)
+    {
+        return;
+    }
+
+    msg = dbus_message_new_method_call(OSK_NAME, OSK_PATH, OSK_NAME, "SetVisible");
+
+    if(NULL == msg)
+    {
+        return;
+    }
+
+    if(!dbus_message_append_args(msg, DBUS_TYPE_BOOLEAN, &value, DBUS_TYPE_INVALID))
+    {
+        dbus_message_unref(msg);
+        return;
+    }
+
+    if(send_osk_call(msg, &osk_visible))
+    {
+        osk_visible = visible;
+    }
+}
+
+/*---------------------------------------------------------*\
+| handle_osk_signal                                         |
+|                                                           |
+| D-Bus message filter that keeps the cached keyboard state |
+| in step with changes made by anyone else: OSK0's Visible  |
+| property, and dconf writes that may touch the key         |
+\*---------------------------------------------------------*/
+
+DBusHandlerResult handle_osk_signal(DBusConnection* conn, DBusMessage* msg, void* user_data)
+{
+    DBusMessageIter     args;
+    DBusMessageIter     changed;
+
+    if(dbus_message_is_signal(msg, DCONF_WRITER_INTERFACE, "Notify"))
+    {
+        const char*     prefix;
+        const char*     tag;
+        char**          keys;
+        int             num_keys;
+
+        if(dbus_message_get_args(msg, NULL,
+                                 DBUS_TYPE_STRING, &prefix,
+                                 DBUS_TYPE_ARRAY, DBUS_TYPE_STRING, &keys, &num_keys,
+                                 DBUS_TYPE_STRING, &tag,
+                                 DBUS_TYPE_INVALID))
+        {
+            /*---------------------------------------------*\
+            | Notifications for our own changes may arrive  |
+            | before their reply, so only trust the tag     |
+            | once no change is in flight                   |
+            \*---------------------------------------------*/
+            if(osk_changes_pending == 0
+            && strcmp(tag, osk_change_tag) != 0
+            && strncmp(OSK_ENABLED_KEY, prefix, strlen(prefix)) == 0)
+            {
+                osk_enabled = OSK_STATE_UNKNOWN;
+            }
+
+            dbus_free_string_array(keys);
+        }
+
+        return(DBUS_HANDLER_RESULT_HANDLED);
+    }
+
+    if(!dbus_message_is_signal(msg, DBUS_PROPERTIES_NAME, "PropertiesChanged")
+    || !dbus_message_has_path(msg, OSK_PATH))
+    {
+        return(DBUS_HANDLER_RESULT_NOT_YET_HANDLED);
+    }
+
+    if(!dbus_message_iter_init(msg, &args)
+    || !dbus_message_iter_next(&args)
+    || dbus_message_iter_get_arg_type(&args) != DBUS_TYPE_ARRAY)
+    {
+        return(DBUS_HANDLER_RESULT_NOT_YET_HANDLED);
+    }
+
+    dbus_message_iter_recurse(&args, &changed);
+
+    while(dbus_message_iter_get_arg_type(&changed) == DBUS_TYPE_DICT_ENTRY)
+    {
+        DBusMessageIter entry;
+        DBusMessageIter value;
+        char*           name;
+        dbus_bool_t     visible;
+
+        dbus_message_iter_recurse(&changed, &entry);
+        dbus_message_iter_get_basic(&entry, &name);
+
+        if(strcmp(name, "Visible") == 0
+        && dbus_message_iter_next(&entry)
+        && dbus_message_iter_get_arg_type(&entry) == DBUS_TYPE_VARIANT)
+        {
+            dbus_message_iter_recurse(&entry, &value);
+
+            if(dbus_message_iter_get_arg_type(&value) == DBUS_TYPE_BOOLEAN)
+            {
+                dbus_message_iter_get_basic(&value, &visible);
+
+                osk_visible = visible ? 1 : 0;
+            }
+        }
+
+        dbus_message_iter_next(&changed);
+    }
+
+    return(DBUS_HANDLER_RESULT_HANDLED);
+}
+
+/*---------------------------------------------------------*\
+| handle_session_bus                                        |
+|                                                           |
+| Dispatch keyboard replies and signals from the event loop |
+\*---------------------------------------------------------*/
+
+void handle_session_bus(event_source_type* source)
+{
+    dispatch_dbus(session_bus);
+}
+
+/*---------------------------------------------------------*\
+| connect_session_bus                                       |
+|                                                           |
+| Open the session bus connection used for keyboard control |
+| and add it to the event loop                              |
+\*---------------------------------------------------------*/
+
+bool connect_session_bus()
+{
+    DBusError   err;
+    int         fd;
+
+    dbus_error_init(&err);
+
+    session_bus = dbus_bus_get(DBUS_BUS_SESSION, &err);
+
+    if(dbus_error_is_set(&err))
+    {
+        fprintf(stderr, "Could not connect to the session bus: %s\n", err.message);
+        dbus_error_free(&err);
+    }
+
+    if(NULL == session_bus)
+    {
+        return(false);
+    }
+
+    dbus_connection_set_exit_on_disconnect(session_bus, false);
+
+    /*-----------------------------------------------------*\
+    | Without an error to fill in, the matches are added    |
+    | without waiting for the bus to reply                  |
+    \*-----------------------------------------------------*/
+    dbus_bus_add_match(session_bus,
+                       "type='signal',"
+                       "sender='" OSK_NAME "',"
+                       "path='" OSK_PATH "',"
+                       "interface='" DBUS_PROPERTIES_NAME "',"
+                       "member='PropertiesChanged'",
+                       NULL);
+
+    dbus_bus_add_match(session_bus,
+                       "type='signal',"
+                       "sender='" DCONF_WRITER_NAME "',"
+                       "path='" DCONF_WRITER_PATH "',"
+                       "interface='" DCONF_WRITER_INTERFACE "',"
+                       "member='Notify'",
+                       NULL);
+
+    dbus_connection_add_filter(session_bus, handle_osk_signal, NULL, NULL);
+
+    if(!dbus_connection_get_unix_fd(session_bus, &fd))
+    {
+        return(false);
+    }
+
+    add_event_source(&session_bus_source, fd, handle_session_bus);
+
+    return(true);
+}
+
+/*---------------------------------------------------------*\
+| disable_keyboard                                          |
+|                                                           |
+| Disable the on screen keyboard                            |
+\*---------------------------------------------------------*/
+
+void disable_keyboard()
+{
+    if(!no_keyboard)
+    {
+        set_osk_enabled(false);
+    }
+    keyboard_enable = 0;
+}
+
+/*---------------------------------------------------------*\
+| enable_keyboard                                           |
+|                                                           |
+| Enable the on screen keyboard                             |
+\*---------------------------------------------------------*/
+
+void enable_keyboard()
+{
+    if(!no_keyboard)
+    {
+        set_osk_enabled(true);
+        set_osk_visible(true);
+    }
+    keyboard_enable = 1;
+}
+
+/*---------------------------------------------------------*\
+| open_uinput                                               |
+|                                                           |
+| Creates the virtual mouse device                          |
+\*---------------------------------------------------------*/
+
+void open_uinput(int* fd)
+{
+    /*-----------------------------------------------------*\
+    | If virtual mouse is already opened, return            |
+    \*-----------------------------------------------------*/
+    if(*fd != 0)
+    {
+        return;
+    }
+
+    /*-----------------------------------------------------*\
+    | Open the uinput device                                |
+    \*-----------------------------------------------------*/
+    *fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+
+    /*-----------------------------------------------------*\
+    | Virtual mouse provides left and right keys; x, y, and |
+    | both wheel axes in legacy and high resolution units,  |
+    | and has direct property                               |
+    \*-----------------------------------------------------*/
+    ioctl(*fd, UI_SET_EVBIT,  EV_KEY);
+    ioctl(*fd, UI_SET_KEYBIT, BTN_LEFT);
+    ioctl(*fd, UI_SET_KEYBIT, BTN_RIGHT);
+
+    ioctl(*fd, UI_SET_EVBIT,  EV_REL);
+    ioctl(*fd, UI_SET_RELBIT, REL_X);
+    ioctl(*fd, UI_SET_RELBIT, REL_Y);
+    ioctl(*fd, UI_SET_RELBIT, REL_WHEEL);
+    ioctl(*fd, UI_SET_RELBIT, REL_HWHEEL);
+    ioctl(*fd, UI_SET_RELBIT, REL_WHEEL_HI_RES);
+    ioctl(*fd, UI_SET_RELBIT, REL_HWHEEL_HI_RES);
+
+    ioctl(*fd, UI_SET_PROPBIT, INPUT_PROP_DIRECT);
+
+    /*-----------------------------------------------------*\
+    | Set up virtual mouse device.  Use fake USB ID and name|
+    | it "Touchpad Emulator"                                |
+    \*-----------------------------------------------------*/
+    struct uinput_setup usetup;
+
+    memset(&usetup, 0, sizeof(usetup));
+
+    usetup.id.bustype = BUS_USB;
+    usetup.id.vendor  = 0x1234;
+    usetup.id.product = 0x5678;
+    strcpy(usetup.name, "Touchpad Emulator");
+
+    ioctl(*fd, UI_DEV_SETUP, &usetup);
+
+    /*-----------------------------------------------------*\
+    | Create the virtual mouse.  The cursor should appear   |
+    | on screen after this call.                            |
+    \*-----------------------------------------------------*/
+    ioctl(*fd, UI_DEV_CREATE);
+}
+
+/*---------------------------------------------------------*\
+| mirror_input_capabilities                                 |
+|                                                           |
+| Give a uinput device every key, switch, relative, absolute|
+| and misc code a grabbed input device supports, so that    |
+| the events it sends can be forwarded unchanged            |
+\*---------------------------------------------------------*/
+
+void mirror_input_capabilities(int fd, int source_fd)
+{
+    static const struct
+    {
+        unsigned int    type;
+        unsigned int    max;
+        unsigned long   set_bit;
+    } forwarded_types[] =
+    {
+        { EV_KEY,   KEY_MAX,    UI_SET_KEYBIT   },
+        { EV_SW,    SW_MAX,     UI_SET_SWBIT    },
+        { EV_REL,   REL_MAX,    UI_SET_RELBIT   },
+        { EV_ABS,   ABS_MAX,    UI_SET_ABSBIT   },
+        { EV_MSC,   MSC_MAX,    UI_SET_MSCBIT   },
+    };
+
+    unsigned long   type_bits[NBITS(EV_MAX)];
+    unsigned long   code_bits[NBITS(KEY_MAX)];
+    unsigned long   prop_bits[NBITS(INPUT_PROP_CNT)];
+
+    if(source_fd < 0)
+    {
+        return;
+    }
+
+    memset(type_bits, 0, sizeof(type_bits));
+
+    ioctl(source_fd, EVIOCGBIT(0, EV_MAX), type_bits);
+
+    for(unsigned int type_idx = 0; type_idx < NUM_EVENT_CODES(forwarded_types); type_idx++)
+    {
+        unsigned int type = forwarded_types[type_idx].type;
+
+        memset(code_bits, 0, sizeof(code_bits));
+
+        if(!test_bit(type, type_bits)
+        || ioctl(source_fd, EVIOCGBIT(type, KEY_MAX), code_bits) < 0)
+        {
+            continue;
+        }
+
+        ioctl(fd, UI_SET_EVBIT, type);
+
+        for(unsigned int code = 0; code <= forwarded_types[type_idx].max; code++)
+        {
+            if(!test_bit(code, code_bits))
+            {
+                continue;
+            }
+
+            ioctl(fd, forwarded_types[type_idx].set_bit, code);
+
+            /*---------------------------------------------*\
+            | Absolute axes also need their range           |
+            \*---------------------------------------------*/
+            if(type == EV_ABS)
+            {
+                struct uinput_abs_setup abs_setup;
+
+                memset(&abs_setup, 0, sizeof(abs_setup));
+
+                abs_setup.code = code;
+
+                if(ioctl(source_fd, EVIOCGABS(code), &abs_setup.absinfo) == 0)
+                {
+                    ioctl(fd, UI_ABS_SETUP, &abs_setup);
+                }
+            }
+        }
+    }
+
+    memset(prop_bits, 0, sizeof(prop_bits));
+
+    if(ioctl(source_fd, EVIOCGPROP(sizeof(prop_bits)), prop_bits) >= 0)
+    {
+        for(unsigned int prop = 0; prop < INPUT_PROP_CNT; prop++)
+        {
+            if(test_bit(prop, prop_bits))
+            {
+                ioctl(fd, UI_SET_PROPBIT, prop);
+            }
+        }
+    }
+}
+
+void open_virtual_buttons(int* fd)
+{
+    /*-----------------------------------------------------*\
+    | If virtual buttons is already opened, return          |
+    \*-----------------------------------------------------*/
+    if(*fd != 0)
+    {
+        return;
+    }
+
+    /*-----------------------------------------------------*\
+    | Open the uinput device                                |
+    \*-----------------------------------------------------*/
+    *fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+
+    /*-----------------------------------------------------*\
+    | Virtual buttons provides volume up and down keys, and |
+    | everything else the grabbed button devices can send   |
+    \*-----------------------------------------------------*/
+    ioctl(*fd, UI_SET_EVBIT,  EV_KEY);
+    ioctl(*fd, UI_SET_KEYBIT, KEY_VOLUMEUP);
+    ioctl(*fd, UI_SET_KEYBIT, KEY_VOLUMEDOWN);
+
+    mirror_input_capabilities(*fd, button_0_fd);
+
+    if(button_1_fd != button_0_fd)
+    {
+        mirror_input_capabilities(*fd, button_1_fd);
+    }
+
+    /*-----------------------------------------------------*\
+    | Set up virtual buttons device.  Use fake USB ID and   |
+    |name it "Touchpad Emulator Buttons"                    |
+    \*-----------------------------------------------------*/
+    struct uinput_setup usetup;
+
+    memset(&usetup, 0, sizeof(usetup));
+
+    usetup.id.bustype = BUS_USB;
+    usetup.id.vendor  = 0x1234;
+    usetup.id.product = 0x5678;
+    strcpy(usetup.name, "Touchpad Emulator Buttons");
+
+    ioctl(*fd, UI_DEV_SETUP, &usetup);
+
+    /*-----------------------------------------------------*\
+    | Create the virtual buttons                            |
+    \*-----------------------------------------------------*/
+    ioctl(*fd, UI_DEV_CREATE);
+}
+
+/*---------------------------------------------------------*\
+| close_uinput                                              |
+|                                                           |
+| Closes the virtual mouse device                           |
+\*---------------------------------------------------------*/
+
+void close_uinput(int* fd)
+{
+    /*-----------------------------------------------------*\
+    | If virtual mouse is not opened, return                |
+    \*-----------------------------------------------------*/
+    if(*fd <= 0)
+    {
+        *fd = 0;
+        return;
+    }
+
+    /*-----------------------------------------------------*\
+    | Destroy the virtual mouse.  The cursor should         |
+    | disappear from the screen after this call if no other |
+    | mice are present.  Submit any writes still queued for |
+    | it first.                                             |
+    \*-----------------------------------------------------*/
+    if(use_io_uring)
+    {
+        uring_submit(false);
+    }
+
+    ioctl(*fd, UI_DEV_DESTROY);
+    close(*fd);
+
+    *fd = 0;
+}
+
+/*---------------------------------------------------------*\
+| reset_pointer_accel                                       |
+|                                                           |
+| Forget the velocity history and sub-pixel remainders so   |
+| a new contact does not inherit the previous one's motion  |
+\*---------------------------------------------------------*/
+
+void reset_pointer_accel()
+{
+    touchpad->pointer_accel.history_head  = 0;
+    touchpad->pointer_accel.history_count = 0;
+    touchpad->pointer_accel.remainder_x   = 0.0f;
+    touchpad->pointer_accel.remainder_y   = 0.0f;
+}
+
+/*---------------------------------------------------------*\
+| pointer_accel_velocity                                    |
+|                                                           |
+| Speed of the contact in millimetres per millisecond over  |
+| the samples inside the velocity window                    |
+\*---------------------------------------------------------*/
+
+float pointer_accel_velocity(struct timeval* frame_time)
+{
+    float           distance = 0.0f;
+    unsigned int    elapsed  = 0;
+
+    for(int sample_idx = 0; sample_idx < touchpad->pointer_accel.history_count; sample_idx++)
+    {
+        int                 history_idx = (touchpad->pointer_accel.history_head + ACCEL_HISTORY_SIZE - 1 - sample_idx) % ACCEL_HISTORY_SIZE;
+        motion_sample_type* sample      = &touchpad->pointer_accel.history[history_idx];
+        struct timeval      age;
+
+        timersub(frame_time, &sample->time, &age);
+
+        unsigned int usec = (age.tv_sec * 1000000) + age.tv_usec;
+
+        if(age.tv_sec < 0 || usec > ACCEL_WINDOW_USEC)
+        {
+            break;
+        }
+
+        distance += hypotf(sample->delta_x, sample->delta_y);
+        elapsed   = usec;
+    }
+
+    /*-----------------------------------------------------*\
+    | The newest sample's own duration is unknown, so count |
+    | at least one typical 60Hz frame for it                |
+    \*-----------------------------------------------------*/
+    if(elapsed < 16667)
+    {
+        elapsed = 16667;
+    }
+
+    return distance / (elapsed / 1000.0f);
+}
+
+/*---------------------------------------------------------*\
+| accelerate_motion                                         |
+|                                                           |
+| Scale a motion delta in mm by the current acceleration    |
+| factor and return the whole pixels to move, keeping       |
+| fractions in the remainders                               |
+\*---------------------------------------------------------*/
+
+void accelerate_motion(float delta_x, float delta_y, struct timeval* frame_time, int* out_x, int* out_y)
+{
+    motion_sample_type* sample = &touchpad->pointer_accel.history[touchpad->pointer_accel.history_head];
+
+    sample->delta_x = delta_x;
+    sample->delta_y = delta_y;
+    sample->time    = *frame_time;
+
+    touchpad->pointer_accel.history_head = (touchpad->pointer_accel.history_head + 1) % ACCEL_HISTORY_SIZE;
+
+    if(touchpad->pointer_accel.history_count < ACCEL_HISTORY_SIZE)
+    {
+        touchpad->pointer_accel.history_count++;
+    }
+
+    /*-----------------------------------------------------*\
+    | Choose the factor for this frame                      |
+    \*-----------------------------------------------------*/
+    float factor = touchpad->pointer_accel.speed * POINTER_PIXELS_PER_MM;
+
+    if(touchpad->pointer_accel.profile == ACCEL_PROFILE_ADAPTIVE)
+    {
+        float velocity = pointer_accel_velocity(frame_time);
+
+        if(velocity > touchpad->pointer_accel.threshold)
+        {
+            float gain = 1.0f + ((velocity - touchpad->pointer_accel.threshold) * touchpad->pointer_accel.incline);
+
+            if(gain > touchpad->pointer_accel.max_factor)
+            {
+                gain = touchpad->pointer_accel.max_factor;
+            }
+
+            factor *= gain;
+        }
+    }
+
+    /*-----------------------------------------------------*\
+    | Apply it, carrying the fractional part forward        |
+    \*-----------------------------------------------------*/
+    float scaled_x = (delta_x * factor) + touchpad->pointer_accel.remainder_x;
+    float scaled_y = (delta_y * factor) + touchpad->pointer_accel.remainder_y;
+
+    *out_x = (int)scaled_x;
+    *out_y = (int)scaled_y;
+
+    touchpad->pointer_accel.last_factor = factor;
+
+    touchpad->pointer_accel.remainder_x = scaled_x - *out_x;
+    touchpad->pointer_accel.remainder_y = scaled_y - *out_y;
+}
+
+/*---------------------------------------------------------*\
+| queue_pointer_motion                                      |
+|                                                           |
+| Queue pointer motion along the screen axes                |
+\*---------------------------------------------------------*/
+
+void queue_pointer_motion(int pixels_x, int pixels_y)
+{
+    queue_motion(REL_X, pixels_x);
+    queue_motion(REL_Y, pixels_y);
+}
+
+/*---------------------------------------------------------*\
+| retract_prediction                                        |
+|                                                           |
+| Move the pointer back by any prediction lead shown, so it |
+| ends where the finger actually is                         |
+\*---------------------------------------------------------*/
+
+void retract_prediction()
+{
+    queue_pointer_motion(-touchpad->prediction.shown_x, -touchpad->prediction.shown_y);
+
+    touchpad->prediction.have_velocity = false;
+    touchpad->prediction.shown_x       = 0;
+    touchpad->prediction.shown_y       = 0;
+}
+
+/*---------------------------------------------------------*\
+| predict_motion                                            |
+|                                                           |
+| Update the velocity estimate with a frame's motion in mm  |
+| and return the change in pointer lead, in pixels, to      |
+| send along with that motion                               |
+\*---------------------------------------------------------*/
+
+void predict_motion(float delta_x, float delta_y, struct timeval* frame_time, int* lead_x, int* lead_y)
+{
+    struct timeval  elapsed;
+    float           target_x = 0.0f;
+    float           target_y = 0.0f;
+
+    timersub(frame_time, &touchpad->prediction.time, &elapsed);
+
+    float period = (elapsed.tv_sec * 1000.0f) + (elapsed.tv_usec / 1000.0f);
+
+    touchpad->prediction.time = *frame_time;
+
+    if(period > 0.0f && period < 100.0f)
+    {
+        float velocity_x = delta_x / period;
+        float velocity_y = delta_y / period;
+        float speed      = hypotf(velocity_x, velocity_y);
+
+        /*-------------------------------------------------*\
+        | Extrapolate only while moving steadily, not while |
+        | reversing or coming to rest                       |
+        \*-------------------------------------------------*/
+        if(touchpad->prediction.have_velocity && speed > PREDICT_MIN_SPEED
+        && ((velocity_x * touchpad->prediction.velocity_x) + (velocity_y * touchpad->prediction.velocity_y)) > 0.0f)
+        {
+            float accel_x = (velocity_x - touchpad->prediction.velocity_x) / period;
+            float accel_y = (velocity_y - touchpad->prediction.velocity_y) / period;
+            float horizon = touchpad->prediction.horizon;
+
+            target_x = (velocity_x * horizon) + (0.5f * accel_x * horizon * horizon);
+            target_y = (velocity_y * horizon) + (0.5f * accel_y * horizon * horizon);
+
+            /*---------------------------------------------*\
+            | Deceleration may shorten the lead but not     |
+            | reverse it, and acceleration may not push it  |
+            | past straight-line extrapolation              |
+            \*---------------------------------------------*/
+            float along = ((target_x * velocity_x) + (target_y * velocity_y)) / speed;
+            float limit = speed * horizon;
+
+            if(along <= 0.0f)
+            {
+                target_x = 0.0f;
+                target_y = 0.0f;
+            }
+            else if(hypotf(target_x, target_y) > limit)
+            {
+                float scale = limit / hypotf(target_x, target_y);
+
+                target_x *= scale;
+                target_y *= scale;
+            }
+        }
+
+        touchpad->prediction.velocity_x    = velocity_x;
+        touchpad->prediction.velocity_y    = velocity_y;
+        touchpad->prediction.have_velocity = true;
+    }
+    else
+    {
+        touchpad->prediction.have_velocity = false;
+    }
+
+    /*-----------------------------------------------------*\
+    | Send the difference from the lead already shown,      |
+    | which corrects the previous guess                     |
+    \*-----------------------------------------------------*/
+    int shown_x = lroundf(target_x * touchpad->pointer_accel.last_factor);
+    int shown_y = lroundf(target_y * touchpad->pointer_accel.last_factor);
+
+    *lead_x = shown_x - touchpad->prediction.shown_x;
+    *lead_y = shown_y - touchpad->prediction.shown_y;
+
+    touchpad->prediction.shown_x = shown_x;
+    touchpad->prediction.shown_y = shown_y;
+}
+
+/*---------------------------------------------------------*\
+| reset_scroll                                              |
+|                                                           |
+| Start a new two-finger scroll with no carried fractions   |
+| or axis lock                                              |
+\*---------------------------------------------------------*/
+
+void reset_scroll()
+{
+    touchpad->scroll.locked_axis      = SCROLL_AXIS_NONE;
+    touchpad->scroll.travel_v         = 0.0f;
+    touchpad->scroll.travel_h         = 0.0f;
+    touchpad->scroll.remainder_v      = 0.0f;
+    touchpad->scroll.remainder_h      = 0.0f;
+    touchpad->scroll.detent_v         = 0;
+    touchpad->scroll.detent_h         = 0;
+    touchpad->scroll.history_head     = 0;
+    touchpad->scroll.history_count    = 0;
+    touchpad->scroll.velocity_v       = 0.0f;
+    touchpad->scroll.velocity_h       = 0.0f;
+}
+
+/*---------------------------------------------------------*\
+| queue_scroll                                              |
+|                                                           |
+| Queue scrolling by a distance in mm on one wheel axis as  |
+| high resolution units, plus a legacy click for each full  |
+| detent accumulated                                        |
+\*---------------------------------------------------------*/
+
+void queue_scroll(float delta_mm, float* remainder, int* detent, int hi_res_code, int code)
+{
+    float hi_res = ((delta_mm / SCROLL_STEP_MM) * SCROLL_HI_RES_PER_DETENT) + *remainder;
+    int   units  = (int)hi_res;
+
+    *remainder = hi_res - units;
+
+    /*-----------------------------------------------------*\
+    | A change of direction restarts the partial detent     |
+    \*-----------------------------------------------------*/
+    if((units > 0 && *detent < 0) || (units < 0 && *detent > 0))
+    {
+        *detent = 0;
+    }
+
+    *detent += units;
+
+    int clicks = *detent / SCROLL_HI_RES_PER_DETENT;
+
+    *detent -= clicks * SCROLL_HI_RES_PER_DETENT;
+
+    queue_motion(hi_res_code, units);
+    queue_motion(code, clicks);
+}
+
+/*---------------------------------------------------------*\
+| record_scroll                                             |
+|                                                           |
+| Add a frame's scroll distance to the history used to find |
+| the release velocity                                      |
+\*---------------------------------------------------------*/
+
+void record_scroll(float delta_v, float delta_h, struct timeval* frame_time)
+{
+    motion_sample_type* sample = &touchpad->scroll.history[touchpad->scroll.history_head];
+
+    sample->delta_x = delta_h;
+    sample->delta_y = delta_v;
+    sample->time    = *frame_time;
+
+    touchpad->scroll.history_head = (touchpad->scroll.history_head + 1) % ACCEL_HISTORY_SIZE;
+
+    if(touchpad->scroll.history_count < ACCEL_HISTORY_SIZE)
+    {
+        touchpad->scroll.history_count++;
+    }
+}
+
+/*---------------------------------------------------------*\
+| measure_scroll_release                                    |
+|                                                           |
+| Record the scroll velocity as the fingers lift, from the  |
+| scrolling done in the last KINETIC_WINDOW_USEC.  Fingers  |
+| that paused before lifting give a low velocity            |
+\*---------------------------------------------------------*/
+
+void measure_scroll_release(struct timeval* frame_time)
+{
+    float           distance_v  = 0.0f;
+    float           distance_h  = 0.0f;
+    unsigned int    elapsed     = 0;
+
+    for(int sample_idx = 0; sample_idx < touchpad->scroll.history_count; sample_idx++)
+    {
+        int                 history_idx = (touchpad->scroll.history_head + ACCEL_HISTORY_SIZE - 1 - sample_idx) % ACCEL_HISTORY_SIZE;
+        motion_sample_type* sample      = &touchpad->scroll.history[history_idx];
+        struct timeval      age;
+
+        timersub(frame_time, &sample->time, &age);
+
+        if(age.tv_sec < 0 || age.tv_sec > 0 || age.tv_usec > KINETIC_WINDOW_USEC)
+        {
+            break;
+        }
+
+        distance_v += sample->delta_y;
+        distance_h += sample->delta_x;
+        elapsed     = age.tv_usec;
+    }
+
+    if(elapsed < KINETIC_INTERVAL_USEC)
+    {
+        elapsed = KINETIC_INTERVAL_USEC;
+    }
+
+    touchpad->scroll.velocity_v   = distance_v / (elapsed / 1000.0f);
+    touchpad->scroll.velocity_h   = distance_h / (elapsed / 1000.0f);
+    touchpad->scroll.release_time = *frame_time;
+
+    touchpad->scroll.history_count = 0;
+}
+
+/*---------------------------------------------------------*\
+| start_kinetic_scroll                                      |
+|                                                           |
+| Keep scrolling after the touchscreen is released if the   |
+| fingers lifted recently and fast enough                   |
+\*---------------------------------------------------------*/
+
+void start_kinetic_scroll(struct timeval* frame_time)
+{
+    struct timeval since_release;
+
+    timersub(frame_time, &touchpad->scroll.release_time, &since_release);
+
+    if(!touchpad->scroll.kinetic_enable || since_release.tv_sec != 0 || since_release.tv_usec > KINETIC_WINDOW_USEC)
+    {
+        return;
+    }
+
+    if(hypotf(touchpad->scroll.velocity_v, touchpad->scroll.velocity_h) < KINETIC_START_SPEED)
+    {
+        return;
+    }
+
+    touchpad->scroll.kinetic = true;
+
+    clock_gettime(CLOCK_MONOTONIC, &touchpad->scroll.kinetic_time);
+
+    start_periodic_timer(&touchpad->kinetic_timer, KINETIC_INTERVAL_USEC);
+}
+
+/*---------------------------------------------------------*\
+| stop_kinetic_scroll                                       |
+|                                                           |
+| End kinetic scrolling                                     |
+\*---------------------------------------------------------*/
+
+void stop_kinetic_scroll()
+{
+    if(touchpad->scroll.kinetic)
+    {
+        touchpad->scroll.kinetic      = false;
+        touchpad->scroll.velocity_v   = 0.0f;
+        touchpad->scroll.velocity_h   = 0.0f;
+
+        stop_timer(&touchpad->kinetic_timer);
+    }
+}
+
+/*---------------------------------------------------------*\
+| multiply_transform                                        |
+|                                                           |
+| Compose two affine transforms, applying first then second |
+\*---------------------------------------------------------*/
+
+transform_type multiply_transform(const transform_type* second, const transform_type* first)
+{
+    const float*    a = second->m;
+    const float*    b = first->m;
+    transform_type  result;
+
+    result.m[0] = (a[0] * b[0]) + (a[1] * b[3]);
+    result.m[1] = (a[0] * b[1]) + (a[1] * b[4]);
+    result.m[2] = (a[0] * b[2]) + (a[1] * b[5]) + a[2];
+    result.m[3] = (a[3] * b[0]) + (a[4] * b[3]);
+    result.m[4] = (a[3] * b[1]) + (a[4] * b[4]);
+    result.m[5] = (a[3] * b[2]) + (a[4] * b[5]) + a[5];
+
+    return result;
+}
+
+/*---------------------------------------------------------*\
+| update_touch_transform                                    |
+|                                                           |
+| Rebuild the device units to screen mm transform for the   |
+| current rotation.  Each screen axis is scaled by the      |
+| length of the panel that maps onto it                     |
+\*---------------------------------------------------------*/
+
+void update_touch_transform()
+{
+    float range_x   = (touchpad->max_x.maximum > touchpad->max_x.minimum) ? (touchpad->max_x.maximum - touchpad->max_x.minimum) : 1.0f;
+    float range_y   = (touchpad->max_y.maximum > touchpad->max_y.minimum) ? (touchpad->max_y.maximum - touchpad->max_y.minimum) : 1.0f;
+    float width_mm  = range_x / touchpad->units_per_mm_x;
+    float height_mm = range_y / touchpad->units_per_mm_y;
+
+    transform_type normalize =
+    { {
+        1.0f / range_x, 0.0f,           -touchpad->max_x.minimum / range_x,
+        0.0f,           1.0f / range_y, -touchpad->max_y.minimum / range_y
+    } };
+
+    transform_type display  = multiply_transform(&touchpad->calibration_matrix, &normalize);
+    transform_type oriented = multiply_transform(&orientation_matrices[(touchpad->rotation / 90) & 3], &display);
+
+    /*-----------------------------------------------------*\
+    | The normalized to screen part, without the panel      |
+    | normalization, decides which panel length each screen |
+    | axis spans                                            |
+    \*-----------------------------------------------------*/
+    transform_type layout = multiply_transform(&orientation_matrices[(touchpad->rotation / 90) & 3], &touchpad->calibration_matrix);
+
+    float screen_w = (fabsf(layout.m[0]) * width_mm) + (fabsf(layout.m[1]) * height_mm);
+    float screen_h = (fabsf(layout.m[3]) * width_mm) + (fabsf(layout.m[4]) * height_mm);
+
+    transform_type scale = { { screen_w, 0.0f, 0.0f, 0.0f, screen_h, 0.0f } };
+
+    touchpad->touch_transform          = multiply_transform(&scale, &oriented);
+    touchpad->touch_transform_rotation = touchpad->rotation;
+}
+
+/*---------------------------------------------------------*\
+| transform_slot_position                                   |
+|                                                           |
+| Map a contact's filtered position onto the screen axes    |
+\*---------------------------------------------------------*/
+
+void transform_slot_position(touch_slot_type* slot)
+{
+    const float* m = touchpad->touch_transform.m;
+
+    slot->screen_x = (m[0] * slot->filter.x) + (m[1] * slot->filter.y) + m[2];
+    slot->screen_y = (m[3] * slot->filter.x) + (m[4] * slot->filter.y) + m[5];
+}
+
+/*---------------------------------------------------------*\
+| jitter_filter_alpha                                       |
+|                                                           |
+| Smoothing factor of a first order low-pass filter with    |
+| the given cutoff for a sample period in seconds           |
+\*---------------------------------------------------------*/
+
+float jitter_filter_alpha(float cutoff, float period)
+{
+    float tau = 1.0f / (2.0f * (float)M_PI * cutoff);
+
+    return 1.0f / (1.0f + (tau / period));
+}
+
+/*---------------------------------------------------------*\
+| filter_slot_position                                      |
+|                                                           |
+| Update a contact's filtered position from its latest raw  |
+| position.  The first sample of a contact is taken as is   |
+\*---------------------------------------------------------*/
+
+void filter_slot_position(touch_slot_type* slot, struct timeval* frame_time)
+{
+    jitter_filter_type* filter = &slot->filter;
+
+    if(!jitter_filter.enable || !filter->initialized)
+    {
+        filter->initialized = true;
+        filter->x           = slot->x;
+        filter->y           = slot->y;
+        filter->speed_x     = 0.0f;
+        filter->speed_y     = 0.0f;
+        filter->time        = *frame_time;
+        return;
+    }
+
+    /*-----------------------------------------------------*\
+    | Time since the previous sample, assuming a 60Hz panel |
+    | if the timestamps are unusable                        |
+    \*-----------------------------------------------------*/
+    struct timeval elapsed;
+
+    timersub(frame_time, &filter->time, &elapsed);
+
+    float period = elapsed.tv_sec + (elapsed.tv_usec / 1000000.0f);
+
+    if(period <= 0.0f || period > 1.0f)
+    {
+        period = 1.0f / 60.0f;
+    }
+
+    filter->time = *frame_time;
+
+    /*-----------------------------------------------------*\
+    | Smooth the speed, then pick the position cutoff from  |
+    | it                                                    |
+    \*-----------------------------------------------------*/
+    float speed_alpha = jitter_filter_alpha(jitter_filter.d_cutoff, period);
+
+    float raw_speed_x = ((slot->x - filter->x) / touchpad->units_per_mm_x) / period;
+    float raw_speed_y = ((slot->y - filter->y) / touchpad->units_per_mm_y) / period;
+
+    filter->speed_x += speed_alpha * (raw_speed_x - filter->speed_x);
+    filter->speed_y += speed_alpha * (raw_speed_y - filter->speed_y);
+
+    float cutoff = jitter_filter.min_cutoff + (jitter_filter.beta * hypotf(filter->speed_x, filter->speed_y));
+    float alpha  = jitter_filter_alpha(cutoff, period);
+
+    filter->x += alpha * (slot->x - filter->x);
+    filter->y += alpha * (slot->y - filter->y);
+}
+
+/*---------------------------------------------------------*\
+| feed_gesture                                              |
+|                                                           |
+| Advance the current touchpad's gesture recognizer by one  |
+| input and emit the actions of the transition taken        |
+\*---------------------------------------------------------*/
+
+void feed_gesture(int input)
+{
+    gesture_type*                   gesture     = &touchpad->gesture;
+    const gesture_transition_type*  transition  = &gesture_transitions[gesture->state][input];
+
+    if(!transition->valid)
+    {
+        return;
+    }
+
+    /*-----------------------------------------------------*\
+    | Leaving a state cancels the timer it armed            |
+    \*-----------------------------------------------------*/
+    if(transition->next_state != gesture->state)
+    {
+        if(gesture->state == GESTURE_STATE_TOUCH)
+        {
+            stop_timer(&touchpad->drag_timer);
+        }
+        else if(gesture->state == GESTURE_STATE_TAP_WAIT)
+        {
+            stop_timer(&touchpad->tap_timer);
+        }
+
+        gesture->state = transition->next_state;
+    }
+
+    if(transition->actions & GESTURE_ACTION_CLICK)
+    {
+        queue_event(&touchpad->mouse_frame, EV_KEY, BTN_LEFT, 1);
+        queue_sync(&touchpad->mouse_frame);
+        queue_event(&touchpad->mouse_frame, EV_KEY, BTN_LEFT, 0);
+    }
+
+    if(transition->actions & GESTURE_ACTION_RIGHT_CLICK)
+    {
+        queue_event(&touchpad->mouse_frame, EV_KEY, BTN_RIGHT, 1);
+        queue_sync(&touchpad->mouse_frame);
+        queue_event(&touchpad->mouse_frame, EV_KEY, BTN_RIGHT, 0);
+    }
+
+    if(transition->actions & GESTURE_ACTION_BUTTON_DOWN)
+    {
+        queue_event(&touchpad->mouse_frame, EV_KEY, BTN_LEFT, 1);
+    }
+
+    if(transition->actions & GESTURE_ACTION_BUTTON_UP)
+    {
+        queue_event(&touchpad->mouse_frame, EV_KEY, BTN_LEFT, 0);
+    }
+
+    if(transition->actions & GESTURE_ACTION_START_HOLD)
+    {
+        start_timer(&touchpad->drag_timer, gesture->hold_drag_usec);
+    }
+
+    if(transition->actions & GESTURE_ACTION_START_TAP_WAIT)
+    {
+        start_timer(&touchpad->tap_timer, gesture->tap_drag_usec);
+    }
+}
+
+/*---------------------------------------------------------*\
+| within_tap_time                                           |
+|                                                           |
+| Check if less than the tap time has passed since a time   |
+\*---------------------------------------------------------*/
+
+bool within_tap_time(struct timeval* frame_time, struct timeval* since)
+{
+    struct timeval ret_time;
+    timersub(frame_time, since, &ret_time);
+
+    return(ret_time.tv_sec >= 0 && ((unsigned int)ret_time.tv_sec * 1000000) + ret_time.tv_usec < touchpad->gesture.tap_usec);
+}
+
+/*---------------------------------------------------------*\
+| touch_pressed                                             |
+|                                                           |
+| Handle the touchscreen being pressed (BTN_TOUCH down)     |
+\*---------------------------------------------------------*/
+
+void touch_pressed(struct timeval* frame_time)
+{
+    /*-----------------------------------------------------*\
+    | Set touch active flag and record the activated time   |
+    \*-----------------------------------------------------*/
+    touchpad->touch_active          = 1;
+    touchpad->gesture.touch_time    = *frame_time;
+
+    /*-----------------------------------------------------*\
+    | A new touch catches any kinetic scroll still running  |
+    \*-----------------------------------------------------*/
+    stop_kinetic_scroll();
+
+    feed_gesture(touchpad->fingers <= 1 ? GESTURE_INPUT_TOUCH_DOWN : GESTURE_INPUT_TOUCH_DOWN_MULTI);
+
+    /*-----------------------------------------------------*\
+    | Set the initialize previous position flag             |
+    \*-----------------------------------------------------*/
+    touchpad->init_prev = 1;
+}
+
+/*---------------------------------------------------------*\
+| touch_released                                            |
+|                                                           |
+| Handle the touchscreen being released (BTN_TOUCH up)      |
+\*---------------------------------------------------------*/
+
+void touch_released(struct timeval* frame_time)
+{
+    /*-----------------------------------------------------*\
+    | Clear touch active flag                               |
+    \*-----------------------------------------------------*/
+    touchpad->touch_active = 0;
+
+    feed_gesture(within_tap_time(frame_time, &touchpad->gesture.touch_time) ? GESTURE_INPUT_TAP_UP : GESTURE_INPUT_TOUCH_UP);
+
+    /*-----------------------------------------------------*\
+    | If two fingers were scrolling as they lifted, keep    |
+    | scrolling with decaying velocity                      |
+    \*-----------------------------------------------------*/
+    start_kinetic_scroll(frame_time);
+}
+
+/*---------------------------------------------------------*\
+| finger_pressed                                            |
+|                                                           |
+| Handle a new contact appearing in a slot                  |
+\*---------------------------------------------------------*/
+
+void finger_pressed(struct timeval* frame_time)
+{
+    /*-----------------------------------------------------*\
+    | Increment finger count                                |
+    \*-----------------------------------------------------*/
+    touchpad->fingers++;
+
+    if(touchpad->fingers > 1)
+    {
+        feed_gesture(GESTURE_INPUT_FINGER_DOWN);
+    }
+
+    /*-----------------------------------------------------*\
+    | If there are two fingers active, record two finger    |
+    | active time and set previous wheel initialization     |
+    | flag                                                  |
+    \*-----------------------------------------------------*/
+    if(touchpad->fingers == 2)
+    {
+        retract_prediction();
+
+        touchpad->gesture.two_finger_time = *frame_time;
+        touchpad->init_prev_wheel = 1;
+    }
+}
+
+/*---------------------------------------------------------*\
+| finger_released                                           |
+|                                                           |
+| Handle a contact lifting from a slot                      |
+\*---------------------------------------------------------*/
+
+void finger_released(struct timeval* frame_time)
+{
+    /*-----------------------------------------------------*\
+    | The pointer should stop where the finger lifted       |
+    \*-----------------------------------------------------*/
+    retract_prediction();
+
+    if(touchpad->fingers == 2)
+    {
+        /*-------------------------------------------------*\
+        | Lifting one of two fingers soon after the second  |
+        | landed is a two finger tap                        |
+        \*-------------------------------------------------*/
+        feed_gesture(within_tap_time(frame_time, &touchpad->gesture.two_finger_time) ? GESTURE_INPUT_FINGER_TAP_UP : GESTURE_INPUT_FINGER_UP);
+
+        /*-------------------------------------------------*\
+        | Remember how fast the scroll was moving in case   |
+        | the touchscreen is released for kinetic scrolling |
+        \*-------------------------------------------------*/
+        measure_scroll_release(frame_time);
+
+        /*-------------------------------------------------*\
+        | Set the initialize previous position flag         |
+        \*-------------------------------------------------*/
+        touchpad->init_prev = 1;
+    }
+    else if(touchpad->fingers > 2)
+    {
+        feed_gesture(GESTURE_INPUT_FINGER_UP);
+    }
+
+    /*-----------------------------------------------------*\
+    | Decrement finger count.  Sanity check, fingers on     |
+    | screen cannot be less than zero                       |
+    \*-----------------------------------------------------*/
+    touchpad->fingers--;
+
+    if(touchpad->fingers < 0)
+    {
+        touchpad->fingers = 0;
+    }
+}
+
+/*---------------------------------------------------------*\
+| process_touch_motion                                      |
+|                                                           |
+| Move the mouse cursor or the scroll wheel from the        |
+| position of the primary contact                           |
+\*---------------------------------------------------------*/
+
+void process_touch_motion(struct timeval* frame_time)
+{
+    touch_slot_type* slot = &touchpad->touch.slots[touchpad->touch.primary_slot];
+
+    /*-----------------------------------------------------*\
+    | The contact moving beyond the slop since touch        |
+    | activated ends any tap or hold                        |
+    \*-----------------------------------------------------*/
+    if(touchpad->init_prev)
+    {
+        touchpad->gesture.down_x = slot->screen_x;
+        touchpad->gesture.down_y = slot->screen_y;
+    }
+    else if(hypotf(slot->screen_x - touchpad->gesture.down_x, slot->screen_y - touchpad->gesture.down_y) > touchpad->gesture.slop_mm)
+    {
+        feed_gesture(GESTURE_INPUT_MOVE);
+    }
+
+    /*-----------------------------------------------------*\
+    | Motion in mm along the screen axes                    |
+    \*-----------------------------------------------------*/
+    float delta_x = slot->screen_x - touchpad->prev_x;
+    float delta_y = slot->screen_y - touchpad->prev_y;
+
+    /*-----------------------------------------------------*\
+    | If one finger is on the screen, move the mouse cursor |
+    \*-----------------------------------------------------*/
+    if(touchpad->fingers == 1)
+    {
+        if(touchpad->init_prev)
+        {
+            reset_pointer_accel();
+            retract_prediction();
+
+            touchpad->prediction.time = *frame_time;
+        }
+        else
+        {
+            int pixels_x;
+            int pixels_y;
+
+            accelerate_motion(delta_x, delta_y, frame_time, &pixels_x, &pixels_y);
+
+            if(touchpad->prediction.horizon > 0.0f)
+            {
+                int lead_x;
+                int lead_y;
+
+                predict_motion(delta_x, delta_y, frame_time, &lead_x, &lead_y);
+
+                pixels_x += lead_x;
+                pixels_y += lead_y;
+
+                if(touchpad->prediction.shown_x != 0 || touchpad->prediction.shown_y != 0)
+                {
+                    start_timer(&touchpad->prediction_timer, PREDICT_SETTLE_USEC);
+                }
+            }
+
+            queue_pointer_motion(pixels_x, pixels_y);
+        }
+
+        touchpad->init_prev = 0;
+    }
+
+    /*-----------------------------------------------------*\
+    | Otherwise, if two fingers are on the screen, scroll   |
+    | along the on-screen axes, content following fingers   |
+    \*-----------------------------------------------------*/
+    else if(touchpad->fingers == 2)
+    {
+        if(touchpad->init_prev_wheel)
+        {
+            reset_scroll();
+            touchpad->init_prev_wheel = 0;
+        }
+        else
+        {
+            float scroll_v =  delta_y;
+            float scroll_h = -delta_x;
+
+            /*---------------------------------------------*\
+            | Lock onto the first axis to travel far enough |
+            \*---------------------------------------------*/
+            if(touchpad->scroll.lock_axis)
+            {
+                if(touchpad->scroll.locked_axis == SCROLL_AXIS_NONE)
+                {
+                    touchpad->scroll.travel_v += scroll_v;
+                    touchpad->scroll.travel_h += scroll_h;
+
+                    if(fabsf(touchpad->scroll.travel_v) >= SCROLL_LOCK_MM || fabsf(touchpad->scroll.travel_h) >= SCROLL_LOCK_MM)
+                    {
+                        touchpad->scroll.locked_axis = (fabsf(touchpad->scroll.travel_v) >= fabsf(touchpad->scroll.travel_h)) ? SCROLL_AXIS_VERTICAL : SCROLL_AXIS_HORIZONTAL;
+                    }
+                }
+
+                if(touchpad->scroll.locked_axis != SCROLL_AXIS_VERTICAL)
+                {
+                    scroll_v = 0.0f;
+                }
+
+                if(touchpad->scroll.locked_axis != SCROLL_AXIS_HORIZONTAL)
+                {
+                    scroll_h = 0.0f;
+                }
+            }
+
+            queue_scroll(scroll_v, &touchpad->scroll.remainder_v, &touchpad->scroll.detent_v, REL_WHEEL_HI_RES,  REL_WHEEL);
+            queue_scroll(scroll_h, &touchpad->scroll.remainder_h, &touchpad->scroll.detent_h, REL_HWHEEL_HI_RES, REL_HWHEEL);
+
+            record_scroll(scroll_v, scroll_h, frame_time);
+        }
+    }
+
+    touchpad->prev_x = slot->screen_x;
+    touchpad->prev_y = slot->screen_y;
+}
+
+/*---------------------------------------------------------*\
+| process_touch_frame                                       |
+|                                                           |
+| Evaluate the slot table once per frame, at SYN_REPORT.    |
+| Contacts that lifted are handled before contacts that     |
+| landed, then the touch state, then motion of the primary  |
+| contact, so the result does not depend on the order the   |
+| driver reported the slots in                              |
+\*---------------------------------------------------------*/
+
+void process_touch_frame(struct timeval* frame_time)
+{
+    /*-----------------------------------------------------*\
+    | Contacts that lifted, or were replaced by a new       |
+    | contact, since the last frame                         |
+    \*-----------------------------------------------------*/
+    for(int slot_idx = 0; slot_idx < touchpad->touch.num_slots; slot_idx++)
+    {
+        touch_slot_type* slot = &touchpad->touch.slots[slot_idx];
+
+        if(slot->active_id >= 0 && slot->tracking_id != slot->active_id)
+        {
+            slot->active_id = -1;
+            finger_released(frame_time);
+        }
+    }
+
+    /*-----------------------------------------------------*\
+    | Contacts that landed since the last frame             |
+    \*-----------------------------------------------------*/
+    for(int slot_idx = 0; slot_idx < touchpad->touch.num_slots; slot_idx++)
+    {
+        touch_slot_type* slot = &touchpad->touch.slots[slot_idx];
+
+        if(slot->tracking_id >= 0 && slot->active_id < 0)
+        {
+            slot->active_id = slot->tracking_id;
+            slot->time_down = *frame_time;
+            slot->filter.initialized = false;
+            finger_pressed(frame_time);
+        }
+    }
+
+    /*-----------------------------------------------------*\
+    | A rotation since the last frame moves every contact   |
+    | to new screen coordinates; restart motion from there  |
+    \*-----------------------------------------------------*/
+    bool transform_changed = (touchpad->rotation != touchpad->touch_transform_rotation);
+
+    if(transform_changed)
+    {
+        update_touch_transform();
+
+        touchpad->init_prev       = 1;
+        touchpad->init_prev_wheel = 1;
+    }
+
+    /*-----------------------------------------------------*\
+    | Filter the positions of contacts that moved or have   |
+    | just landed and map them onto the screen, before any  |
+    | gesture or motion uses them                           |
+    \*-----------------------------------------------------*/
+    for(int slot_idx = 0; slot_idx < touchpad->touch.num_slots; slot_idx++)
+    {
+        touch_slot_type* slot = &touchpad->touch.slots[slot_idx];
+
+        if(slot->active_id < 0)
+        {
+            continue;
+        }
+
+        if((slot->dirty & SLOT_DIRTY_POSITION) || !slot->filter.initialized)
+        {
+            filter_slot_position(slot, frame_time);
+            transform_slot_position(slot);
+        }
+        else if(transform_changed)
+        {
+            transform_slot_position(slot);
+        }
+    }
+
+    /*-----------------------------------------------------*\
+    | Touchscreen pressed or released                       |
+    \*-----------------------------------------------------*/
+    if(touchpad->touch.btn_touch == 1 && !touchpad->touch_active)
+    {
+        touch_pressed(frame_time);
+    }
+    else if(touchpad->touch.btn_touch == 0 && touchpad->touch_active)
+    {
+        touch_released(frame_time);
+    }
+
+    touchpad->touch.btn_touch = -1;
+
+    /*-----------------------------------------------------*\
+    | The primary contact drives the pointer.  If it lifted,|
+    | the oldest remaining contact takes over, starting     |
+    | from its current position rather than jumping to it   |
+    \*-----------------------------------------------------*/
+    if(touchpad->touch.slots[touchpad->touch.primary_slot].active_id < 0)
+    {
+        for(int slot_idx = 0; slot_idx < touchpad->touch.num_slots; slot_idx++)
+        {
+            touch_slot_type* slot = &touchpad->touch.slots[slot_idx];
+
+            if(slot->active_id >= 0
+            && (touchpad->touch.slots[touchpad->touch.primary_slot].active_id < 0 || timercmp(&slot->time_down, &touchpad->touch.slots[touchpad->touch.primary_slot].time_down, <)))
+            {
+                touchpad->touch.primary_slot = slot_idx;
+                touchpad->init_prev          = 1;
+                touchpad->init_prev_wheel    = 1;
+            }
+        }
+    }
+
+    /*-----------------------------------------------------*\
+    | Motion of the primary contact                         |
+    \*-----------------------------------------------------*/
+    touch_slot_type* primary = &touchpad->touch.slots[touchpad->touch.primary_slot];
+
+    if(touchpad->touch_active && primary->active_id >= 0 && ((primary->dirty & SLOT_DIRTY_POSITION) || touchpad->init_prev || touchpad->init_prev_wheel))
+    {
+        process_touch_motion(frame_time);
+    }
+
+    /*-----------------------------------------------------*\
+    | Clear the dirty bits for the next frame               |
+    \*-----------------------------------------------------*/
+    for(int slot_idx = 0; slot_idx < touchpad->touch.num_slots; slot_idx++)
+    {
+        touchpad->touch.slots[slot_idx].dirty = 0;
+    }
+
+    output_mouse_frame();
+}
+
+/*---------------------------------------------------------*\
+| resync_touch_state                                        |
+|                                                           |
+| Rebuild the slot table and touch state from the kernel's  |
+| current device state and evaluate it as one frame.  Used  |
+| after the kernel dropped events (SYN_DROPPED) and when    |
+| the touchpad is enabled while fingers may be down, so     |
+| lifts that were never seen still end drags and contacts   |
+| already down are picked up without a restart              |
+\*---------------------------------------------------------*/
+
+void resync_touch_state(struct timeval* frame_time)
+{
+    struct
+    {
+        __u32   code;
+        __s32   values[MAX_TOUCH_SLOTS];
+    } mt_slots;
+
+    unsigned long key_bits[NBITS(KEY_MAX)];
+
+    /*-----------------------------------------------------*\
+    | Contacts whose lift or landing was lost cannot be     |
+    | trusted to form a click or tap                        |
+    \*-----------------------------------------------------*/
+    feed_gesture(GESTURE_INPUT_CANCEL);
+
+    if(touchpad->touch.single_touch)
+    {
+        struct input_absinfo absinfo;
+
+        if(ioctl(touchpad->touchscreen_fd, EVIOCGABS(ABS_X), &absinfo) == 0)
+        {
+            touchpad->touch.slots[0].x = absinfo.value;
+        }
+
+        if(ioctl(touchpad->touchscreen_fd, EVIOCGABS(ABS_Y), &absinfo) == 0)
+        {
+            touchpad->touch.slots[0].y = absinfo.value;
+        }
+    }
+    else
+    {
+        /*-------------------------------------------------*\
+        | Read the tracking ID and position of every slot   |
+        \*-------------------------------------------------*/
+        static const __u32 mt_codes[3] = { ABS_MT_TRACKING_ID, ABS_MT_POSITION_X, ABS_MT_POSITION_Y };
+
+        for(int code_idx = 0; code_idx < 3; code_idx++)
+        {
+            memset(&mt_slots, 0, sizeof(mt_slots));
+
+            mt_slots.code = mt_codes[code_idx];
+
+            if(ioctl(touchpad->touchscreen_fd, EVIOCGMTSLOTS(sizeof(mt_slots)), &mt_slots) < 0)
+            {
+                continue;
+            }
+
+            for(int slot_idx = 0; slot_idx < touchpad->touch.num_slots; slot_idx++)
+            {
+                touch_slot_type* slot = &touchpad->touch.slots[slot_idx];
+
+                switch(mt_codes[code_idx])
+                {
+                    case ABS_MT_TRACKING_ID:
+                        slot->tracking_id = mt_slots.values[slot_idx];
+                        break;
+
+                    case ABS_MT_POSITION_X:
+                        slot->x = mt_slots.values[slot_idx];
+                        break;
+
+                    case ABS_MT_POSITION_Y:
+                        slot->y = mt_slots.values[slot_idx];
+                        break;
+                }
+
+                slot->dirty |= SLOT_DIRTY_TRACKING_ID | SLOT_DIRTY_POSITION;
+            }
+        }
+
+        /*-------------------------------------------------*\
+        | The next slot events apply to the current slot    |
+        \*-------------------------------------------------*/
+        struct input_absinfo absinfo;
+
+        if(ioctl(touchpad->touchscreen_fd, EVIOCGABS(ABS_MT_SLOT), &absinfo) == 0)
+        {
+            touchpad->touch.current_slot = absinfo.value;
+        }
+    }
+
+    /*-----------------------------------------------------*\
+    | Read the touch key state                              |
+    \*-----------------------------------------------------*/
+    memset(key_bits, 0, sizeof(key_bits));
+
+    if(ioctl(touchpad->touchscreen_fd, EVIOCGKEY(sizeof(key_bits)), key_bits) >= 0)
+    {
+        touchpad->touch.btn_touch = test_bit(BTN_TOUCH, key_bits);
+
+        if(touchpad->touch.single_touch)
+        {
+            touchpad->touch.slots[0].tracking_id  = touchpad->touch.btn_touch ? 0 : -1;
+            touchpad->touch.slots[0].dirty       |= SLOT_DIRTY_TRACKING_ID | SLOT_DIRTY_POSITION;
+        }
+    }
+
+    touchpad->touch.syn_dropped = false;
+
+    process_touch_frame(frame_time);
+}
+
+/*---------------------------------------------------------*\
+| process_touchscreen_event                                 |
+|                                                           |
+| Record a touchscreen input event in the slot table.       |
+| Nothing is acted on until the frame's SYN_REPORT          |
+\*---------------------------------------------------------*/
+
+void process_touchscreen_event(struct input_event* touchscreen_event)
+{
+    touch_slot_type* slot = NULL;
+
+    /*-----------------------------------------------------*\
+    | After a SYN_DROPPED, the events up to the next        |
+    | SYN_REPORT are an incomplete frame and are discarded  |
+    \*-----------------------------------------------------*/
+    if(touchpad->touch.syn_dropped && !(touchscreen_event->type == EV_SYN && touchscreen_event->code == SYN_REPORT))
+    {
+        return;
+    }
+
+    if(touchpad->touch.current_slot >= 0 && touchpad->touch.current_slot < touchpad->touch.num_slots)
+    {
+        slot = &touchpad->touch.slots[touchpad->touch.current_slot];
+    }
+
+    switch(touchscreen_event->type)
+    {
+        case EV_ABS:
+            switch(touchscreen_event->code)
+            {
+                case ABS_MT_SLOT:
+                    touchpad->touch.current_slot = touchscreen_event->value;
+                    break;
+
+                case ABS_MT_TRACKING_ID:
+                    if(slot != NULL)
+                    {
+                        slot->tracking_id  = touchscreen_event->value;
+                        slot->dirty       |= SLOT_DIRTY_TRACKING_ID;
+                    }
+                    break;
+
+                case ABS_MT_POSITION_X:
+                    if(slot != NULL)
+                    {
+                        slot->x            = touchscreen_event->value;
+                        slot->dirty       |= SLOT_DIRTY_POSITION;
+                    }
+                    break;
+
+                case ABS_MT_POSITION_Y:
+                    if(slot != NULL)
+                    {
+                        slot->y            = touchscreen_event->value;
+                        slot->dirty       |= SLOT_DIRTY_POSITION;
+                    }
+                    break;
+
+                /*-----------------------------------------*\
+                | Single touch axes are only used for       |
+                | devices without multitouch positions,     |
+                | which are tracked in slot 0               |
+                \*-----------------------------------------*/
+                case ABS_X:
+                    if(touchpad->touch.single_touch)
+                    {
+                        touchpad->touch.slots[0].x       = touchscreen_event->value;
+                        touchpad->touch.slots[0].dirty  |= SLOT_DIRTY_POSITION;
+                    }
+                    break;
+
+                case ABS_Y:
+                    if(touchpad->touch.single_touch)
+                    {
+                        touchpad->touch.slots[0].y       = touchscreen_event->value;
+                        touchpad->touch.slots[0].dirty  |= SLOT_DIRTY_POSITION;
+                    }
+                    break;
+            }
+            break;
+
+        case EV_KEY:
+            if(touchscreen_event->code == BTN_TOUCH)
+            {
+                touchpad->touch.btn_touch = touchscreen_event->value;
+
+                if(touchpad->touch.single_touch)
+                {
+                    touchpad->touch.slots[0].tracking_id  = touchscreen_event->value ? 0 : -1;
+                    touchpad->touch.slots[0].dirty       |= SLOT_DIRTY_TRACKING_ID;
+                }
+            }
+            break;
+
+        case EV_SYN:
+            if(touchscreen_event->code == SYN_REPORT)
+            {
+                struct timeval frame_time;
+                frame_time.tv_sec  = touchscreen_event->input_event_sec;
+                frame_time.tv_usec = touchscreen_event->input_event_usec;
+
+                if(touchpad->touch.syn_dropped)
+                {
+                    resync_touch_state(&frame_time);
+                }
+                else
+                {
+                    process_touch_frame(&frame_time);
+                }
+            }
+            else if(touchscreen_event->code == SYN_DROPPED)
+            {
+                touchpad->touch.syn_dropped = true;
+            }
+            break;
+    }
+}
+
+/*---------------------------------------------------------*\
+| reset_touch_state                                         |
+|                                                           |
+| Clear the slot table and touch state, as when no contact  |
+| is on the touchscreen                                     |
+\*---------------------------------------------------------*/
+
+void reset_touch_state()
+{
+    for(int slot_idx = 0; slot_idx < MAX_TOUCH_SLOTS; slot_idx++)
+    {
+        touchpad->touch.slots[slot_idx].tracking_id   = -1;
+        touchpad->touch.slots[slot_idx].active_id     = -1;
+        touchpad->touch.slots[slot_idx].dirty         = 0;
+    }
+
+    touchpad->touch.current_slot  = 0;
+    touchpad->touch.primary_slot  = 0;
+    touchpad->touch.btn_touch     = -1;
+    touchpad->touch.syn_dropped   = false;
+
+    touchpad->touch_active        = 0;
+    touchpad->fingers             = 0;
+}
+
+/*---------------------------------------------------------*\
+| send_sensor_proxy_call                                    |
+|                                                           |
+| Call a SensorProxy method with up to two string arguments |
+| on the system bus connection without waiting.  The reply, |
+| if notify is given, is passed to it from the event loop   |
+\*---------------------------------------------------------*/
+
+bool send_sensor_proxy_call(const char* interface, const char* method, const char* arg1, const char* arg2, DBusPendingCallNotifyFunction notify, DBusPendingCall** pending)
+{
+    DBusMessageIter     args;
     DBusMessage*        msg;
-    DBusPendingCall*    pending;
+    bool                sent;
+
+    if(system_bus == NULL)
+    {
+        return(false);
+    }
+
+    /*-----------------------------------------------------*\
+    | Create a new method call and check for errors         |
+    \*-----------------------------------------------------*/
+    msg = dbus_message_new_method_call(SENSOR_PROXY_NAME, SENSOR_PROXY_PATH, interface, method);
+
+    if(NULL == msg)
+    {
+        return(false);
+    }
+
+    /*-----------------------------------------------------*\
+    | Append arguments                                      |
+    \*-----------------------------------------------------*/
+    dbus_message_iter_init_append(msg, &args);
+
+    if((arg1 != NULL && !dbus_message_iter_append_basic(&args, DBUS_TYPE_STRING, &arg1))
+    || (arg2 != NULL && !dbus_message_iter_append_basic(&args, DBUS_TYPE_STRING, &arg2)))
+    {
+        dbus_message_unref(msg);
+        return(false);
+    }
+
+    /*-----------------------------------------------------*\
+    | Send message, with a bounded wait for the reply if    |
+    | one is wanted                                         |
+    \*-----------------------------------------------------*/
+    if(notify == NULL)
+    {
+        sent = dbus_connection_send(system_bus, msg, NULL);
+    }
+    else
+    {
+        sent = (dbus_connection_send_with_reply(system_bus, msg, pending, DBUS_CALL_TIMEOUT_MS) && NULL != *pending);
+
+        if(sent)
+        {
+            dbus_pending_call_set_notify(*pending, notify, NULL, NULL);
+        }
+    }
+
+    dbus_message_unref(msg);
+
+    dbus_connection_read_write(system_bus, 0);
+
+    return(sent);
+}
+
+/*---------------------------------------------------------*\
+| read_accelerometer_orientation                            |
+|                                                           |
+| Read the AccelerometerOrientation property of SensorProxy |
+| from the reply to its Get call                            |
+\*---------------------------------------------------------*/
+
+char* read_accelerometer_orientation(DBusMessage* msg)
+{
+    DBusMessageIter     args;
+    DBusMessageIter     args_variant;
     char*               stat;
 
-    /*-----------------------------------------------------*\
-    | Initialize the errors                                 |
-    \*-----------------------------------------------------*/
-    dbus_error_init(&err);
+    query_buf[0] = '\0';
+
+    /*-----------------------------------------------------*\
+    | Read the parameters                                   |
+    \*-----------------------------------------------------*/
+    if (!dbus_message_iter_init(msg, &args))
+    {
+        fprintf(stderr, "Message has no arguments!\n");
+    }
+    else if(DBUS_TYPE_VARIANT != dbus_message_iter_get_arg_type(&args))
+    {
+        fprintf(stderr, "Argument is not variant! It is: %d\n", dbus_message_iter_get_arg_type(&args));
+    }
+    else
+    {
+        dbus_message_iter_recurse(&args, &args_variant);
+        
+        if(dbus_message_iter_get_arg_type(&args_variant) == DBUS_TYPE_STRING)
+        {
+            dbus_message_iter_get_basic(&args_variant, &stat);
+
+            /*---------------------------------------------*\
+            | Copy reply                                    |
+            \*---------------------------------------------*/
+            strncpy(query_buf, stat, sizeof(query_buf) - 1);
+        }
+    }
+
+    return(query_buf);
+}
+
+/*---------------------------------------------------------*\
+| rotation_from_accelerometer_orientation                   |
+|                                                           |
+| Determine the orientation angle from SensorProxy's        |
+| AccelerometerOrientation property                         |
+\*---------------------------------------------------------*/
+
+int rotation_from_accelerometer_orientation(const char* orientation)
+{
+    if(strncmp(orientation, "right-up", 64) == 0)
+    {
+        return(90);
+    }
+    else if(strncmp(orientation, "bottom-up", 64) == 0)
+    {
+        return(180);
+    }
+    else if(strncmp(orientation, "left-up", 64) == 0)
+    {
+        return(270);
+    }
+    else if(strncmp(orientation, "normal", 64) == 0)
+    {
+        return(0);
+    }
+    else
+    {
+        return(-1);
+    }
+}
+
+/*---------------------------------------------------------*\
+| handle_sensor_proxy_signal                                |
+|                                                           |
+| D-Bus message filter that picks AccelerometerOrientation  |
+| out of SensorProxy's PropertiesChanged signals.  Runs on  |
+| the main loop, the only reader of rotation                |
+\*---------------------------------------------------------*/
+
+DBusHandlerResult handle_sensor_proxy_signal(DBusConnection* conn, DBusMessage* msg, void* user_data)
+{
+    DBusMessageIter     args;
+    DBusMessageIter     changed;
+
+    if(!dbus_message_is_signal(msg, DBUS_PROPERTIES_NAME, "PropertiesChanged")
+    || !dbus_message_has_path(msg, SENSOR_PROXY_PATH))
+    {
+        return(DBUS_HANDLER_RESULT_NOT_YET_HANDLED);
+    }
+
+    /*-----------------------------------------------------*\
+    | Arguments are the interface name, then a dictionary   |
+    | of changed properties                                 |
+    \*-----------------------------------------------------*/
+    if(!dbus_message_iter_init(msg, &args)
+    || !dbus_message_iter_next(&args)
+    || dbus_message_iter_get_arg_type(&args) != DBUS_TYPE_ARRAY)
+    {
+        return(DBUS_HANDLER_RESULT_NOT_YET_HANDLED);
+    }
+
+    dbus_message_iter_recurse(&args, &changed);
+
+    while(dbus_message_iter_get_arg_type(&changed) == DBUS_TYPE_DICT_ENTRY)
+    {
+        DBusMessageIter entry;
+        DBusMessageIter value;
+        char*           name;
+        char*           orientation;
+
+        dbus_message_iter_recurse(&changed, &entry);
+        dbus_message_iter_get_basic(&entry, &name);
+
+        if(strcmp(name, "AccelerometerOrientation") == 0
+        && dbus_message_iter_next(&entry)
+        && dbus_message_iter_get_arg_type(&entry) == DBUS_TYPE_VARIANT)
+        {
+            dbus_message_iter_recurse(&entry, &value);
+
+            if(dbus_message_iter_get_arg_type(&value) == DBUS_TYPE_STRING)
+            {
+                dbus_message_iter_get_basic(&value, &orientation);
+
+                int new_rotation = rotation_from_accelerometer_orientation(orientation);
+
+                if(new_rotation >= 0)
+                {
+                    touchpads[0].rotation = new_rotation;
+                }
+            }
+        }
+
+        dbus_message_iter_next(&changed);
+    }
+
+    return(DBUS_HANDLER_RESULT_HANDLED);
+}
+
+/*---------------------------------------------------------*\
+| handle_dbus                                               |
+|                                                           |
+| Read whatever arrived on the system bus connection and    |
+| dispatch every complete message to the filters            |
+\*---------------------------------------------------------*/
+
+void handle_dbus(event_source_type* source)
+{
+    dispatch_dbus(system_bus);
+}
+
+/*---------------------------------------------------------*\
+| connect_sensor_proxy                                      |
+|                                                           |
+| Open the system bus connection, subscribe to SensorProxy  |
+| property changes and claim the accelerometer, then add    |
+| the connection to the event loop.  SensorProxy only       |
+| reports orientation changes to clients that claimed it    |
+\*---------------------------------------------------------*/
+
+bool connect_sensor_proxy()
+{
+    DBusError   err;
+    int         fd;
+
+    dbus_error_init(&err);
+
+    /*-----------------------------------------------------*\
+    | Connect to the system bus and check for errors        |
+    \*-----------------------------------------------------*/
+    system_bus = dbus_bus_get(DBUS_BUS_SYSTEM, &err);
+
+    if(dbus_error_is_set(&err))
+    {
+        dbus_error_free(&err);
+    }
+
+    if(NULL == system_bus)
+    {
+        return(false);
+    }
+
+    dbus_connection_set_exit_on_disconnect(system_bus, false);
+
+    /*-----------------------------------------------------*\
+    | Subscribe before claiming so no change is missed      |
+    \*-----------------------------------------------------*/
+    dbus_bus_add_match(system_bus,
+                       "type='signal',"
+                       "sender='" SENSOR_PROXY_NAME "',"
+                       "path='" SENSOR_PROXY_PATH "',"
+                       "interface='" DBUS_PROPERTIES_NAME "',"
+                       "member='PropertiesChanged'",
+                       &err);
+
+    if(dbus_error_is_set(&err))
+    {
+        dbus_error_free(&err);
+        return(false);
+    }
+
+    dbus_connection_add_filter(system_bus, handle_sensor_proxy_signal, NULL, NULL);
+
+    /*-----------------------------------------------------*\
+    | The claim is not waited for.  If SensorProxy is not   |
+    | there, the orientation query sent after it fails too  |
+    \*-----------------------------------------------------*/
+    if(!send_sensor_proxy_call(SENSOR_PROXY_NAME, "ClaimAccelerometer", NULL, NULL, NULL, NULL))
+    {
+        return(false);
+    }
+
+    if(!dbus_connection_get_unix_fd(system_bus, &fd))
+    {
+        return(false);
+    }
+
+    add_event_source(&dbus_source, fd, handle_dbus);
+
+    /*-----------------------------------------------------*\
+    | Signals read while adding the match are already       |
+    | queued and will not wake the event loop               |
+    \*-----------------------------------------------------*/
+    handle_dbus(&dbus_source);
+
+    return(true);
+}
+
+/*---------------------------------------------------------*\
+| release_accelerometer                                     |
+|                                                           |
+| Tell SensorProxy the accelerometer is no longer needed    |
+\*---------------------------------------------------------*/
+
+void release_accelerometer()
+{
+    DBusMessage* msg;
+
+    if(system_bus == NULL)
+    {
+        return;
+    }
+
+    msg = dbus_message_new_method_call(SENSOR_PROXY_NAME, SENSOR_PROXY_PATH, SENSOR_PROXY_NAME, "ReleaseAccelerometer");
+
+    if(NULL != msg)
+    {
+        dbus_message_set_no_reply(msg, true);
+        dbus_connection_send(system_bus, msg, NULL);
+        dbus_connection_flush(system_bus);
+        dbus_message_unref(msg);
+    }
+}
+
+/*---------------------------------------------------------*\
+| read_sysfs_attribute                                      |
+|                                                           |
+| Read a sysfs attribute into buf, without the trailing     |
+| newline.  Returns false if it could not be read           |
+\*---------------------------------------------------------*/
+
+bool read_sysfs_attribute(const char* dir, const char* name, char* buf, int len)
+{
+    char    path[1024];
+    int     fd;
+    ssize_t ret;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if(fd < 0)
+    {
+        return(false);
+    }
+
+    ret = read(fd, buf, len - 1);
+
+    close(fd);
+
+    if(ret <= 0)
+    {
+        return(false);
+    }
+
+    buf[ret] = '\0';
+    buf[strcspn(buf, "\n")] = '\0';
+
+    return(true);
+}
+
+/*---------------------------------------------------------*\
+| write_sysfs_attribute                                     |
+|                                                           |
+| Write a value to a sysfs attribute.  Returns false if the |
+| attribute does not exist or rejected the value            |
+\*---------------------------------------------------------*/
+
+bool write_sysfs_attribute(const char* dir, const char* name, const char* value)
+{
+    char    path[1024];
+    int     fd;
+    ssize_t ret;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+    fd = open(path, O_WRONLY | O_CLOEXEC);
+
+    if(fd < 0)
+    {
+        return(false);
+    }
+
+    ret = write(fd, value, strlen(value));
+
+    close(fd);
+
+    return(ret == (ssize_t)strlen(value));
+}
+
+/*---------------------------------------------------------*\
+| IIO accelerometer axis names and the orientation for each |
+| rotation / 90                                             |
+\*---------------------------------------------------------*/
+const char* iio_axis_names[3]       = { "x", "y", "z" };
+const char* iio_orientations[4]     = { "normal", "right-up", "bottom-up", "left-up" };
+
+/*---------------------------------------------------------*\
+| find_iio_accelerometer                                    |
+|                                                           |
+| Look under iio_root for a device reporting raw values on  |
+| all three acceleration axes                               |
+\*---------------------------------------------------------*/
+
+bool find_iio_accelerometer()
+{
+    DIR*            dir;
+    struct dirent*  entry;
+    char            buf[32];
+    bool            found = false;
+
+    dir = opendir(iio_root);
+
+    if(dir == NULL)
+    {
+        return(false);
+    }
+
+    while(!found && (entry = readdir(dir)) != NULL)
+    {
+        if(strncmp(entry->d_name, "iio:device", 10) != 0)
+        {
+            continue;
+        }
+
+        snprintf(iio_accel.path, sizeof(iio_accel.path), "%s/%s", iio_root, entry->d_name);
+
+        found = read_sysfs_attribute(iio_accel.path, "in_accel_x_raw", buf, sizeof(buf))
+             && read_sysfs_attribute(iio_accel.path, "in_accel_y_raw", buf, sizeof(buf))
+             && read_sysfs_attribute(iio_accel.path, "in_accel_z_raw", buf, sizeof(buf));
+
+        if(found)
+        {
+            snprintf(iio_accel.device, sizeof(iio_accel.device), "%s", entry->d_name);
+        }
+    }
+
+    closedir(dir);
+
+    return(found);
+}
+
+/*---------------------------------------------------------*\
+| read_iio_mount_matrix                                     |
+|                                                           |
+| Read the matrix that maps the sensor's axes onto the      |
+| device's, defaulting to identity                          |
+\*---------------------------------------------------------*/
+
+void read_iio_mount_matrix()
+{
+    char    buf[256];
+    float*  m = iio_accel.mount;
+
+    memset(m, 0, sizeof(iio_accel.mount));
+
+    m[0] = m[4] = m[8] = 1.0f;
+
+    if(read_sysfs_attribute(iio_accel.path, "in_accel_mount_matrix", buf, sizeof(buf))
+    || read_sysfs_attribute(iio_accel.path, "mount_matrix", buf, sizeof(buf)))
+    {
+        float parsed[9];
+
+        if(sscanf(buf, "%f, %f, %f; %f, %f, %f; %f, %f, %f",
+                  &parsed[0], &parsed[1], &parsed[2],
+                  &parsed[3], &parsed[4], &parsed[5],
+                  &parsed[6], &parsed[7], &parsed[8]) == 9)
+        {
+            memcpy(m, parsed, sizeof(parsed));
+        }
+    }
+}
+
+/*---------------------------------------------------------*\
+| restore_iio_buffer                                        |
+|                                                           |
+| Put back the scan channels and trigger found before the   |
+| buffer was set up, once it is no longer enabled           |
+\*---------------------------------------------------------*/
+
+void restore_iio_buffer()
+{
+    char scan_path[1024];
+
+    snprintf(scan_path, sizeof(scan_path), "%s/scan_elements", iio_accel.path);
+
+    for(int i = 0; i < iio_accel.saved_scan_count; i++)
+    {
+        iio_scan_element_type* element = &iio_accel.saved_scan[i];
+
+        write_sysfs_attribute(scan_path, element->name, element->enabled ? "1" : "0");
+    }
+
+    /*-----------------------------------------------------*\
+    | A name matching no trigger detaches the current one   |
+    \*-----------------------------------------------------*/
+    if(iio_accel.set_trigger)
+    {
+        write_sysfs_attribute(iio_accel.path, "trigger/current_trigger", "\n");
+    }
+
+    iio_accel.saved_scan_count  = 0;
+    iio_accel.set_trigger       = false;
+}
+
+/*---------------------------------------------------------*\
+| setup_iio_buffer                                          |
+|                                                           |
+| Enable only the three acceleration channels in the scan   |
+| and work out where each lands in a buffer frame, then     |
+| open the character device.  Returns false if the device   |
+| has no buffer or another reader already has it set up,    |
+| leaving the raw attributes to be polled                   |
+\*---------------------------------------------------------*/
+
+bool setup_iio_buffer()
+{
+    char            scan_path[1024];
+    char            dev_path[300];
+    char            name[64];
+    char            buf[64];
+    DIR*            dir;
+    struct dirent*  entry;
+    int             order[3] = { 0, 1, 2 };
+    bool            has_trigger;
+
+    /*-----------------------------------------------------*\
+    | An enabled buffer or an attached trigger means some   |
+    | other reader is using the buffer, so leave it alone   |
+    \*-----------------------------------------------------*/
+    if(!read_sysfs_attribute(iio_accel.path, "buffer/enable", buf, sizeof(buf)) || atoi(buf) != 0)
+    {
+        return(false);
+    }
+
+    has_trigger = read_sysfs_attribute(iio_accel.path, "trigger/current_trigger", buf, sizeof(buf));
+
+    if(has_trigger && buf[0] != '\0')
+    {
+        return(false);
+    }
+
+    snprintf(scan_path, sizeof(scan_path), "%s/scan_elements", iio_accel.path);
+
+    dir = opendir(scan_path);
+
+    if(dir == NULL)
+    {
+        return(false);
+    }
+
+    /*-----------------------------------------------------*\
+    | Other channels, such as the timestamp, would only     |
+    | make every frame larger.  Each is saved first so      |
+    | restore_iio_buffer can put it back                    |
+    \*-----------------------------------------------------*/
+    while((entry = readdir(dir)) != NULL)
+    {
+        int len = strlen(entry->d_name);
+
+        if(len > 3 && strcmp(entry->d_name + len - 3, "_en") == 0)
+        {
+            iio_scan_element_type* element = &iio_accel.saved_scan[iio_accel.saved_scan_count];
+
+            if(iio_accel.saved_scan_count == IIO_MAX_SCAN_ELEMENTS
+            || len >= (int)sizeof(element->name)
+            || !read_sysfs_attribute(scan_path, entry->d_name, buf, sizeof(buf)))
+            {
+                closedir(dir);
+                return(false);
+            }
+
+            snprintf(element->name, sizeof(element->name), "%s", entry->d_name);
+
+            element->enabled = (atoi(buf) != 0);
+            iio_accel.saved_scan_count++;
+
+            write_sysfs_attribute(scan_path, entry->d_name, "0");
+        }
+    }
+
+    closedir(dir);
+
+    for(int axis = 0; axis < 3; axis++)
+    {
+        iio_channel_type*   channel = &iio_accel.channels[axis];
+        char                endian;
+        char                sign;
+        int                 storage_bits;
+
+        channel->shift = 0;
+
+        snprintf(name, sizeof(name), "in_accel_%s_en", iio_axis_names[axis]);
+
+        if(!write_sysfs_attribute(scan_path, name, "1"))
+        {
+            return(false);
+        }
+
+        snprintf(name, sizeof(name), "in_accel_%s_index", iio_axis_names[axis]);
+
+        if(!read_sysfs_attribute(scan_path, name, buf, sizeof(buf)))
+        {
+            return(false);
+        }
+
+        channel->index = atoi(buf);
+
+        /*-------------------------------------------------*\
+        | Type is [be|le]:[s|u]bits/storagebits[>>shift]    |
+        \*-------------------------------------------------*/
+        snprintf(name, sizeof(name), "in_accel_%s_type", iio_axis_names[axis]);
+
+        if(!read_sysfs_attribute(scan_path, name, buf, sizeof(buf))
+        || sscanf(buf, "%ce:%c%d/%d>>%d", &endian, &sign, &channel->bits, &storage_bits, &channel->shift) < 4
+        || storage_bits % 8 != 0 || storage_bits < 8 || storage_bits > 64
+        || channel->bits < 1 || channel->bits > storage_bits)
+        {
+            return(false);
+        }
+
+        channel->bytes      = storage_bits / 8;
+        channel->is_signed  = (sign == 's');
+        channel->big_endian = (endian == 'b');
+    }
+
+    /*-----------------------------------------------------*\
+    | Channels appear in index order, each aligned to its   |
+    | own storage size                                      |
+    \*-----------------------------------------------------*/
+    for(int i = 0; i < 3; i++)
+    {
+        for(int j = i + 1; j < 3; j++)
+        {
+            if(iio_accel.channels[order[j]].index < iio_accel.channels[order[i]].index)
+            {
+                int swap = order[i];
+                order[i] = order[j];
+                order[j] = swap;
+            }
+        }
+    }
+
+    int offset      = 0;
+    int alignment   = 1;
+
+    for(int i = 0; i < 3; i++)
+    {
+        iio_channel_type* channel = &iio_accel.channels[order[i]];
+
+        offset          = ((offset + channel->bytes - 1) / channel->bytes) * channel->bytes;
+        channel->offset = offset;
+        offset         += channel->bytes;
+
+        if(channel->bytes > alignment)
+        {
+            alignment = channel->bytes;
+        }
+    }
+
+    iio_accel.frame_bytes = ((offset + alignment - 1) / alignment) * alignment;
+
+    if(iio_accel.frame_bytes > IIO_MAX_FRAME_BYTES)
+    {
+        return(false);
+    }
+
+    /*-----------------------------------------------------*\
+    | Buffers fill from a trigger.  Drivers that register   |
+    | their own data-ready trigger name it <name>-dev<N>    |
+    \*-----------------------------------------------------*/
+    if(has_trigger)
+    {
+        char device_name[64];
+        char trigger[512];
+
+        if(read_sysfs_attribute(iio_accel.path, "name", device_name, sizeof(device_name)))
+        {
+            snprintf(trigger, sizeof(trigger), "%s-dev%d", device_name, atoi(iio_accel.device + strlen("iio:device")));
+
+            iio_accel.set_trigger = write_sysfs_attribute(iio_accel.path, "trigger/current_trigger", trigger);
+        }
+    }
+
+    snprintf(dev_path, sizeof(dev_path), "/dev/%s", iio_accel.device);
+
+    iio_accel.dev_fd = open(dev_path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+
+    return(iio_accel.dev_fd >= 0);
+}
+
+/*---------------------------------------------------------*\
+| read_iio_raw_sample                                       |
+|                                                           |
+| Read the current value of each axis from its raw sysfs    |
+| attribute                                                 |
+\*---------------------------------------------------------*/
+
+bool read_iio_raw_sample(float sample[3])
+{
+    char buf[32];
+
+    for(int axis = 0; axis < 3; axis++)
+    {
+        ssize_t ret = pread(iio_accel.channels[axis].raw_fd, buf, sizeof(buf) - 1, 0);
+
+        if(ret <= 0)
+        {
+            return(false);
+        }
+
+        buf[ret]        = '\0';
+        sample[axis]    = strtof(buf, NULL);
+    }
+
+    return(true);
+}
+
+/*---------------------------------------------------------*\
+| decode_iio_frame                                          |
+|                                                           |
+| Extract the three axes from one buffer frame              |
+\*---------------------------------------------------------*/
+
+void decode_iio_frame(const unsigned char* frame, float sample[3])
+{
+    for(int axis = 0; axis < 3; axis++)
+    {
+        iio_channel_type*   channel = &iio_accel.channels[axis];
+        uint64_t            value   = 0;
+
+        for(int byte = 0; byte < channel->bytes; byte++)
+        {
+            int src = channel->big_endian ? (channel->bytes - 1 - byte) : byte;
+
+            value |= (uint64_t)frame[channel->offset + src] << (8 * byte);
+        }
+
+        value >>= channel->shift;
+
+        if(channel->bits < 64)
+        {
+            value &= (1ULL << channel->bits) - 1;
+
+            if(channel->is_signed && (value & (1ULL << (channel->bits - 1))))
+            {
+                value |= ~((1ULL << channel->bits) - 1);
+            }
+        }
+
+        sample[axis] = channel->is_signed ? (float)(int64_t)value : (float)value;
+    }
+}
+
+/*---------------------------------------------------------*\
+| apply_mount_matrix                                        |
+|                                                           |
+| Map a sample from the sensor's axes onto the device's     |
+\*---------------------------------------------------------*/
+
+void apply_mount_matrix(const float sample[3], float accel[3])
+{
+    const float* m = iio_accel.mount;
+
+    for(int row = 0; row < 3; row++)
+    {
+        accel[row] = (m[(row * 3) + 0] * sample[0])
+                   + (m[(row * 3) + 1] * sample[1])
+                   + (m[(row * 3) + 2] * sample[2]);
+    }
+}
+
+/*---------------------------------------------------------*\
+| iio_accelerometer_orientation                             |
+|                                                           |
+| Orientation for a sample in the device's axes, or NULL if |
+| the device lies too flat or too close to the boundary     |
+| between two orientations to tell.  Axes follow            |
+| SensorProxy: y points down when upright, x points down    |
+| when lying on the left edge                               |
+\*---------------------------------------------------------*/
+
+const char* iio_accelerometer_orientation(const float accel[3])
+{
+    float planar    = hypotf(accel[0], accel[1]);
+    float total     = sqrtf((accel[0] * accel[0]) + (accel[1] * accel[1]) + (accel[2] * accel[2]));
+
+    if(total <= 0.0f || planar < (total * IIO_MIN_TILT))
+    {
+        return(NULL);
+    }
+
+    /*-----------------------------------------------------*\
+    | Angle of "up" measured clockwise from the top edge    |
+    \*-----------------------------------------------------*/
+    float angle = atan2f(-accel[0], -accel[1]) * (180.0f / (float)M_PI);
+
+    if(angle < 0.0f)
+    {
+        angle += 360.0f;
+    }
+
+    int     sector  = ((int)((angle + 45.0f) / 90.0f)) % 4;
+    float   offset  = fabsf(angle - (sector * 90.0f));
+
+    if(offset > 180.0f)
+    {
+        offset = 360.0f - offset;
+    }
+
+    if(offset > IIO_SECTOR_DEG)
+    {
+        return(NULL);
+    }
+
+    return(iio_orientations[sector]);
+}
+
+/*---------------------------------------------------------*\
+| update_iio_orientation                                    |
+|                                                           |
+| Follow a new sample.  Rotation only changes once a        |
+| different orientation has been held for IIO_SETTLE_USEC,  |
+| so shaking the device on a boundary does not flip it      |
+\*---------------------------------------------------------*/
+
+void update_iio_orientation(const float sample[3])
+{
+    float           accel[3];
+    struct timespec cur_time;
+    const char*     orientation;
+    int             new_rotation = -1;
+
+    apply_mount_matrix(sample, accel);
+
+    orientation = iio_accelerometer_orientation(accel);
+
+    if(orientation != NULL)
+    {
+        new_rotation = rotation_from_accelerometer_orientation(orientation);
+    }
+
+    if(new_rotation < 0 || new_rotation == touchpads[0].rotation)
+    {
+        iio_accel.candidate = -1;
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &cur_time);
+
+    if(new_rotation != iio_accel.candidate)
+    {
+        iio_accel.candidate         = new_rotation;
+        iio_accel.candidate_time    = cur_time;
+        return;
+    }
+
+    long held_usec = ((cur_time.tv_sec - iio_accel.candidate_time.tv_sec) * 1000000L)
+                   + ((cur_time.tv_nsec - iio_accel.candidate_time.tv_nsec) / 1000);
+
+    if(held_usec >= IIO_SETTLE_USEC)
+    {
+        touchpads[0].rotation   = new_rotation;
+        iio_accel.candidate     = -1;
+    }
+}
+
+/*---------------------------------------------------------*\
+| query_iio_accelerometer_orientation                       |
+|                                                           |
+| Initial orientation from the raw attributes.  A device    |
+| lying flat counts as normal                               |
+\*---------------------------------------------------------*/
+
+const char* query_iio_accelerometer_orientation()
+{
+    float       sample[3];
+    float       accel[3];
+    const char* orientation;
+
+    if(!read_iio_raw_sample(sample))
+    {
+        return("");
+    }
+
+    apply_mount_matrix(sample, accel);
+
+    orientation = iio_accelerometer_orientation(accel);
+
+    return(orientation != NULL ? orientation : "normal");
+}
+
+/*---------------------------------------------------------*\
+| handle_iio_buffer                                         |
+|                                                           |
+| Read the frames waiting in the accelerometer's buffer.    |
+| Only the newest one matters                               |
+\*---------------------------------------------------------*/
+
+void handle_iio_buffer(event_source_type* source)
+{
+    unsigned char   frames[IIO_MAX_FRAME_BYTES * IIO_READ_FRAMES];
+    float           sample[3];
+    ssize_t         ret;
+
+    ret = read(source->fd, frames, iio_accel.frame_bytes * IIO_READ_FRAMES);
+
+    if(ret < iio_accel.frame_bytes)
+    {
+        return;
+    }
+
+    decode_iio_frame(frames + (((ret / iio_accel.frame_bytes) - 1) * iio_accel.frame_bytes), sample);
+
+    update_iio_orientation(sample);
+}
+
+/*---------------------------------------------------------*\
+| handle_iio_poll                                           |
+|                                                           |
+| Poll the raw attributes of an accelerometer without a     |
+| usable buffer                                             |
+\*---------------------------------------------------------*/
+
+void handle_iio_poll(event_source_type* source)
+{
+    float sample[3];
+
+    if(read_timer(source) && read_iio_raw_sample(sample))
+    {
+        update_iio_orientation(sample);
+    }
+}
+
+/*---------------------------------------------------------*\
+| start_iio_accelerometer                                   |
+|                                                           |
+| Start following the IIO accelerometer, falling back to    |
+| polling if the buffer cannot be enabled                   |
+\*---------------------------------------------------------*/
+
+void start_iio_accelerometer()
+{
+    float sample[3];
+
+    if(!iio_accel_active)
+    {
+        return;
+    }
+
+    /*-----------------------------------------------------*\
+    | Catch up with any rotation while stopped, before the  |
+    | buffer takes over the raw attributes                  |
+    \*-----------------------------------------------------*/
+    if(read_iio_raw_sample(sample))
+    {
+        const char* orientation;
+        float       accel[3];
+
+        apply_mount_matrix(sample, accel);
+
+        orientation = iio_accelerometer_orientation(accel);
+
+        if(orientation != NULL)
+        {
+            touchpads[0].rotation = rotation_from_accelerometer_orientation(orientation);
+        }
+    }
+
+    iio_accel.candidate = -1;
+
+    if(iio_accel.buffered)
+    {
+        if(write_sysfs_attribute(iio_accel.path, "buffer/enable", "1"))
+        {
+            add_event_source(&iio_source, iio_accel.dev_fd, handle_iio_buffer);
+            return;
+        }
+
+        fprintf(stderr, "Could not enable IIO buffer, polling instead\n");
+
+        close(iio_accel.dev_fd);
+
+        iio_accel.dev_fd    = -1;
+        iio_accel.buffered  = false;
+    }
+
+    start_periodic_timer(&iio_timer, IIO_POLL_USEC);
+}
+
+/*---------------------------------------------------------*\
+| stop_iio_accelerometer                                    |
+|                                                           |
+| Stop following the IIO accelerometer, so it does not wake |
+| the main loop while the touchpad is disabled              |
+\*---------------------------------------------------------*/
+
+void stop_iio_accelerometer()
+{
+    if(!iio_accel_active)
+    {
+        return;
+    }
+
+    if(iio_accel.buffered)
+    {
+        remove_event_source(&iio_source);
+        iio_source.fd = -1;
+
+        write_sysfs_attribute(iio_accel.path, "buffer/enable", "0");
+    }
+    else
+    {
+        stop_timer(&iio_timer);
+    }
+}
+
+/*---------------------------------------------------------*\
+| close_iio_accelerometer                                   |
+|                                                           |
+| Stop reading the IIO accelerometer, hand its buffer back  |
+| as it was found and close its files                       |
+\*---------------------------------------------------------*/
+
+void close_iio_accelerometer()
+{
+    if(!iio_accel_active)
+    {
+        return;
+    }
+
+    stop_iio_accelerometer();
+
+    restore_iio_buffer();
+
+    for(int axis = 0; axis < 3; axis++)
+    {
+        if(iio_accel.channels[axis].raw_fd >= 0)
+        {
+            close(iio_accel.channels[axis].raw_fd);
+            iio_accel.channels[axis].raw_fd = -1;
+        }
+    }
+
+    if(iio_accel.dev_fd >= 0)
+    {
+        close(iio_accel.dev_fd);
+        iio_accel.dev_fd = -1;
+    }
+
+    iio_accel_active = false;
+}
+
+/*---------------------------------------------------------*\
+| open_iio_accelerometer                                    |
+|                                                           |
+| Find an IIO accelerometer and prepare to read it, through |
+| its buffer where possible and otherwise by polling the    |
+| raw attributes                                            |
+\*---------------------------------------------------------*/
+
+bool open_iio_accelerometer()
+{
+    char name[64];
+
+    iio_accel.dev_fd            = -1;
+    iio_accel.buffered          = false;
+    iio_accel.candidate         = -1;
+    iio_accel.saved_scan_count  = 0;
+    iio_accel.set_trigger       = false;
+
+    for(int axis = 0; axis < 3; axis++)
+    {
+        iio_accel.channels[axis].raw_fd = -1;
+    }
+
+    if(!find_iio_accelerometer())
+    {
+        return(false);
+    }
+
+    read_iio_mount_matrix();
+
+    create_timer(&iio_timer, handle_iio_poll);
+
+    iio_source.fd       = -1;
+    iio_accel_active    = true;
+
+    /*-----------------------------------------------------*\
+    | The raw attributes give the initial orientation, and  |
+    | are polled if the buffer cannot be used               |
+    \*-----------------------------------------------------*/
+    for(int axis = 0; axis < 3; axis++)
+    {
+        char path[1024];
+
+        snprintf(name, sizeof(name), "in_accel_%s_raw", iio_axis_names[axis]);
+        snprintf(path, sizeof(path), "%s/%s", iio_accel.path, name);
+
+        iio_accel.channels[axis].raw_fd = open(path, O_RDONLY | O_CLOEXEC);
+
+        if(iio_accel.channels[axis].raw_fd < 0)
+        {
+            close_iio_accelerometer();
+            return(false);
+        }
+    }
+
+    iio_accel.buffered  = setup_iio_buffer();
+
+    if(!iio_accel.buffered)
+    {
+        restore_iio_buffer();
+    }
+
+    printf("Using IIO accelerometer %s (%s).\r\n", iio_accel.device, iio_accel.buffered ? "buffered" : "polled");
+
+    return(true);
+}
+
+/*---------------------------------------------------------*\
+| resolve_initial_orientation                               |
+|                                                           |
+| Start following the accelerometer from the orientation    |
+| first reported, or fall back to manual rotation if there  |
+| is none and autorotation is not forced                    |
+\*---------------------------------------------------------*/
+
+void resolve_initial_orientation(const char* orientation)
+{
+    int initial_rotation = rotation_from_accelerometer_orientation(orientation);
+
+    if(initial_rotation >= 0 || force_autorotation)
+    {
+        /*-------------------------------------------------*\
+        | If force autorotation is active, keep the current |
+        | rotation until the accelerometer reports one      |
+        \*-------------------------------------------------*/
+        if(initial_rotation >= 0)
+        {
+            touchpads[0].rotation = initial_rotation;
+        }
+
+        /*-------------------------------------------------*\
+        | Orientation changes now arrive as signals in the  |
+        | main loop                                         |
+        \*-------------------------------------------------*/
+        printf("Automatic orientation detection enabled.\r\n");
+    }
+    else
+    {
+        /*-------------------------------------------------*\
+        | Enable manual rotation if automatic rotation      |
+        | could not be enabled                              |
+        \*-------------------------------------------------*/
+        printf("Orientation could not be determined from accelerometer, defaulting to 0 degrees.\r\n");
+        printf("Long-press Volume Up button to change orientations manually.\r\n");
+        button_0_long_hold_event = BUTTON_EVENT_CHANGE_ORIENTATION;
+        touchpads[0].rotation    = 0;
+
+        release_accelerometer();
+        close_iio_accelerometer();
+    }
+}
+
+/*---------------------------------------------------------*\
+| finish_orientation_query                                  |
+|                                                           |
+| Use SensorProxy's answer to the orientation query, NULL   |
+| if it failed or timed out.  Without SensorProxy, the IIO  |
+| accelerometer is read directly                            |
+\*---------------------------------------------------------*/
+
+void finish_orientation_query(DBusMessage* reply)
+{
+    const char* orientation = "";
+
+    stop_timer(&orientation_timer);
+
+    if(orientation_query != NULL)
+    {
+        dbus_pending_call_unref(orientation_query);
+        orientation_query = NULL;
+    }
+
+    if(reply != NULL)
+    {
+        orientation = read_accelerometer_orientation(reply);
+    }
+    else
+    {
+        release_accelerometer();
+
+        if(open_iio_accelerometer())
+        {
+            orientation = query_iio_accelerometer_orientation();
+
+            if(touchpads[0].enabled)
+            {
+                start_iio_accelerometer();
+            }
+        }
+    }
+
+    resolve_initial_orientation(orientation);
+}
+
+/*---------------------------------------------------------*\
+| handle_orientation_reply                                  |
+|                                                           |
+| Called from the event loop when the orientation query     |
+| returns                                                   |
+\*---------------------------------------------------------*/
+
+void handle_orientation_reply(DBusPendingCall* pending, void* user_data)
+{
+    DBusMessage* reply = dbus_pending_call_steal_reply(pending);
+
+    if(reply != NULL && dbus_message_get_type(reply) == DBUS_MESSAGE_TYPE_ERROR)
+    {
+        fprintf(stderr, "SensorProxy Get failed: %s\n", dbus_message_get_error_name(reply));
+
+        dbus_message_unref(reply);
+        reply = NULL;
+    }
+
+    finish_orientation_query(reply);
+
+    if(reply != NULL)
+    {
+        dbus_message_unref(reply);
+    }
+}
+
+/*---------------------------------------------------------*\
+| orientation_query_timeout                                 |
+|                                                           |
+| Give up on an orientation query SensorProxy has not       |
+| answered in DBUS_CALL_TIMEOUT_MS                          |
+\*---------------------------------------------------------*/
+
+void orientation_query_timeout(event_source_type* source)
+{
+    if(!read_timer(source) || orientation_query == NULL)
+    {
+        return;
+    }
+
+    fprintf(stderr, "SensorProxy did not answer the orientation query\n");
+
+    dbus_pending_call_cancel(orientation_query);
+
+    finish_orientation_query(NULL);
+}
+
+/*---------------------------------------------------------*\
+| start_orientation_query                                   |
+|                                                           |
+| Ask SensorProxy for the current orientation without       |
+| waiting, so startup is not held up by the system bus.     |
+| The touchpad runs at the current rotation until it        |
+| answers                                                   |
+\*---------------------------------------------------------*/
+
+void start_orientation_query()
+{
+    create_timer(&orientation_timer, orientation_query_timeout);
+
+    if(!send_sensor_proxy_call(DBUS_PROPERTIES_NAME, "Get", SENSOR_PROXY_NAME, "AccelerometerOrientation", handle_orientation_reply, &orientation_query))
+    {
+        orientation_query = NULL;
+
+        finish_orientation_query(NULL);
+        return;
+    }
+
+    start_timer(&orientation_timer, DBUS_CALL_TIMEOUT_MS * 1000);
+}
+
+/*---------------------------------------------------------*\
+| release_touchpad                                          |
+|                                                           |
+| Give the current touchpad's touchscreen back and remove   |
+| its virtual mouse.  A touchpad whose touchscreen is gone  |
+| already had both done when it went away                   |
+\*---------------------------------------------------------*/
+
+void release_touchpad()
+{
+    if(touchpad->touchscreen_fd < 0)
+    {
+        return;
+    }
+
+    stop_kinetic_scroll();
+    feed_gesture(GESTURE_INPUT_RESET);
+
+    ioctl(touchpad->touchscreen_fd, EVIOCGRAB, 0);
+    close_uinput(&touchpad->virtual_mouse_fd);
+
+    /*-----------------------------------------------------*\
+    | Stop the touchscreen from waking the main loop        |
+    \*-----------------------------------------------------*/
+    set_event_mask(touchpad->touchscreen_fd, NULL, 0);
+
+    /*-----------------------------------------------------*\
+    | Drop any partially built frame for the mouse          |
+    \*-----------------------------------------------------*/
+    touchpad->mouse_frame.count = 0;
+    clear_pending_motion();
+}
+
+/*---------------------------------------------------------*\
+| grab_touchpad                                             |
+|                                                           |
+| Take the current touchpad's touchscreen and create its    |
+| virtual mouse.  A touchpad whose touchscreen is gone is   |
+| grabbed when it comes back instead                        |
+\*---------------------------------------------------------*/
+
+void grab_touchpad()
+{
+    if(touchpad->touchscreen_fd < 0)
+    {
+        return;
+    }
+
+    ioctl(touchpad->touchscreen_fd, EVIOCGRAB, 1);
+    open_uinput(&touchpad->virtual_mouse_fd);
+
+    set_event_mask(touchpad->touchscreen_fd, touchscreen_event_codes, NUM_EVENT_CODES(touchscreen_event_codes));
+
+    /*-----------------------------------------------------*\
+    | Pick up any fingers already on the touchscreen, as    |
+    | touches while disabled were never delivered           |
+    \*-----------------------------------------------------*/
+    struct timeval cur_time;
+    gettimeofday(&cur_time, NULL);
+
+    reset_touch_state();
+    resync_touch_state(&cur_time);
+}
+
+/*---------------------------------------------------------*\
+| disable_touchpad                                          |
+|                                                           |
+| Switch the device's own touchpad off                      |
+\*---------------------------------------------------------*/
+
+void disable_touchpad()
+{
+    touchpad = &touchpads[0];
+
+    if(touchpad->enabled)
+    {
+        release_touchpad();
+
+        /*-------------------------------------------------*\
+        | Rotation only matters while the touchpad is on    |
+        \*-------------------------------------------------*/
+        stop_iio_accelerometer();
+    }
+    touchpad->enabled = 0;
+}
+
+/*---------------------------------------------------------*\
+| enable_touchpad                                           |
+|                                                           |
+| Switch the device's own touchpad on                       |
+\*---------------------------------------------------------*/
+
+void enable_touchpad()
+{
+    touchpad = &touchpads[0];
+
+    if(!touchpad->enabled)
+    {
+        grab_touchpad();
+
+        start_iio_accelerometer();
+    }
+
+    touchpad->enabled = 1;
+}
+
+/*---------------------------------------------------------*\
+| compare_event_ids                                         |
+|                                                           |
+| qsort comparison for event numbers                        |
+\*---------------------------------------------------------*/
+
+int compare_event_ids(const void* a, const void* b)
+{
+    return(*(const int*)a - *(const int*)b);
+}
+
+/*---------------------------------------------------------*\
+| list_input_events                                         |
+|                                                           |
+| Fill event_ids with the numbers of the eventN nodes that  |
+| exist in /dev/input, in ascending order.  Numbering may   |
+| have gaps after devices come and go                       |
+\*---------------------------------------------------------*/
+
+int list_input_events(int* event_ids, int max_ids)
+{
+    DIR*            dir;
+    struct dirent*  entry;
+    int             num_ids = 0;
+
+    dir = opendir(INPUT_DEV_PATH);
+
+    if(dir == NULL)
+    {
+        return(0);
+    }
+
+    while(num_ids < max_ids && (entry = readdir(dir)) != NULL)
+    {
+        int event_id;
+
+        if(sscanf(entry->d_name, "event%d", &event_id) == 1)
+        {
+            event_ids[num_ids++] = event_id;
+        }
+    }
+
+    closedir(dir);
+
+    qsort(event_ids, num_ids, sizeof(int), compare_event_ids);
+
+    return(num_ids);
+}
+
+/*---------------------------------------------------------*\
+| read_input_capabilities                                   |
+|                                                           |
+| Get the event types of an input device and the codes it   |
+| supports for each                                         |
+\*---------------------------------------------------------*/
+
+void read_input_capabilities(int fd, unsigned long capabilities[EV_MAX][NBITS(KEY_MAX)])
+{
+    memset(capabilities, 0, EV_MAX * sizeof(capabilities[0]));
+
+    ioctl(fd, EVIOCGBIT(0, EV_MAX), capabilities[0]);
+
+    for(unsigned int type = 0; type < EV_MAX; type++)
+    {
+        if(test_bit(type, capabilities[0]) && type != EV_REP)
+        {
+            if(type == EV_SYN)
+            {
+                continue;
+            }
+
+            ioctl(fd, EVIOCGBIT(type, KEY_MAX), capabilities[type]);
+        }
+    }
+}
+
+/*---------------------------------------------------------*\
+| is_volume_key_device                                      |
+|                                                           |
+| Check if a device has the given volume key                |
+\*---------------------------------------------------------*/
+
+bool is_volume_key_device(unsigned long capabilities[EV_MAX][NBITS(KEY_MAX)], int key)
+{
+    return(test_bit(EV_SYN,             capabilities[0])
+        && test_bit(EV_KEY,             capabilities[0])
+        && test_bit(key,                capabilities[EV_KEY]));
+}
+
+/*---------------------------------------------------------*\
+| is_touchscreen_device                                     |
+|                                                           |
+| Check if a device is a touchscreen                        |
+\*---------------------------------------------------------*/
+
+bool is_touchscreen_device(unsigned long capabilities[EV_MAX][NBITS(KEY_MAX)])
+{
+    return(test_bit(EV_SYN,             capabilities[0])
+        && test_bit(EV_KEY,             capabilities[0])
+        && test_bit(BTN_TOUCH,          capabilities[EV_KEY])
+        && test_bit(EV_ABS,             capabilities[0])
+        && test_bit(ABS_MT_SLOT,        capabilities[EV_ABS])
+        && ((test_bit(ABS_X,             capabilities[EV_ABS])
+          && test_bit(ABS_Y,             capabilities[EV_ABS]))
+         || (test_bit(ABS_MT_POSITION_X,  capabilities[EV_ABS])
+          && test_bit(ABS_MT_POSITION_Y,  capabilities[EV_ABS]))));
+}
+
+/*---------------------------------------------------------*\
+| probe_input_node                                          |
+|                                                           |
+| Open an event node and read its name, IDs and             |
+| capabilities.  The node is left open for matching         |
+\*---------------------------------------------------------*/
+
+void probe_input_node(input_probe_type* probe)
+{
+    char path[64];
+
+    snprintf(path, sizeof(path), INPUT_DEV_PATH "/event%d", probe->event_id);
+
+    probe->fd = open(path, O_RDONLY|O_NONBLOCK);
+
+    if(probe->fd < 0)
+    {
+        return;
+    }
+
+    ioctl(probe->fd, EVIOCGNAME(sizeof(probe->name) - 1), probe->name);
+    ioctl(probe->fd, EVIOCGID, &probe->id);
+
+    read_input_capabilities(probe->fd, probe->capabilities);
+}
+
+/*---------------------------------------------------------*\
+| probe_input_worker                                        |
+|                                                           |
+| Probe thread, taking nodes until none are left            |
+\*---------------------------------------------------------*/
+
+void* probe_input_worker(void* arg)
+{
+    int probe_idx;
+
+    while((probe_idx = __atomic_fetch_add(&next_input_probe, 1, __ATOMIC_RELAXED)) < num_input_probes)
+    {
+        probe_input_node(&input_probes[probe_idx]);
+    }
+
+    return(NULL);
+}
+
+/*---------------------------------------------------------*\
+| probe_input_devices                                       |
+|                                                           |
+| Probe every event node, spread over PROBE_THREADS threads |
+| including this one.  Runs before any signal handling is   |
+| set up, and all threads are joined before returning       |
+\*---------------------------------------------------------*/
+
+void probe_input_devices()
+{
+    int         event_ids[MAX_INPUT_DEVICES];
+    pthread_t   threads[PROBE_THREADS - 1];
+    int         num_threads = 0;
+
+    num_input_probes = list_input_events(event_ids, MAX_INPUT_DEVICES);
+    next_input_probe = 0;
+
+    input_probes = calloc(num_input_probes > 0 ? num_input_probes : 1, sizeof(input_probe_type));
+
+    if(input_probes == NULL)
+    {
+        num_input_probes = 0;
+        return;
+    }
+
+    for(int probe_idx = 0; probe_idx < num_input_probes; probe_idx++)
+    {
+        input_probes[probe_idx].event_id = event_ids[probe_idx];
+        input_probes[probe_idx].fd       = -1;
+    }
+
+    while(num_threads < PROBE_THREADS - 1 && num_threads < num_input_probes - 1)
+    {
+        if(pthread_create(&threads[num_threads], NULL, probe_input_worker, NULL) != 0)
+        {
+            break;
+        }
+
+        num_threads++;
+    }
+
+    probe_input_worker(NULL);
+
+    for(int thread = 0; thread < num_threads; thread++)
+    {
+        pthread_join(threads[thread], NULL);
+    }
+}
+
+/*---------------------------------------------------------*\
+| find_probe_event_id                                       |
+|                                                           |
+| Get the event number of a probed node from its fd         |
+\*---------------------------------------------------------*/
+
+int find_probe_event_id(int fd)
+{
+    for(int probe_idx = 0; probe_idx < num_input_probes; probe_idx++)
+    {
+        if(fd >= 0 && input_probes[probe_idx].fd == fd)
+        {
+            return(input_probes[probe_idx].event_id);
+        }
+    }
+
+    return(-1);
+}
+
+/*---------------------------------------------------------*\
+| release_input_probes                                      |
+|                                                           |
+| Close the probed nodes no role was opened with            |
+\*---------------------------------------------------------*/
+
+void release_input_probes()
+{
+    for(int probe_idx = 0; probe_idx < num_input_probes; probe_idx++)
+    {
+        int fd = input_probes[probe_idx].fd;
+
+        if(fd >= 0
+        && fd != touchpad->touchscreen_fd
+        && fd != button_0_fd
+        && fd != button_1_fd
+        && fd != slider_fd)
+        {
+            close(fd);
+        }
+    }
+
+    free(input_probes);
+
+    input_probes     = NULL;
+    num_input_probes = 0;
+}
+
+/*---------------------------------------------------------*\
+| configure_touchscreen                                     |
+|                                                           |
+| Read the limits, slot count and resolution of the opened  |
+| touchscreen and build the transform for them              |
+\*---------------------------------------------------------*/
+
+void configure_touchscreen()
+{
+    /*-----------------------------------------------------*\
+    | Determine maximums                                    |
+    \*-----------------------------------------------------*/
+    ioctl(touchpad->touchscreen_fd, EVIOCGABS(ABS_MT_POSITION_X), &touchpad->max_x);
+    ioctl(touchpad->touchscreen_fd, EVIOCGABS(ABS_MT_POSITION_Y), &touchpad->max_y);
+
+    /*-----------------------------------------------------*\
+    | Size the slot table from the number of multitouch     |
+    | slots.  Devices without multitouch positions are      |
+    | tracked as a single contact in slot 0                 |
+    \*-----------------------------------------------------*/
+    unsigned long abs_bits[NBITS(ABS_MAX)];
+    struct input_absinfo slot_info;
+
+    memset(abs_bits, 0, sizeof(abs_bits));
+    memset(&slot_info, 0, sizeof(slot_info));
+
+    ioctl(touchpad->touchscreen_fd, EVIOCGBIT(EV_ABS, sizeof(abs_bits)), abs_bits);
+
+    touchpad->touch.single_touch = !test_bit(ABS_MT_POSITION_X, abs_bits);
+    touchpad->touch.num_slots    = 1;
+
+    if(!touchpad->touch.single_touch && test_bit(ABS_MT_SLOT, abs_bits) && ioctl(touchpad->touchscreen_fd, EVIOCGABS(ABS_MT_SLOT), &slot_info) == 0)
+    {
+        touchpad->touch.num_slots = slot_info.maximum + 1;
+    }
+
+    if(touchpad->touch.num_slots > MAX_TOUCH_SLOTS)
+    {
+        touchpad->touch.num_slots = MAX_TOUCH_SLOTS;
+    }
+
+    if(touchpad->touch.single_touch)
+    {
+        ioctl(touchpad->touchscreen_fd, EVIOCGABS(ABS_X), &touchpad->max_x);
+        ioctl(touchpad->touchscreen_fd, EVIOCGABS(ABS_Y), &touchpad->max_y);
+    }
+
+    printf("Touchscreen Max X:%d, Max y:%d\r\n", touchpad->max_x.maximum, touchpad->max_y.maximum);
+
+    /*-----------------------------------------------------*\
+    | Determine the resolution in units per millimetre.     |
+    | Drivers that report 0 fall back to the panel size of  |
+    | the matched device, assuming square units             |
+    \*-----------------------------------------------------*/
+    touchpad->units_per_mm_x = touchpad->max_x.resolution;
+    touchpad->units_per_mm_y = touchpad->max_y.resolution;
+
+    if(touchpad->resolution_override > 0.0f)
+    {
+        touchpad->units_per_mm_x = touchpad->resolution_override;
+        touchpad->units_per_mm_y = touchpad->resolution_override;
+    }
+    else if(touchpad->units_per_mm_x <= 0.0f || touchpad->units_per_mm_y <= 0.0f)
+    {
+        float diagonal_mm = touchpad->panel_diagonal_mm;
+
+        if(diagonal_mm <= 0.0f)
+        {
+            diagonal_mm = DEFAULT_DIAGONAL_MM;
+        }
+
+        float diagonal_units = hypotf(touchpad->max_x.maximum - touchpad->max_x.minimum, touchpad->max_y.maximum - touchpad->max_y.minimum);
+
+        if(touchpad->units_per_mm_x <= 0.0f)
+        {
+            touchpad->units_per_mm_x = diagonal_units / diagonal_mm;
+        }
+
+        if(touchpad->units_per_mm_y <= 0.0f)
+        {
+            touchpad->units_per_mm_y = diagonal_units / diagonal_mm;
+        }
+    }
+
+    if(touchpad->units_per_mm_x <= 0.0f || touchpad->units_per_mm_y <= 0.0f)
+    {
+        touchpad->units_per_mm_x = 1.0f;
+        touchpad->units_per_mm_y = 1.0f;
+    }
+
+    printf("Touchscreen resolution X:%.2f, Y:%.2f units/mm\r\n", touchpad->units_per_mm_x, touchpad->units_per_mm_y);
+
+    update_touch_transform();
+
+    reset_touch_state();
+}
+
+/*---------------------------------------------------------*\
+| scan_and_open_auto                                        |
+|                                                           |
+| Pick probed devices based on capabilities                 |
+\*---------------------------------------------------------*/
+
+bool scan_and_open_auto(bool no_buttons)
+{
+    bool    button_0_found      = false;
+    bool    button_1_found      = false;
+    bool    touchscreen_found   = false;
+
+    /*-----------------------------------------------------*\
+    | Set button found flags to prevent initializing        |
+    | buttons if no buttons flag is set                     |
+    \*-----------------------------------------------------*/
+    if(no_buttons)
+    {
+        button_0_found = true;
+        button_1_found = true;
+    }
+    
+    /*-----------------------------------------------------*\
+    | Default all file descriptors to -1 (invalid)          |
+    \*-----------------------------------------------------*/
+    touchpad->touchscreen_fd  = -1;
+    button_0_fd     = -1;
+    button_1_fd     = -1;
+    slider_fd       = -1;
+
+    for(int probe_idx = 0; probe_idx < num_input_probes; probe_idx++)
+    {
+        input_probe_type* probe = &input_probes[probe_idx];
+
+        if(probe->fd < 0)
+        {
+            continue;
+        }
+
+        /*-------------------------------------------------*\
+        | Check if this device is Volume Up                 |
+        \*-------------------------------------------------*/
+        if(!button_0_found && is_volume_key_device(probe->capabilities, KEY_VOLUMEUP))
+        {
+            button_0_fd         = probe->fd;
+            button_0_found      = true;
+        }
+
+        /*-------------------------------------------------*\
+        | Check if this device is Volume Down               |
+        \*-------------------------------------------------*/
+        if(!button_1_found && is_volume_key_device(probe->capabilities, KEY_VOLUMEDOWN))
+        {
+            button_1_fd         = probe->fd;
+            button_1_found      = true;
+        }
+
+        /*-------------------------------------------------*\
+        | Check if this device is Touchscreen               |
+        \*-------------------------------------------------*/
+        if(!touchscreen_found && is_touchscreen_device(probe->capabilities))
+        {
+            touchpad->touchscreen_fd      = probe->fd;
+            touchscreen_found   = true;
+        }
+    }
+
+    /*-----------------------------------------------------*\
+    | If both volume up and down are on the same device,    |
+    | set the second button fd to invalid                   |
+    \*-----------------------------------------------------*/
+    if(button_0_fd == button_1_fd)
+    {
+        button_1_fd = -1;
+    }
+
+    /*-----------------------------------------------------*\
+    | Return true if touchscreen, volume up, and volume     |
+    | down were all found                                   |
+    \*-----------------------------------------------------*/
+    if(touchscreen_found && button_0_found && button_1_found)
+    {
+        return true;
+    }
+
+    touchpad->touchscreen_fd  = -1;
+    button_0_fd     = -1;
+    button_1_fd     = -1;
+
+    return false;
+}
+
+/*---------------------------------------------------------*\
+| hash_device_name                                          |
+|                                                           |
+| FNV-1a hash of the first len characters of a device name  |
+\*---------------------------------------------------------*/
+
+unsigned int hash_device_name(const char* name, int len)
+{
+    unsigned int hash = 2166136261u;
+
+    for(int i = 0; i < len; i++)
+    {
+        hash ^= (unsigned char)name[i];
+        hash *= 16777619u;
+    }
+
+    return(hash % DEVICE_INDEX_SIZE);
+}
+
+/*---------------------------------------------------------*\
+| init_device_entry                                         |
+|                                                           |
+| Clear a database entry to no roles and no tuning          |
+\*---------------------------------------------------------*/
+
+void init_device_entry(device_entry_type* entry, const char* device)
+{
+    memset(entry, 0, sizeof(*entry));
+
+    snprintf(entry->device, sizeof(entry->device), "%s", device);
+
+    for(int role = 0; role < NUM_INPUT_ROLES; role++)
+    {
+        entry->roles[role].bustype  = DEVICE_ID_ANY;
+        entry->roles[role].vendor   = DEVICE_ID_ANY;
+        entry->roles[role].product  = DEVICE_ID_ANY;
+    }
+
+    for(int button = 0; button < 2; button++)
+    {
+        for(int action = 0; action < 3; action++)
+        {
+            entry->button_events[button][action] = -1;
+        }
+    }
+}
+
+/*---------------------------------------------------------*\
+| load_builtin_devices                                      |
+|                                                           |
+| Add the known devices after any read from the database    |
+| file, so the file can override them                       |
+\*---------------------------------------------------------*/
+
+void load_builtin_devices()
+{
+    for(unsigned int device_idx = 0; device_idx < NUM_KNOWN_DEVICES && num_db_devices < MAX_DB_DEVICES; device_idx++)
+    {
+        const event_names_type* known = &known_devices[device_idx];
+        device_entry_type*      entry = &device_db[num_db_devices++];
+
+        init_device_entry(entry, known->device);
+
+        snprintf(entry->roles[INPUT_ROLE_TOUCHSCREEN].name, MAX_DEVICE_NAME, "%s", known->touchscreen);
+        snprintf(entry->roles[INPUT_ROLE_BUTTON_0].name,    MAX_DEVICE_NAME, "%s", known->button_0);
+        snprintf(entry->roles[INPUT_ROLE_BUTTON_1].name,    MAX_DEVICE_NAME, "%s", known->button_1);
+        snprintf(entry->roles[INPUT_ROLE_SLIDER].name,      MAX_DEVICE_NAME, "%s", known->slider);
+
+        entry->diagonal_mm = known->diagonal_mm;
+    }
+}
+
+/*---------------------------------------------------------*\
+| parse_device_id                                           |
+|                                                           |
+| Parse "bus:vendor:product" in hex, * matching any value   |
+\*---------------------------------------------------------*/
+
+bool parse_device_id(const char* value, device_match_type* match)
+{
+    int     fields[3];
+    char*   end;
+
+    for(int field = 0; field < 3; field++)
+    {
+        if(*value == '*')
+        {
+            fields[field] = DEVICE_ID_ANY;
+            end           = (char*)value + 1;
+        }
+        else
+        {
+            long id = strtol(value, &end, 16);
+
+            if(end == value || id < 0 || id > 0xFFFF)
+            {
+                return(false);
+            }
+
+            fields[field] = (int)id;
+        }
+
+        if(*end != ((field < 2) ? ':' : '\0'))
+        {
+            return(false);
+        }
+
+        value = end + 1;
+    }
+
+    match->bustype = fields[0];
+    match->vendor  = fields[1];
+    match->product = fields[2];
+
+    return(true);
+}
+
+/*---------------------------------------------------------*\
+| parse_button_event                                        |
+|                                                           |
+| Get the button event for its name in the database file    |
+\*---------------------------------------------------------*/
+
+int parse_button_event(const char* value)
+{
+    static const char* button_event_names[] =
+    {
+        "nothing",
+        "enable-touchpad",
+        "toggle-keyboard",
+        "close",
+        "volume-up",
+        "volume-down",
+        "change-orientation",
+        "enable-keyboard",
+        "disable-keyboard",
+    };
+
+    for(unsigned int event = 0; event < sizeof(button_event_names) / sizeof(button_event_names[0]); event++)
+    {
+        if(strcmp(value, button_event_names[event]) == 0)
+        {
+            return(event);
+        }
+    }
+
+    return(-1);
+}
+
+/*---------------------------------------------------------*\
+| parse_device_key                                          |
+|                                                           |
+| Set one key of a database entry from its value            |
+\*---------------------------------------------------------*/
+
+bool parse_device_key(device_entry_type* entry, const char* key, const char* value)
+{
+    static const char* role_keys[NUM_INPUT_ROLES] =
+    {
+        "touchscreen",
+        "button_0",
+        "button_1",
+        "slider",
+    };
+
+    static const char* action_keys[3] =
+    {
+        "click",
+        "short_hold",
+        "long_hold",
+    };
+
+    char    role_id_key[32];
+    char    action_key[32];
+
+    for(int role = 0; role < NUM_INPUT_ROLES; role++)
+    {
+        if(strcmp(key, role_keys[role]) == 0)
+        {
+            snprintf(entry->roles[role].name, MAX_DEVICE_NAME, "%s", value);
+            return(true);
+        }
+
+        snprintf(role_id_key, sizeof(role_id_key), "%s_id", role_keys[role]);
+
+        if(strcmp(key, role_id_key) == 0)
+        {
+            return(parse_device_id(value, &entry->roles[role]));
+        }
+    }
+
+    for(int button = 0; button < 2; button++)
+    {
+        for(int action = 0; action < 3; action++)
+        {
+            snprintf(action_key, sizeof(action_key), "button_%d_%s", button, action_keys[action]);
+
+            if(strcmp(key, action_key) == 0)
+            {
+                entry->button_events[button][action] = parse_button_event(value);
+
+                return(entry->button_events[button][action] >= 0);
+            }
+        }
+    }
+
+    if(strcmp(key, "diagonal_mm") == 0)
+    {
+        entry->diagonal_mm = strtof(value, NULL);
+
+        return(entry->diagonal_mm > 0.0f);
+    }
+
+    if(strcmp(key, "resolution") == 0)
+    {
+        entry->resolution = strtof(value, NULL);
+
+        return(entry->resolution > 0.0f);
+    }
+
+    if(strcmp(key, "orientation") == 0)
+    {
+        entry->orientation = atoi(value);
+
+        return(entry->orientation == 0 || entry->orientation == 90 || entry->orientation == 180 || entry->orientation == 270);
+    }
+
+    if(strcmp(key, "calibration_matrix") == 0)
+    {
+        float* cal = entry->calibration.m;
+
+        entry->has_calibration = (sscanf(value, "%f %f %f %f %f %f", &cal[0], &cal[1], &cal[2], &cal[3], &cal[4], &cal[5]) == 6);
+
+        return(entry->has_calibration);
+    }
+
+    if(strcmp(key, "accel_speed") == 0)
+    {
+        entry->accel_speed = strtof(value, NULL);
+
+        return(entry->accel_speed > 0.0f);
+    }
+
+    if(strcmp(key, "tap_time") == 0)
+    {
+        entry->tap_usec = (atoi(value) > 0) ? atoi(value) * 1000 : 0;
+
+        return(entry->tap_usec > 0);
+    }
+
+    if(strcmp(key, "tap_drag_time") == 0)
+    {
+        entry->tap_drag_usec = (atoi(value) > 0) ? atoi(value) * 1000 : 0;
+
+        return(entry->tap_drag_usec > 0);
+    }
+
+    if(strcmp(key, "hold_drag_time") == 0)
+    {
+        entry->hold_drag_usec = (atoi(value) > 0) ? atoi(value) * 1000 : 0;
+
+        return(entry->hold_drag_usec > 0);
+    }
+
+    if(strcmp(key, "touch_slop_mm") == 0)
+    {
+        entry->slop_mm = strtof(value, NULL);
+
+        return(entry->slop_mm > 0.0f);
+    }
+
+    return(false);
+}
+
+/*---------------------------------------------------------*\
+| trim_whitespace                                           |
+|                                                           |
+| Strip leading and trailing whitespace from a string       |
+\*---------------------------------------------------------*/
+
+char* trim_whitespace(char* str)
+{
+    char* end;
+
+    while(*str == ' ' || *str == '\t')
+    {
+        str++;
+    }
+
+    end = str + strlen(str);
+
+    while(end > str && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r' || end[-1] == '\n'))
+    {
+        *--end = '\0';
+    }
+
+    return(str);
+}
+
+/*---------------------------------------------------------*\
+| load_device_database                                      |
+|                                                           |
+| Read the devices in a database file.  Lines that cannot   |
+| be used are reported and skipped.  Returns false if the   |
+| file could not be opened                                  |
+\*---------------------------------------------------------*/
+
+bool load_device_database(const char* path)
+{
+    FILE*               file;
+    char                line[512];
+    int                 line_num    = 0;
+    device_entry_type*  entry       = NULL;
+
+    file = fopen(path, "r");
+
+    if(file == NULL)
+    {
+        return(false);
+    }
+
+    while(fgets(line, sizeof(line), file) != NULL)
+    {
+        char* str = trim_whitespace(line);
+        char* separator;
+
+        line_num++;
+
+        if(*str == '\0' || *str == '#' || *str == ';')
+        {
+            continue;
+        }
+
+        /*-------------------------------------------------*\
+        | A [Device Name] line starts a new entry           |
+        \*-------------------------------------------------*/
+        if(*str == '[')
+        {
+            char* close_bracket = strchr(str, ']');
+
+            entry = NULL;
+
+            if(close_bracket == NULL)
+            {
+                printf("Ignoring invalid device database section %s:%d\r\n", path, line_num);
+                continue;
+            }
+
+            if(num_db_devices >= MAX_DB_DEVICES)
+            {
+                printf("Ignoring device database section %s:%d, too many devices\r\n", path, line_num);
+                continue;
+            }
+
+            *close_bracket = '\0';
+
+            entry = &device_db[num_db_devices++];
+
+            init_device_entry(entry, trim_whitespace(str + 1));
+            continue;
+        }
+
+        separator = strchr(str, '=');
+
+        if(entry == NULL || separator == NULL)
+        {
+            printf("Ignoring device database line %s:%d\r\n", path, line_num);
+            continue;
+        }
+
+        *separator = '\0';
+
+        if(!parse_device_key(entry, trim_whitespace(str), trim_whitespace(separator + 1)))
+        {
+            printf("Ignoring invalid device database key %s:%d\r\n", path, line_num);
+        }
+    }
+
+    fclose(file);
+
+    return(true);
+}
+
+/*---------------------------------------------------------*\
+| role_in_entry                                             |
+|                                                           |
+| Check if a database entry names a device for a role       |
+\*---------------------------------------------------------*/
+
+bool role_in_entry(const device_entry_type* entry, int role)
+{
+    const device_match_type* match = &entry->roles[role];
+
+    return(match->name[0] != '\0'
+        || match->bustype != DEVICE_ID_ANY
+        || match->vendor  != DEVICE_ID_ANY
+        || match->product != DEVICE_ID_ANY);
+}
+
+/*---------------------------------------------------------*\
+| build_device_index                                        |
+|                                                           |
+| Hash each role's name prefix into the index and collect   |
+| the distinct prefix lengths to probe event names with     |
+\*---------------------------------------------------------*/
+
+void build_device_index()
+{
+    int num_nodes = 0;
+
+    for(int bucket = 0; bucket < DEVICE_INDEX_SIZE; bucket++)
+    {
+        device_index[bucket] = -1;
+    }
+
+    num_device_name_lengths = 0;
+
+    /*-----------------------------------------------------*\
+    | Chain entries in reverse so that each bucket lists    |
+    | them in database order                                |
+    \*-----------------------------------------------------*/
+    for(int entry_idx = num_db_devices - 1; entry_idx >= 0; entry_idx--)
+    {
+        for(int role = 0; role < NUM_INPUT_ROLES; role++)
+        {
+            const char* name    = device_db[entry_idx].roles[role].name;
+            int         len     = strlen(name);
+            int         length_idx;
+
+            if(!role_in_entry(&device_db[entry_idx], role))
+            {
+                continue;
+            }
+
+            unsigned int bucket = hash_device_name(name, len);
+
+            device_index_nodes[num_nodes].entry = entry_idx;
+            device_index_nodes[num_nodes].role  = role;
+            device_index_nodes[num_nodes].next  = device_index[bucket];
+            device_index[bucket]                = num_nodes++;
+
+            for(length_idx = 0; length_idx < num_device_name_lengths; length_idx++)
+            {
+                if(device_name_lengths[length_idx] == len)
+                {
+                    break;
+                }
+            }
+
+            if(length_idx == num_device_name_lengths)
+            {
+                device_name_lengths[num_device_name_lengths++] = len;
+            }
+        }
+    }
+}
+
+/*---------------------------------------------------------*\
+| device_matches_role                                       |
+|                                                           |
+| Check an input device against a database entry's role:    |
+| its name prefix, any IDs given and the capabilities the   |
+| role is read for                                          |
+\*---------------------------------------------------------*/
+
+bool device_matches_role(const device_entry_type* entry, int role, const char* name, const struct input_id* id, unsigned long capabilities[EV_MAX][NBITS(KEY_MAX)])
+{
+    const device_match_type* match = &entry->roles[role];
+
+    if(strncmp(name, match->name, strlen(match->name)) != 0
+    || (match->bustype != DEVICE_ID_ANY && match->bustype != id->bustype)
+    || (match->vendor  != DEVICE_ID_ANY && match->vendor  != id->vendor)
+    || (match->product != DEVICE_ID_ANY && match->product != id->product))
+    {
+        return(false);
+    }
+
+    switch(role)
+    {
+        case INPUT_ROLE_TOUCHSCREEN:
+            return(test_bit(EV_ABS, capabilities[0])
+               && (test_bit(ABS_MT_POSITION_X, capabilities[EV_ABS]) || test_bit(ABS_X, capabilities[EV_ABS])));
+
+        case INPUT_ROLE_BUTTON_0:
+        case INPUT_ROLE_BUTTON_1:
+            return(test_bit(EV_KEY, capabilities[0]));
+
+        case INPUT_ROLE_SLIDER:
+            return(test_bit(EV_ABS, capabilities[0])
+                && test_bit(EVENT_CODE_SLIDER, capabilities[EV_ABS]));
+    }
+
+    return(false);
+}
+
+/*---------------------------------------------------------*\
+| role_required                                             |
+|                                                           |
+| Check if a role of a database entry has to be found for   |
+| the entry to match.  The touchscreen always has to be,    |
+| and a slider replaces the buttons                         |
+\*---------------------------------------------------------*/
+
+bool role_required(const device_entry_type* entry, int role, bool no_buttons, bool no_slider)
+{
+    bool use_slider = !no_slider && role_in_entry(entry, INPUT_ROLE_SLIDER);
+
+    switch(role)
+    {
+        case INPUT_ROLE_TOUCHSCREEN:
+            return(true);
+
+        case INPUT_ROLE_BUTTON_0:
+        case INPUT_ROLE_BUTTON_1:
+            if(no_buttons || use_slider)
+            {
+                return(false);
+            }
+            break;
+
+        case INPUT_ROLE_SLIDER:
+            if(!use_slider)
+            {
+                return(false);
+            }
+            break;
+    }
+
+    return(role_in_entry(entry, role));
+}
+
+/*---------------------------------------------------------*\
+| scan_and_open_database                                    |
+|                                                           |
+| Open the first device in the database whose input devices |
+| are all present, in a single pass over the probed nodes   |
+\*---------------------------------------------------------*/
+
+bool scan_and_open_database(bool no_buttons, bool no_slider)
+{
+    int     candidates[MAX_DB_DEVICES][NUM_INPUT_ROLES];
+    int     role_fds[NUM_INPUT_ROLES];
+    int     found           = -1;
+
+    memset(candidates, 0xFF, sizeof(candidates));
+
+    for(int probe_idx = 0; probe_idx < num_input_probes; probe_idx++)
+    {
+        input_probe_type*   probe       = &input_probes[probe_idx];
+        int                 name_len    = strlen(probe->name);
+
+        if(probe->fd < 0)
+        {
+            continue;
+        }
+
+        /*-------------------------------------------------*\
+        | Look the name up once for each prefix length and  |
+        | keep the first node found for each entry's role   |
+        \*-------------------------------------------------*/
+        for(int length_idx = 0; length_idx < num_device_name_lengths; length_idx++)
+        {
+            int len = device_name_lengths[length_idx];
+
+            if(len > name_len)
+            {
+                continue;
+            }
+
+            for(int node = device_index[hash_device_name(probe->name, len)]; node >= 0; node = device_index_nodes[node].next)
+            {
+                int entry_idx   = device_index_nodes[node].entry;
+                int role        = device_index_nodes[node].role;
+
+                if(candidates[entry_idx][role] < 0
+                && (int)strlen(device_db[entry_idx].roles[role].name) == len
+                && device_matches_role(&device_db[entry_idx], role, probe->name, &probe->id, probe->capabilities))
+                {
+                    candidates[entry_idx][role] = probe_idx;
+                }
+            }
+        }
+    }
+
+    /*-----------------------------------------------------*\
+    | Pick the first entry with every required role found   |
+    \*-----------------------------------------------------*/
+    for(int entry_idx = 0; entry_idx < num_db_devices && found < 0; entry_idx++)
+    {
+        found = entry_idx;
+
+        for(int role = 0; role < NUM_INPUT_ROLES; role++)
+        {
+            if(role_required(&device_db[entry_idx], role, no_buttons, no_slider) && candidates[entry_idx][role] < 0)
+            {
+                found = -1;
+                break;
+            }
+        }
+    }
+
+    if(found < 0)
+    {
+        return(false);
+    }
+
+    /*-----------------------------------------------------*\
+    | Hand the chosen nodes to their roles.  Buttons that   |
+    | are both on one node are read through button 0 only   |
+    \*-----------------------------------------------------*/
+    for(int role = 0; role < NUM_INPUT_ROLES; role++)
+    {
+        role_fds[role] = -1;
+
+        if(role_required(&device_db[found], role, no_buttons, no_slider))
+        {
+            role_fds[role] = input_probes[candidates[found][role]].fd;
+        }
+    }
+
+    if(role_fds[INPUT_ROLE_BUTTON_1] == role_fds[INPUT_ROLE_BUTTON_0])
+    {
+        role_fds[INPUT_ROLE_BUTTON_1] = -1;
+    }
+
+    touchpad->touchscreen_fd      = role_fds[INPUT_ROLE_TOUCHSCREEN];
+    button_0_fd         = role_fds[INPUT_ROLE_BUTTON_0];
+    button_1_fd         = role_fds[INPUT_ROLE_BUTTON_1];
+    slider_fd           = role_fds[INPUT_ROLE_SLIDER];
+
+    input_device_entry  = &device_db[found];
+
+    return(true);
+}
+
+/*---------------------------------------------------------*\
+| apply_device_tuning                                       |
+|                                                           |
+| Use the matched device's tuning for whatever was not set  |
+| on the command line                                       |
+\*---------------------------------------------------------*/
+
+void apply_device_tuning(const device_entry_type* entry, bool calibration_set, bool accel_speed_set)
+{
+    int* button_events[2][3] =
+    {
+        { &button_0_click_event, &button_0_short_hold_event, &button_0_long_hold_event },
+        { &button_1_click_event, &button_1_short_hold_event, &button_1_long_hold_event },
+    };
+
+    touchpad->panel_diagonal_mm = entry->diagonal_mm;
+
+    if(touchpad->resolution_override <= 0.0f)
+    {
+        touchpad->resolution_override = entry->resolution;
+    }
+
+    /*-----------------------------------------------------*\
+    | A panel mounted rotated is turned upright after its   |
+    | calibration                                           |
+    \*-----------------------------------------------------*/
+    if(!calibration_set)
+    {
+        if(entry->has_calibration)
+        {
+            touchpad->calibration_matrix = entry->calibration;
+        }
+
+        touchpad->calibration_matrix = multiply_transform(&orientation_matrices[(entry->orientation / 90) & 3], &touchpad->calibration_matrix);
+    }
+
+    if(!accel_speed_set && entry->accel_speed > 0.0f)
+    {
+        touchpad->pointer_accel.speed = entry->accel_speed;
+    }
+
+    if(entry->tap_usec > 0)
+    {
+        touchpad->gesture.tap_usec = entry->tap_usec;
+    }
+
+    if(entry->tap_drag_usec > 0)
+    {
+        touchpad->gesture.tap_drag_usec = entry->tap_drag_usec;
+    }
+
+    if(entry->hold_drag_usec > 0)
+    {
+        touchpad->gesture.hold_drag_usec = entry->hold_drag_usec;
+    }
+
+    if(entry->slop_mm > 0.0f)
+    {
+        touchpad->gesture.slop_mm = entry->slop_mm;
+    }
+
+    for(int button = 0; button < 2; button++)
+    {
+        for(int action = 0; action < 3; action++)
+        {
+            if(entry->button_events[button][action] >= 0)
+            {
+                *button_events[button][action] = entry->button_events[button][action];
+            }
+        }
+    }
+}
+
+/*---------------------------------------------------------*\
+| find_device_cache_path                                    |
+|                                                           |
+| Locate the device cache under $XDG_CACHE_HOME, or under   |
+| ~/.cache if that is not set.  Returns false if neither is |
+\*---------------------------------------------------------*/
+
+bool find_device_cache_path()
+{
+    const char* cache_home  = getenv("XDG_CACHE_HOME");
+    const char* home        = getenv("HOME");
+
+    if(cache_home != NULL && cache_home[0] == '/')
+    {
+        snprintf(device_cache_path, sizeof(device_cache_path), "%s/" DEVICE_CACHE_FILE, cache_home);
+    }
+    else if(home != NULL && home[0] == '/')
+    {
+        snprintf(device_cache_path, sizeof(device_cache_path), "%s/.cache/" DEVICE_CACHE_FILE, home);
+    }
+    else
+    {
+        device_cache_path[0] = '\0';
+    }
+
+    return(device_cache_path[0] != '\0');
+}
+
+/*---------------------------------------------------------*\
+| device_cache_key                                          |
+|                                                           |
+| Describe what the cached devices were chosen with.  The   |
+| cache is only used if the options, the database file and  |
+| the built-in devices, by the program's own file, are the  |
+| same as when it was written                               |
+\*---------------------------------------------------------*/
+
+void device_cache_key(char* key, int len, bool no_buttons, bool no_slider, const char* db_path)
+{
+    struct stat db_stat;
+    struct stat exe_stat;
+
+    memset(&db_stat, 0, sizeof(db_stat));
+    memset(&exe_stat, 0, sizeof(exe_stat));
+
+    stat(db_path, &db_stat);
+    stat("/proc/self/exe", &exe_stat);
+
+    snprintf(key, len, "options %d %d %ld %ld", no_buttons, no_slider, (long)db_stat.st_mtime, (long)exe_stat.st_mtime);
+}
+
+/*---------------------------------------------------------*\
+| open_cached_devices                                       |
+|                                                           |
+| Open the devices chosen the last time, checking with two  |
+| ioctls per node that each is still the same device,       |
+| instead of probing every event node                       |
+\*---------------------------------------------------------*/
+
+bool open_cached_devices(bool no_buttons, bool no_slider, const char* db_path)
+{
+    int*    role_fds[NUM_INPUT_ROLES] = { &touchpad->touchscreen_fd, &button_0_fd, &button_1_fd, &slider_fd };
+    FILE*   file;
+    char    key[128];
+    char    line[512];
+    bool    valid;
+
+    if(device_cache_path[0] == '\0' || (file = fopen(device_cache_path, "r")) == NULL)
+    {
+        return(false);
+    }
+
+    device_cache_key(key, sizeof(key), no_buttons, no_slider, db_path);
+
+    for(int role = 0; role < NUM_INPUT_ROLES; role++)
+    {
+        *role_fds[role] = -1;
+    }
+
+    input_device_entry = NULL;
+
+    /*-----------------------------------------------------*\
+    | The key, then the database entry, empty for devices   |
+    | detected automatically, then one line per role        |
+    \*-----------------------------------------------------*/
+    valid = (fgets(line, sizeof(line), file) != NULL && strcmp(trim_whitespace(line), key) == 0);
+
+    if(valid && fgets(line, sizeof(line), file) != NULL && strncmp(line, "device", 6) == 0)
+    {
+        char* device = trim_whitespace(line + 6);
+
+        for(int entry_idx = 0; entry_idx < num_db_devices && device[0] != '\0'; entry_idx++)
+        {
+            if(strcmp(device_db[entry_idx].device, device) == 0)
+            {
+                input_device_entry = &device_db[entry_idx];
+                break;
+            }
+        }
+
+        valid = (device[0] == '\0' || input_device_entry != NULL);
+    }
+    else
+    {
+        valid = false;
+    }
+
+    while(valid && fgets(line, sizeof(line), file) != NULL)
+    {
+        struct input_id id;
+        struct input_id cached_id;
+        char            cached_name[256];
+        char            name[256];
+        char            path[64];
+        int             role;
+        int             event_id;
+        int             fd;
+        unsigned int    bustype;
+        unsigned int    vendor;
+        unsigned int    product;
+
+        memset(name, 0, sizeof(name));
+        memset(cached_name, 0, sizeof(cached_name));
+        memset(&id, 0, sizeof(id));
+
+        if(sscanf(line, "%d %d %x %x %x %255[^\n]", &role, &event_id, &bustype, &vendor, &product, cached_name) < 5
+        || role < 0 || role >= NUM_INPUT_ROLES || *role_fds[role] >= 0)
+        {
+            valid = false;
+            break;
+        }
+
+        snprintf(path, sizeof(path), INPUT_DEV_PATH "/event%d", event_id);
+
+        fd = open(path, O_RDONLY|O_NONBLOCK);
+
+        if(fd < 0)
+        {
+            valid = false;
+            break;
+        }
+
+        *role_fds[role] = fd;
+
+        ioctl(fd, EVIOCGNAME(sizeof(name) - 1), name);
+        ioctl(fd, EVIOCGID, &id);
+
+        cached_id.bustype = bustype;
+        cached_id.vendor  = vendor;
+        cached_id.product = product;
+
+        valid = (strcmp(name, cached_name) == 0
+              && id.bustype == cached_id.bustype
+              && id.vendor  == cached_id.vendor
+              && id.product == cached_id.product);
+    }
+
+    fclose(file);
+
+    if(valid && touchpad->touchscreen_fd >= 0)
+    {
+        return(true);
+    }
+
+    for(int role = 0; role < NUM_INPUT_ROLES; role++)
+    {
+        if(*role_fds[role] >= 0)
+        {
+            close(*role_fds[role]);
+        }
+
+        *role_fds[role] = -1;
+    }
+
+    input_device_entry = NULL;
+
+    return(false);
+}
+
+/*---------------------------------------------------------*\
+| write_device_cache                                        |
+|                                                           |
+| Record the devices just chosen from the probed nodes for  |
+| the next start.  The file is replaced atomically          |
+\*---------------------------------------------------------*/
+
+void write_device_cache(bool no_buttons, bool no_slider, const char* db_path)
+{
+    int*    role_fds[NUM_INPUT_ROLES] = { &touchpad->touchscreen_fd, &button_0_fd, &button_1_fd, &slider_fd };
+    FILE*   file;
+    char    key[128];
+    char    dir[512];
+    char    temp_path[600];
+    char*   separator;
+
+    if(device_cache_path[0] == '\0')
+    {
+        return;
+    }
+
+    /*-----------------------------------------------------*\
+    | Create the cache directory and its parent if needed   |
+    \*-----------------------------------------------------*/
+    snprintf(dir, sizeof(dir), "%s", device_cache_path);
+
+    separator = strrchr(dir, '/');
+    *separator = '\0';
+
+    separator = strrchr(dir, '/');
+
+    if(separator != NULL && separator != dir)
+    {
+        *separator = '\0';
+        mkdir(dir, 0755);
+        *separator = '/';
+    }
+
+    mkdir(dir, 0755);
+
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", device_cache_path);
+
+    file = fopen(temp_path, "w");
+
+    if(file == NULL)
+    {
+        return;
+    }
+
+    device_cache_key(key, sizeof(key), no_buttons, no_slider, db_path);
+
+    fprintf(file, "%s\n", key);
+    fprintf(file, "device %s\n", input_device_entry != NULL ? input_device_entry->device : "");
+
+    for(int role = 0; role < NUM_INPUT_ROLES; role++)
+    {
+        struct input_id id;
+        char            name[256];
+        int             fd = *role_fds[role];
+
+        if(fd < 0)
+        {
+            continue;
+        }
+
+        memset(name, 0, sizeof(name));
+        memset(&id, 0, sizeof(id));
+
+        ioctl(fd, EVIOCGNAME(sizeof(name) - 1), name);
+        ioctl(fd, EVIOCGID, &id);
+
+        fprintf(file, "%d %d %04x %04x %04x %s\n", role, find_probe_event_id(fd), id.bustype, id.vendor, id.product, name);
+    }
+
+    if(fclose(file) != 0 || rename(temp_path, device_cache_path) != 0)
+    {
+        unlink(temp_path);
+    }
+}
+
+/*---------------------------------------------------------*\
+| print_opened_devices                                      |
+|                                                           |
+| List the device and the input devices opened for it       |
+\*---------------------------------------------------------*/
+
+void print_opened_devices()
+{
+    int         role_fds[NUM_INPUT_ROLES]   = { touchpad->touchscreen_fd, button_0_fd, button_1_fd, slider_fd };
+    const char* role_names[NUM_INPUT_ROLES] =
+    {
+        "Touchscreen:",
+        "Buttons:    ",
+        "Buttons:    ",
+        "Slider:     ",
+    };
+
+    printf("Opened device %s with:\r\n", input_device_entry != NULL ? input_device_entry->device : "Automatic");
+
+    for(int role = 0; role < NUM_INPUT_ROLES; role++)
+    {
+        char name[256];
+
+        if(role_fds[role] >= 0)
+        {
+            memset(name, 0, sizeof(name));
+            ioctl(role_fds[role], EVIOCGNAME(sizeof(name) - 1), name);
+            printf("    %s %s\r\n", role_names[role], name);
+        }
+    }
+}
+
+/*---------------------------------------------------------*\
+| process_button_event                                      |
+|                                                           |
+| Process a button event                                    |
+\*---------------------------------------------------------*/
+
+void process_button_event(int event)
+{
+    switch(event)
+    {
+        case BUTTON_EVENT_ENABLE_TOUCHPAD:
+            enable_touchpad();
+            disable_keyboard();
+            break;
+
+        case BUTTON_EVENT_DISABLE_TOUCHPAD_TOGGLE_KEYBOARD:
+            if(!touchpads[0].enabled)
+            {
+                if(keyboard_enable)
+                {
+                    disable_keyboard();
+                }
+                else
+                {
+                    enable_keyboard();
+                }
+            }
+            
+            disable_touchpad();
+            break;
+
+        case BUTTON_EVENT_DISABLE_TOUCHPAD_DISABLE_KEYBOARD:
+            if(!touchpads[0].enabled)
+            {
+                disable_keyboard();
+            }
+            
+            disable_touchpad();
+            break;
+
+        case BUTTON_EVENT_DISABLE_TOUCHPAD_ENABLE_KEYBOARD:
+            if(!touchpads[0].enabled)
+            {
+                enable_keyboard();
+            }
+            
+            disable_touchpad();
+            break;
+
+        case BUTTON_EVENT_CLOSE:
+            close_flag = 1;
+            break;
+        
+        case BUTTON_EVENT_EMIT_VOLUMEUP:
+            queue_event(&buttons_frame, EV_KEY, KEY_VOLUMEUP, 1);
+            queue_sync(&buttons_frame);
+            queue_event(&buttons_frame, EV_KEY, KEY_VOLUMEUP, 0);
+            flush_frame(&buttons_frame, virtual_buttons_fd);
+            break;
+            
+        case BUTTON_EVENT_EMIT_VOLUMEDOWN:
+            queue_event(&buttons_frame, EV_KEY, KEY_VOLUMEDOWN, 1);
+            queue_sync(&buttons_frame);
+            queue_event(&buttons_frame, EV_KEY, KEY_VOLUMEDOWN, 0);
+            flush_frame(&buttons_frame, virtual_buttons_fd);
+            break;
+
+        case BUTTON_EVENT_CHANGE_ORIENTATION:
+            touchpads[0].rotation += 90;
+
+            if(touchpads[0].rotation > 270)
+            {
+                touchpads[0].rotation = 0;
+            }
+            break;
+    }
+}
+
+/*---------------------------------------------------------*\
+| drag_timeout                                              |
+|                                                           |
+| Handle the hold-to-drag timer timeout                     |
+\*---------------------------------------------------------*/
+
+void drag_timeout(event_source_type* source)
+{
+    touchpad = TOUCHPAD_OF(source, drag_timer);
+
+    if(read_timer(source))
+    {
+        feed_gesture(GESTURE_INPUT_HOLD_TIMEOUT);
+        output_mouse_frame();
+    }
+}
+
+/*---------------------------------------------------------*\
+| tap_timeout                                               |
+|                                                           |
+| Handle the tap-to-drag window timeout                     |
+\*---------------------------------------------------------*/
+
+void tap_timeout(event_source_type* source)
+{
+    touchpad = TOUCHPAD_OF(source, tap_timer);
+
+    if(read_timer(source))
+    {
+        feed_gesture(GESTURE_INPUT_TAP_TIMEOUT);
+    }
+}
+
+/*---------------------------------------------------------*\
+| output_timeout                                            |
+|                                                           |
+| Send the motion held back for the end of the period       |
+\*---------------------------------------------------------*/
+
+void output_timeout(event_source_type* source)
+{
+    touchpad = TOUCHPAD_OF(source, output_timer);
+
+    if(read_timer(source))
+    {
+        touchpad->output_scheduler.timer_armed = false;
+        output_mouse_frame();
+    }
+}
+
+/*---------------------------------------------------------*\
+| prediction_timeout                                        |
+|                                                           |
+| Drop the prediction lead once the finger has stopped      |
+\*---------------------------------------------------------*/
+
+void prediction_timeout(event_source_type* source)
+{
+    touchpad = TOUCHPAD_OF(source, prediction_timer);
+
+    if(read_timer(source) && touchpad->touch_active)
+    {
+        retract_prediction();
+        output_mouse_frame();
+    }
+}
+
+/*---------------------------------------------------------*\
+| kinetic_timeout                                           |
+|                                                           |
+| Advance kinetic scrolling by the time since the last step |
+\*---------------------------------------------------------*/
+
+void kinetic_timeout(event_source_type* source)
+{
+    struct timespec now;
+
+    touchpad = TOUCHPAD_OF(source, kinetic_timer);
+
+    if(!read_timer(source) || !touchpad->scroll.kinetic)
+    {
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    float elapsed_ms = ((now.tv_sec - touchpad->scroll.kinetic_time.tv_sec) * 1000.0f) + ((now.tv_nsec - touchpad->scroll.kinetic_time.tv_nsec) / 1000000.0f);
+
+    touchpad->scroll.kinetic_time = now;
+
+    /*-----------------------------------------------------*\
+    | Scroll by the distance covered while the velocity     |
+    | decayed over the elapsed time                         |
+    \*-----------------------------------------------------*/
+    float decay     = expf(-touchpad->scroll.friction * (elapsed_ms / 1000.0f));
+    float distance  = (1.0f - decay) / (touchpad->scroll.friction / 1000.0f);
+
+    queue_scroll(touchpad->scroll.velocity_v * distance, &touchpad->scroll.remainder_v, &touchpad->scroll.detent_v, REL_WHEEL_HI_RES,  REL_WHEEL);
+    queue_scroll(touchpad->scroll.velocity_h * distance, &touchpad->scroll.remainder_h, &touchpad->scroll.detent_h, REL_HWHEEL_HI_RES, REL_HWHEEL);
+
+    output_mouse_frame();
+
+    touchpad->scroll.velocity_v *= decay;
+    touchpad->scroll.velocity_h *= decay;
+
+    if(hypotf(touchpad->scroll.velocity_v, touchpad->scroll.velocity_h) < KINETIC_STOP_SPEED)
+    {
+        stop_kinetic_scroll();
+    }
+}
+
+/*---------------------------------------------------------*\
+| emit_volume_passthrough                                   |
+|                                                           |
+| Write a passed through volume key's press, repeat or      |
+| release to the virtual buttons device                     |
+\*---------------------------------------------------------*/
+
+void emit_volume_passthrough(volume_button_type* button, int value)
+{
+    queue_event(&buttons_frame, EV_KEY, button->passthrough_key, value);
+    flush_frame(&buttons_frame, virtual_buttons_fd);
+
+    if(value == 0)
+    {
+        button->passthrough_key = 0;
+    }
+}
+
+/*---------------------------------------------------------*\
+| schedule_volume_button                                    |
+|                                                           |
+| Arm a held volume key's timer for its next hold threshold |
+| or, once no hold action is left pending, its next repeat. |
+| A key that may still switch modes does not repeat, as     |
+| repeating the volume change would fight it                |
+\*---------------------------------------------------------*/
+
+void schedule_volume_button(volume_button_type* button)
+{
+    unsigned int next_usec = 0;
+
+    if(button->hold_stage < HOLD_STAGE_SHORT && *button->short_hold_event != BUTTON_EVENT_DO_NOTHING)
+    {
+        next_usec = short_hold_usec;
+    }
+    else if(button->hold_stage < HOLD_STAGE_LONG && *button->long_hold_event != BUTTON_EVENT_DO_NOTHING)
+    {
+        next_usec = long_hold_usec;
+    }
+    else if(button->passthrough_key && repeat_period_usec > 0)
+    {
+        next_usec = repeat_delay_usec;
+
+        if(button->held_usec >= repeat_delay_usec)
+        {
+            next_usec = button->held_usec + repeat_period_usec;
+        }
+    }
+
+    if(next_usec <= button->held_usec)
+    {
+        stop_timer(&button->timer);
+        return;
+    }
+
+    button->next_usec = next_usec;
+
+    start_timer(&button->timer, next_usec - button->held_usec);
+}
+
+/*---------------------------------------------------------*\
+| volume_button_timeout                                     |
+|                                                           |
+| Handle a held volume key reaching a hold threshold or its |
+| next repeat                                               |
+\*---------------------------------------------------------*/
+
+void volume_button_timeout(event_source_type* source)
+{
+    volume_button_type* button = VOLUME_BUTTON_OF(source);
+
+    if(!read_timer(source) || !button->pressed)
+    {
+        return;
+    }
+
+    button->held_usec = button->next_usec;
+
+    if(button->hold_stage < HOLD_STAGE_SHORT
+    && *button->short_hold_event != BUTTON_EVENT_DO_NOTHING
+    && button->held_usec >= short_hold_usec)
+    {
+        if(button->passthrough_key)
+        {
+            emit_volume_passthrough(button, 0);
+        }
+
+        button->hold_stage = HOLD_STAGE_SHORT;
+        process_button_event(*button->short_hold_event);
+    }
+    else if(button->hold_stage < HOLD_STAGE_LONG
+    && *button->long_hold_event != BUTTON_EVENT_DO_NOTHING
+    && button->held_usec >= long_hold_usec)
+    {
+        if(button->passthrough_key)
+        {
+            emit_volume_passthrough(button, 0);
+        }
+
+        button->hold_stage = HOLD_STAGE_LONG;
+        process_button_event(*button->long_hold_event);
+    }
+    else if(button->passthrough_key)
+    {
+        emit_volume_passthrough(button, 2);
+    }
+
+    schedule_volume_button(button);
+}
+
+/*---------------------------------------------------------*\
+| release_volume_button                                     |
+|                                                           |
+| Forget a volume key press without firing its click, such  |
+| as when its device goes away while it is held             |
+\*---------------------------------------------------------*/
+
+void release_volume_button(volume_button_type* button)
+{
+    stop_timer(&button->timer);
+
+    if(button->passthrough_key)
+    {
+        emit_volume_passthrough(button, 0);
+    }
+
+    button->pressed = 0;
+}
+
+/*---------------------------------------------------------*\
+| process_volume_key_event                                  |
+|                                                           |
+| Process a volume key input event.  A click that emits a   |
+| volume key is passed through on press, any other click    |
+| fires on release if no hold action fired first            |
+\*---------------------------------------------------------*/
+
+void process_volume_key_event(struct input_event* buttons_event)
+{
+    volume_button_type* button;
+
+    if(buttons_event->type != EV_KEY)
+    {
+        return;
+    }
+
+    if(buttons_event->code == KEY_VOLUMEUP)
+    {
+        button = &volume_buttons[0];
+    }
+    else if(buttons_event->code == KEY_VOLUMEDOWN)
+    {
+        button = &volume_buttons[1];
+    }
+    else
+    {
+        return;
+    }
+
+    /*-----------------------------------------------------*\
+    | Handle the press, passing the click's volume key      |
+    | through right away                                    |
+    \*-----------------------------------------------------*/
+    if(buttons_event->value == 1 && !button->pressed)
+    {
+        button->pressed         = 1;
+        button->hold_stage      = HOLD_STAGE_NONE;
+        button->held_usec       = 0;
+
+        if(*button->click_event == BUTTON_EVENT_EMIT_VOLUMEUP)
+        {
+            button->passthrough_key = KEY_VOLUMEUP;
+        }
+        else if(*button->click_event == BUTTON_EVENT_EMIT_VOLUMEDOWN)
+        {
+            button->passthrough_key = KEY_VOLUMEDOWN;
+        }
+
+        if(button->passthrough_key)
+        {
+            emit_volume_passthrough(button, 1);
+        }
+
+        schedule_volume_button(button);
+    }
 
     /*-----------------------------------------------------*\
-    | Connect to the system bus and check for errors        |
+    | Handle the release                                    |
     \*-----------------------------------------------------*/
-    conn = dbus_bus_get(DBUS_BUS_SYSTEM, &err);
-
-    if(dbus_error_is_set(&err))
+    else if(buttons_event->value == 0 && button->pressed)
     {
-        dbus_error_free(&err);
+        stop_timer(&button->timer);
+
+        button->pressed = 0;
+
+        if(button->passthrough_key)
+        {
+            emit_volume_passthrough(button, 0);
+        }
+        else if(button->hold_stage == HOLD_STAGE_NONE)
+        {
+            process_button_event(*button->click_event);
+        }
     }
+}
+
+/*---------------------------------------------------------*\
+| resync_volume_keys                                        |
+|                                                           |
+| Compare the kernel's volume key state with the last state |
+| seen and replay any press or release that was dropped,    |
+| timestamped with the given SYN_REPORT.  Only the keys fd  |
+| reports are checked, as the other may be on another node  |
+\*---------------------------------------------------------*/
+
+void resync_volume_keys(int fd, struct input_event* syn_event)
+{
+    unsigned long supported_bits[NBITS(KEY_MAX)];
+    unsigned long key_bits[NBITS(KEY_MAX)];
+
+    memset(supported_bits, 0, sizeof(supported_bits));
+    memset(key_bits, 0, sizeof(key_bits));
 
-    if(NULL == conn)
+    if(ioctl(fd, EVIOCGBIT(EV_KEY, KEY_MAX), supported_bits) < 0
+    || ioctl(fd, EVIOCGKEY(sizeof(key_bits)), key_bits) < 0)
     {
-        exit(1);
+        return;
     }
 
-    /*-----------------------------------------------------*\
-    | Create a new method call and check for errors         |
-    \*-----------------------------------------------------*/
-    msg = dbus_message_new_method_call("net.hadess.SensorProxy",
-                                       "/net/hadess/SensorProxy",
-                                       "org.freedesktop.DBus.Properties",
-                                       "Get");
-
-    if(NULL == msg)
+    for(int key_idx = 0; key_idx < 2; key_idx++)
     {
-        exit(1);
+        int pressed = test_bit(volume_buttons[key_idx].key, key_bits);
+
+        if(!test_bit(volume_buttons[key_idx].key, supported_bits))
+        {
+            continue;
+        }
+
+        if(pressed != volume_buttons[key_idx].pressed)
+        {
+            struct input_event key_event = *syn_event;
+
+            key_event.type  = EV_KEY;
+            key_event.code  = volume_buttons[key_idx].key;
+            key_event.value = pressed;
+
+            process_volume_key_event(&key_event);
+        }
     }
+}
 
-    /*-----------------------------------------------------*\
-    | Append arguments                                      |
-    \*-----------------------------------------------------*/
-    dbus_message_iter_init_append(msg, &args);
+/*---------------------------------------------------------*\
+| is_volume_key_event                                       |
+|                                                           |
+| Check if a button device event is used by the volume key  |
+| handling rather than forwarded                            |
+\*---------------------------------------------------------*/
+
+bool is_volume_key_event(struct input_event* buttons_event)
+{
+    return(buttons_event->type == EV_KEY
+       && (buttons_event->code == KEY_VOLUMEUP || buttons_event->code == KEY_VOLUMEDOWN));
+}
+
+/*---------------------------------------------------------*\
+| forward_button_event                                      |
+|                                                           |
+| Queue a button device event the volume key handling does  |
+| not use for the virtual buttons device, unchanged.  A     |
+| full frame is written out early rather than dropping      |
+| events                                                    |
+\*---------------------------------------------------------*/
 
-    char* arg1 = "net.hadess.SensorProxy";
-    char* arg2 = "AccelerometerOrientation";
-    if(!dbus_message_iter_append_basic(&args, DBUS_TYPE_STRING, &arg1))
+void forward_button_event(struct input_event* buttons_event)
+{
+    if(buttons_event->type == EV_SYN)
     {
-        exit(1);
+        if(buttons_event->code == SYN_REPORT)
+        {
+            queue_sync(&buttons_frame);
+        }
+        return;
     }
 
-    if(!dbus_message_iter_append_basic(&args, DBUS_TYPE_STRING, &arg2))
+    if(buttons_frame.count >= (OUTPUT_FRAME_SIZE - 1))
     {
-          exit(1);
+        flush_frame(&buttons_frame, virtual_buttons_fd);
     }
 
-    /*-----------------------------------------------------*\
-    | Send message and get a handle for a reply             |
-    \*-----------------------------------------------------*/
-    if(!dbus_connection_send_with_reply (conn, msg, &pending, -1))
+    if(buttons_event->type == EV_KEY && buttons_event->code < KEY_CNT && buttons_event->value != 2)
     {
-        exit(1);
+        if(buttons_event->value)
+        {
+            forwarded_key_state[LONG(buttons_event->code)] |= BIT(buttons_event->code);
+        }
+        else
+        {
+            forwarded_key_state[LONG(buttons_event->code)] &= ~BIT(buttons_event->code);
+        }
     }
-       
-    if(NULL == pending)
+    else if(buttons_event->type == EV_SW && buttons_event->code < SW_CNT)
     {
-        exit(1);
+        if(buttons_event->value)
+        {
+            forwarded_sw_state[LONG(buttons_event->code)] |= BIT(buttons_event->code);
+        }
+        else
+        {
+            forwarded_sw_state[LONG(buttons_event->code)] &= ~BIT(buttons_event->code);
+        }
     }
 
-    dbus_connection_flush(conn);
+    queue_event(&buttons_frame, buttons_event->type, buttons_event->code, buttons_event->value);
+}
 
-    /*-----------------------------------------------------*\
-    | Free message                                          |
-    \*-----------------------------------------------------*/
-    dbus_message_unref(msg);
+/*---------------------------------------------------------*\
+| resync_forwarded_events                                   |
+|                                                           |
+| Compare a button device's key and switch state with what  |
+| was last forwarded from it and forward any change that    |
+| was dropped                                               |
+\*---------------------------------------------------------*/
 
-    /*-----------------------------------------------------*\
-    | Block until we recieve a reply                        |
-    \*-----------------------------------------------------*/
-    dbus_pending_call_block(pending);
+void resync_forwarded_events(int fd)
+{
+    unsigned long   supported_bits[NBITS(KEY_CNT)];
+    unsigned long   state_bits[NBITS(KEY_CNT)];
+    struct input_event  forward_event;
+
+    memset(&forward_event, 0, sizeof(forward_event));
 
     /*-----------------------------------------------------*\
-    | Get the reply message                                 |
+    | Keys other than the volume keys                       |
     \*-----------------------------------------------------*/
-    msg = dbus_pending_call_steal_reply(pending);
+    memset(supported_bits, 0, sizeof(supported_bits));
+    memset(state_bits,     0, sizeof(state_bits));
 
-    if(NULL == msg)
+    if(ioctl(fd, EVIOCGBIT(EV_KEY, KEY_MAX), supported_bits) >= 0
+    && ioctl(fd, EVIOCGKEY(sizeof(state_bits)), state_bits) >= 0)
     {
-        exit(1);
+        forward_event.type = EV_KEY;
+
+        for(forward_event.code = 0; forward_event.code < KEY_CNT; forward_event.code++)
+        {
+            forward_event.value = test_bit(forward_event.code, state_bits);
+
+            if(test_bit(forward_event.code, supported_bits)
+            && !is_volume_key_event(&forward_event)
+            && forward_event.value != (int)test_bit(forward_event.code, forwarded_key_state))
+            {
+                forward_button_event(&forward_event);
+            }
+        }
     }
 
     /*-----------------------------------------------------*\
-    | Free the pending message handle                       |
+    | Switches                                              |
     \*-----------------------------------------------------*/
-    dbus_pending_call_unref(pending);
+    memset(supported_bits, 0, sizeof(supported_bits));
+    memset(state_bits,     0, sizeof(state_bits));
+
+    if(ioctl(fd, EVIOCGBIT(EV_SW, SW_MAX), supported_bits) >= 0
+    && ioctl(fd, EVIOCGSW(sizeof(state_bits)), state_bits) >= 0)
+    {
+        forward_event.type = EV_SW;
+
+        for(forward_event.code = 0; forward_event.code < SW_CNT; forward_event.code++)
+        {
+            forward_event.value = test_bit(forward_event.code, state_bits);
+
+            if(test_bit(forward_event.code, supported_bits)
+            && forward_event.value != (int)test_bit(forward_event.code, forwarded_sw_state))
+            {
+                forward_button_event(&forward_event);
+            }
+        }
+    }
+
+    queue_sync(&buttons_frame);
+    flush_frame(&buttons_frame, virtual_buttons_fd);
+}
+
+/*---------------------------------------------------------*\
+| process_slider_event                                      |
+|                                                           |
+| Process a slider input event                              |
+\*---------------------------------------------------------*/
 
+void process_slider_event(struct input_event* slider_event)
+{
     /*-----------------------------------------------------*\
-    | Read the parameters                                   |
+    | Handle slider events                                  |
     \*-----------------------------------------------------*/
-    if (!dbus_message_iter_init(msg, &args))
+    if((slider_event->type == EV_ABS) && (slider_event->code == EVENT_CODE_SLIDER))
     {
-        fprintf(stderr, "Message has no arguments!\n");
+        switch(slider_event->value)
+        {
+            case 0:
+                process_button_event(BUTTON_EVENT_ENABLE_TOUCHPAD);
+                break;
+                
+            case 1:
+                process_button_event(BUTTON_EVENT_DISABLE_TOUCHPAD_DISABLE_KEYBOARD);
+                break;
+                
+            case 2:
+                process_button_event(BUTTON_EVENT_DISABLE_TOUCHPAD_ENABLE_KEYBOARD);
+                break;
+        }
     }
-    else if(DBUS_TYPE_VARIANT != dbus_message_iter_get_arg_type(&args))
+}
+
+/*---------------------------------------------------------*\
+| process_touchscreen_events                                |
+|                                                           |
+| Process a batch of touchscreen events in order, up to and |
+| including each frame's SYN_REPORT                         |
+\*---------------------------------------------------------*/
+
+void process_touchscreen_events(event_source_type* source, struct input_event* events, int count)
+{
+    touchpad = TOUCHPAD_OF(source, touchscreen_source);
+
+    if(!touchpad->enabled)
     {
-        fprintf(stderr, "Argument is not variant! It is: %d\n", dbus_message_iter_get_arg_type(&args));
+        reset_touch_state();
+        return;
     }
-    else
+
+    for(int event_idx = 0; event_idx < count; event_idx++)
     {
-        dbus_message_iter_recurse(&args, &args_variant);
-        
-        if(dbus_message_iter_get_arg_type(&args_variant) == DBUS_TYPE_STRING)
-        {
-            dbus_message_iter_get_basic(&args_variant, &stat);
+        process_touchscreen_event(&events[event_idx]);
+    }
+}
 
-            /*---------------------------------------------*\
-            | Copy reply                                    |
-            \*---------------------------------------------*/
-            strncpy(query_buf, stat, 64);
+/*---------------------------------------------------------*\
+| process_buttons_events                                    |
+|                                                           |
+| Process a batch of buttons events                         |
+\*---------------------------------------------------------*/
+
+void process_buttons_events(event_source_type* source, struct input_event* events, int count)
+{
+    for(int event_idx = 0; event_idx < count; event_idx++)
+    {
+        struct input_event* buttons_event = &events[event_idx];
+
+        /*-------------------------------------------------*\
+        | After a SYN_DROPPED, discard the incomplete frame |
+        | and resync the volume keys and forwarded events   |
+        | from the key and switch state                     |
+        \*-------------------------------------------------*/
+        if(buttons_event->type == EV_SYN && buttons_event->code == SYN_DROPPED)
+        {
+            source->syn_dropped = true;
+        }
+        else if(source->syn_dropped)
+        {
+            if(buttons_event->type == EV_SYN && buttons_event->code == SYN_REPORT)
+            {
+                source->syn_dropped = false;
+                resync_volume_keys(source->fd, buttons_event);
+                resync_forwarded_events(source->fd);
+            }
+        }
+        else if(is_volume_key_event(buttons_event))
+        {
+            process_volume_key_event(buttons_event);
+        }
+        else
+        {
+            forward_button_event(buttons_event);
         }
     }
 
     /*-----------------------------------------------------*\
-    | Free reply                                            |
+    | Write everything forwarded from this batch at once    |
     \*-----------------------------------------------------*/
-    dbus_message_unref(msg);
-
-    return(query_buf);
+    flush_frame(&buttons_frame, virtual_buttons_fd);
 }
 
 /*---------------------------------------------------------*\
-| rotation_from_accelerometer_orientation                   |
+| process_slider_events                                     |
 |                                                           |
-| Determine the orientation angle from SensorProxy's        |
-| AccelerometerOrientation property                         |
+| Process a batch of slider events                          |
 \*---------------------------------------------------------*/
 
-int rotation_from_accelerometer_orientation(const char* orientation)
+void process_slider_events(event_source_type* source, struct input_event* events, int count)
 {
-    if(strncmp(orientation, "right-up", 64) == 0)
-    {
-        return(90);
-    }
-    else if(strncmp(orientation, "bottom-up", 64) == 0)
+    for(int event_idx = 0; event_idx < count; event_idx++)
     {
-        return(180);
+        struct input_event* slider_event = &events[event_idx];
+
+        /*-------------------------------------------------*\
+        | After a SYN_DROPPED, discard the incomplete frame |
+        | and resync the slider from its current position   |
+        \*-------------------------------------------------*/
+        if(slider_event->type == EV_SYN && slider_event->code == SYN_DROPPED)
+        {
+            source->syn_dropped = true;
+        }
+        else if(source->syn_dropped)
+        {
+            if(slider_event->type == EV_SYN && slider_event->code == SYN_REPORT)
+            {
+                struct input_absinfo absinfo;
+
+                source->syn_dropped = false;
+
+                if(ioctl(source->fd, EVIOCGABS(EVENT_CODE_SLIDER), &absinfo) == 0)
+                {
+                    struct input_event abs_event = *slider_event;
+
+                    abs_event.type  = EV_ABS;
+                    abs_event.code  = EVENT_CODE_SLIDER;
+                    abs_event.value = absinfo.value;
+
+                    process_slider_event(&abs_event);
+                }
+            }
+        }
+        else
+        {
+            process_slider_event(slider_event);
+        }
     }
-    else if(strncmp(orientation, "left-up", 64) == 0)
+}
+
+/*---------------------------------------------------------*\
+| handle_signal                                             |
+|                                                           |
+| Handle a termination signal by leaving the main loop so   |
+| that the virtual devices are cleaned up before exiting    |
+\*---------------------------------------------------------*/
+
+void handle_signal(event_source_type* source)
+{
+    struct signalfd_siginfo siginfo;
+
+    if(read(source->fd, &siginfo, sizeof(siginfo)) == sizeof(siginfo))
     {
-        return(270);
+        close_flag = 1;
     }
-    else if(strncmp(orientation, "normal", 64) == 0)
+}
+
+/*---------------------------------------------------------*\
+| Input device roles, with the event source and processing  |
+| function each one's device is read with                   |
+\*---------------------------------------------------------*/
+input_role_type input_roles[NUM_INPUT_ROLES] =
+{
+    { "Touchscreen",    &touchpads[0].touchscreen_fd, &touchpads[0].touchscreen_source, process_touchscreen_events  },
+    { "Volume Up",      &button_0_fd,       &button_0_source,       process_buttons_events      },
+    { "Volume Down",    &button_1_fd,       &button_1_source,       process_buttons_events      },
+    { "Slider",         &slider_fd,         &slider_source,         process_slider_events       },
+};
+
+/*---------------------------------------------------------*\
+| input_roles_missing                                       |
+|                                                           |
+| Check if any device opened at startup is currently gone   |
+\*---------------------------------------------------------*/
+
+bool input_roles_missing()
+{
+    for(int role = 0; role < NUM_INPUT_ROLES; role++)
     {
-        return(0);
+        if(input_role_wanted[role] && *input_roles[role].fd < 0)
+        {
+            return(true);
+        }
     }
-    else
+
+    return(false);
+}
+
+/*---------------------------------------------------------*\
+| match_input_role                                          |
+|                                                           |
+| Find the missing role a newly opened device fills, by the |
+| database entry it was first opened by or, for devices     |
+| detected automatically, by its capabilities.  Returns -1  |
+| if none                                                   |
+\*---------------------------------------------------------*/
+
+int match_input_role(int fd)
+{
+    unsigned long   capabilities[EV_MAX][NBITS(KEY_MAX)];
+    char            name[256];
+    struct input_id id;
+
+    memset(name, 0, sizeof(name));
+    memset(&id, 0, sizeof(id));
+
+    ioctl(fd, EVIOCGNAME(sizeof(name) - 1), name);
+    ioctl(fd, EVIOCGID, &id);
+
+    read_input_capabilities(fd, capabilities);
+
+    for(int role = 0; role < NUM_INPUT_ROLES; role++)
     {
-        return(-1);
+        bool matched = false;
+
+        if(!input_role_wanted[role] || *input_roles[role].fd >= 0)
+        {
+            continue;
+        }
+
+        if(input_device_entry != NULL)
+        {
+            matched = device_matches_role(input_device_entry, role, name, &id, capabilities);
+        }
+        else if(role == INPUT_ROLE_TOUCHSCREEN)
+        {
+            matched = is_touchscreen_device(capabilities);
+        }
+        else if(role == INPUT_ROLE_BUTTON_0)
+        {
+            matched = is_volume_key_device(capabilities, KEY_VOLUMEUP);
+        }
+        else if(role == INPUT_ROLE_BUTTON_1)
+        {
+            matched = is_volume_key_device(capabilities, KEY_VOLUMEDOWN);
+        }
+
+        if(matched)
+        {
+            return(role);
+        }
     }
+
+    return(-1);
 }
 
 /*---------------------------------------------------------*\
-| monitor_rotation                                          |
+| release_touchpad_contacts                                 |
 |                                                           |
-| Thread for monitoring rotation                            |
+| The contacts of a vanished touchscreen can never lift, so |
+| let go of anything the current touchpad's were holding    |
 \*---------------------------------------------------------*/
 
-void *monitor_rotation(void *vargp)
+void release_touchpad_contacts()
 {
-    int temp_rotation;
-
-    while(1)
-    {
-        sleep(1);
-        const char* orientation = query_accelerometer_orientation();
-        temp_rotation = rotation_from_accelerometer_orientation(orientation);
+    feed_gesture(GESTURE_INPUT_RESET);
+    output_mouse_frame();
 
-        if(temp_rotation >= 0)
-        {
-            rotation = temp_rotation;
-        }
-    }
+    stop_kinetic_scroll();
+    reset_touch_state();
 }
 
 /*---------------------------------------------------------*\
-| scan_and_open_auto                                        |
+| touchscreen_in_use                                        |
 |                                                           |
-| Scan for and open devices based on capabilities           |
+| Check if a device is already some touchpad's touchscreen, |
+| by its device number                                      |
 \*---------------------------------------------------------*/
 
-bool scan_and_open_auto(bool no_buttons)
+bool touchscreen_in_use(int fd)
 {
-    char    input_dev_buf[1024];
-    int     event_id            = 0;
-    bool    button_0_found      = false;
-    bool    button_1_found      = false;
-    bool    touchscreen_found   = false;
+    struct stat fd_stat;
+    struct stat touchscreen_stat;
 
-    /*-----------------------------------------------------*\
-    | Set button found flags to prevent initializing        |
-    | buttons if no buttons flag is set                     |
-    \*-----------------------------------------------------*/
-    if(no_buttons)
+    if(fstat(fd, &fd_stat) < 0)
     {
-        button_0_found = true;
-        button_1_found = true;
+        return(false);
     }
-    
-    /*-----------------------------------------------------*\
-    | Default all file descriptors to -1 (invalid)          |
-    \*-----------------------------------------------------*/
-    touchscreen_fd  = -1;
-    button_0_fd     = -1;
-    button_1_fd     = -1;
-    slider_fd       = -1;
 
-    while(1)
+    for(int touchpad_idx = 0; touchpad_idx < num_touchpads; touchpad_idx++)
     {
-        /*-------------------------------------------------*\
-        | Create the input event path                       |
-        \*-------------------------------------------------*/
-        snprintf(input_dev_buf, 1024, "/dev/input/event%d", event_id);
-
-        /*-------------------------------------------------*\
-        | Open the input event path                         |
-        \*-------------------------------------------------*/
-        int input_fd = open(input_dev_buf, O_RDONLY|O_NONBLOCK);
-
-        if(input_fd < 0)
+        if(touchpads[touchpad_idx].touchscreen_fd >= 0
+        && fstat(touchpads[touchpad_idx].touchscreen_fd, &touchscreen_stat) == 0
+        && touchscreen_stat.st_rdev == fd_stat.st_rdev)
         {
-            break;
+            return(true);
         }
+    }
 
-        /*-------------------------------------------------*\
-        | Get list of capabilities                          |
-        \*-------------------------------------------------*/
-        unsigned long capabilities[EV_MAX][NBITS(KEY_MAX)];
+    return(false);
+}
 
-        ioctl(input_fd, EVIOCGBIT(0, EV_MAX), capabilities[0]);
+/*---------------------------------------------------------*\
+| handle_touchpad_removed                                   |
+|                                                           |
+| Called when reading an additional touchscreen fails with  |
+| ENODEV.  Its touchpad is kept for a touchscreen plugged   |
+| in later                                                  |
+\*---------------------------------------------------------*/
 
-        for(unsigned int type = 0; type < EV_MAX; type++)
-        {
-            if(test_bit(type, capabilities[0]) && type != EV_REP)
-            {
-                if(type == EV_SYN)
-                {
-                    continue;
-                }
+void handle_touchpad_removed(event_source_type* source)
+{
+    touchpad = TOUCHPAD_OF(source, touchscreen_source);
 
-                ioctl(input_fd, EVIOCGBIT(type, KEY_MAX), capabilities[type]);
-            }
-        }
+    printf("Detached Touchscreen %d\r\n", (int)(touchpad - touchpads));
 
-        /*-------------------------------------------------*\
-        | Check if this device is Volume Up                 |
-        \*-------------------------------------------------*/
-        if(!button_0_found
-        && test_bit(EV_SYN,             capabilities[0])
-        && test_bit(EV_KEY,             capabilities[0])
-        && test_bit(KEY_VOLUMEUP,       capabilities[EV_KEY]))
-        {
-            button_0_fd         = input_fd;
-            button_0_found      = true;
-        }
+    remove_event_source(source);
+    close(touchpad->touchscreen_fd);
 
-        /*-------------------------------------------------*\
-        | Check if this device is Volume Down               |
-        \*-------------------------------------------------*/
-        if(!button_1_found
-        && test_bit(EV_SYN,             capabilities[0])
-        && test_bit(EV_KEY,             capabilities[0])
-        && test_bit(KEY_VOLUMEDOWN,     capabilities[EV_KEY]))
-        {
-            button_1_fd         = input_fd;
-            button_1_found      = true;
-        }
+    touchpad->touchscreen_fd = -1;
+    source->fd               = -1;
 
-        /*-------------------------------------------------*\
-        | Check if this device is Touchscreen               |
-        \*-------------------------------------------------*/
-        if(!touchscreen_found
-        && test_bit(EV_SYN,             capabilities[0])
-        && test_bit(EV_KEY,             capabilities[0])
-        && test_bit(BTN_TOUCH,          capabilities[EV_KEY])
-        && test_bit(EV_ABS,             capabilities[0])
-        && test_bit(ABS_MT_SLOT,        capabilities[EV_ABS])
-        && ((test_bit(ABS_X,             capabilities[EV_ABS])
-          && test_bit(ABS_Y,             capabilities[EV_ABS]))
-         || (test_bit(ABS_MT_POSITION_X,  capabilities[EV_ABS])
-          && test_bit(ABS_MT_POSITION_Y,  capabilities[EV_ABS]))))
+    release_touchpad_contacts();
+    close_uinput(&touchpad->virtual_mouse_fd);
+}
+
+/*---------------------------------------------------------*\
+| attach_touchpad                                           |
+|                                                           |
+| Emulate a touchpad on an additional touchscreen, reusing  |
+| the touchpad of one that went away if there is one.  The  |
+| calibration and panel size set for the device's own       |
+| touchscreen do not apply to it.  Returns false if all     |
+| MAX_TOUCHPADS are in use                                  |
+\*---------------------------------------------------------*/
+
+bool attach_touchpad(int fd)
+{
+    touchpad_type*  new_touchpad = NULL;
+    char            name[256];
+
+    for(int touchpad_idx = 1; touchpad_idx < num_touchpads && new_touchpad == NULL; touchpad_idx++)
+    {
+        if(touchpads[touchpad_idx].touchscreen_fd < 0)
         {
-            touchscreen_fd      = input_fd;
-            touchscreen_found   = true;
+            new_touchpad = &touchpads[touchpad_idx];
         }
+    }
 
-        /*-------------------------------------------------*\
-        | If this device was not used, close the device     |
-        \*-------------------------------------------------*/
-        if(touchscreen_fd != input_fd
-        && button_0_fd    != input_fd
-        && button_1_fd    != input_fd)
+    if(new_touchpad == NULL)
+    {
+        if(num_touchpads >= MAX_TOUCHPADS)
         {
-            close(input_fd);
+            return(false);
         }
 
-        /*-------------------------------------------------*\
-        | Move on to the next event                         |
-        \*-------------------------------------------------*/
-        event_id++;
-    }
+        new_touchpad  = &touchpads[num_touchpads++];
+        *new_touchpad = touchpad_settings;
 
-    /*-----------------------------------------------------*\
-    | If both volume up and down are on the same device,    |
-    | set the second button fd to invalid                   |
-    \*-----------------------------------------------------*/
-    if(button_0_fd == button_1_fd)
-    {
-        button_1_fd = -1;
+        new_touchpad->calibration_matrix    = orientation_matrices[0];
+        new_touchpad->panel_diagonal_mm     = 0.0f;
+        new_touchpad->resolution_override   = 0.0f;
+        new_touchpad->rotation              = extra_rotation;
+
+        create_timer(&new_touchpad->drag_timer,       drag_timeout);
+        create_timer(&new_touchpad->tap_timer,        tap_timeout);
+        create_timer(&new_touchpad->kinetic_timer,    kinetic_timeout);
+        create_timer(&new_touchpad->output_timer,     output_timeout);
+        create_timer(&new_touchpad->prediction_timer, prediction_timeout);
     }
 
+    memset(name, 0, sizeof(name));
+
+    ioctl(fd, EVIOCGNAME(sizeof(name) - 1), name);
+
+    printf("Attached Touchscreen %d: %s\r\n", (int)(new_touchpad - touchpads), name);
+
+    touchpad                                    = new_touchpad;
+    touchpad->touchscreen_fd                    = fd;
+    touchpad->touchscreen_source.syn_dropped    = false;
+    touchpad->touchscreen_source.removed        = handle_touchpad_removed;
+
+    add_input_source(&touchpad->touchscreen_source, fd, process_touchscreen_events);
+
+    configure_touchscreen();
+
     /*-----------------------------------------------------*\
-    | Return true if touchscreen, volume up, and volume     |
-    | down were all found                                   |
+    | Additional touchscreens always emulate a touchpad     |
     \*-----------------------------------------------------*/
-    if(touchscreen_found && button_0_found && button_1_found)
-    {
-        printf( "Opened device Automatic with:\r\n");
-
-        if(touchscreen_fd > 0)
-        {
-            ioctl(touchscreen_fd, EVIOCGNAME(sizeof(input_dev_buf)), input_dev_buf);
-            printf("    Touchscreen: %s\r\n", input_dev_buf);
-        }
-        if(button_0_fd > 0)
-        {
-            ioctl(button_0_fd, EVIOCGNAME(sizeof(input_dev_buf)), input_dev_buf);
-            printf("    Buttons:     %s\r\n", input_dev_buf);
-        }
-        if(button_1_fd > 0)
-        {
-            ioctl(button_1_fd, EVIOCGNAME(sizeof(input_dev_buf)), input_dev_buf);
-            printf("    Buttons:     %s\r\n", input_dev_buf);
-        }
+    touchpad->enabled = 1;
 
-        return true;
-    }
-    
-    close(button_0_fd);
-    close(button_1_fd);
-    close(touchscreen_fd);
+    grab_touchpad();
 
-    return false;
+    return(true);
 }
 
 /*---------------------------------------------------------*\
-| scan_and_open_devices                                     |
+| attach_input_device                                       |
 |                                                           |
-| Scan for and open devices matching the given names        |
+| Put a device that came back into its role in the running  |
+| event loop, set up as at startup and brought in sync with |
+| whatever changed while it was gone                        |
 \*---------------------------------------------------------*/
 
-bool scan_and_open_devices(char* touchscreen_device, char* button_0_device, char* button_1_device, char* slider_device)
+void attach_input_device(int role, int fd)
 {
-    char*   device_name[4];
-    bool    device_required[4];
-    int     device_id[4];
-    int     event_id        = 0;
-    
-    device_name[0] = touchscreen_device;
-    device_name[1] = button_0_device;
-    device_name[2] = button_1_device;
-    device_name[3] = slider_device;
+    input_role_type*        input_role = &input_roles[role];
+    char                    name[256];
+    struct timeval          cur_time;
+    struct input_event      sync_event;
+    struct input_absinfo    absinfo;
 
-    for(int i = 0; i < 4; i++)
-    {
-        device_required[i] = false;
-        device_id[i]       = -1;
+    memset(name, 0, sizeof(name));
 
-        if(strlen(device_name[i]) > 0)
-        {
-            device_required[i] = true;
-        }
-    }
-    
-    bool all_found = false;
+    ioctl(fd, EVIOCGNAME(sizeof(name) - 1), name);
 
-    while(!all_found)
-    {
-        /*-------------------------------------------------*\
-        | Create the input event name path                  |
-        \*-------------------------------------------------*/
-        char input_dev_buf[1024];
+    printf("Attached %s: %s\r\n", input_role->label, name);
 
-        snprintf(input_dev_buf, 1024, "/sys/class/input/event%d/device/name", event_id);
+    *input_role->fd                 = fd;
+    input_role->source->syn_dropped = false;
 
-        /*-------------------------------------------------*\
-        | Open the input event path to get the name         |
-        \*-------------------------------------------------*/
-        int input_name_fd = open(input_dev_buf, O_RDONLY|O_NONBLOCK);
+    add_input_source(input_role->source, fd, input_role->process);
 
-        if(input_name_fd < 0)
-        {
-            break;
-        }
+    gettimeofday(&cur_time, NULL);
 
-        memset(input_dev_buf, 0, 1024);
-        read(input_name_fd, input_dev_buf, 1024);
-        close(input_name_fd);
-        
-        /*-------------------------------------------------*\
-        | Check if this input matches any of our devices    |
-        \*-------------------------------------------------*/
-        for(int i = 0; i < 4; i++)
-        {
-            if(device_required[i] && (strncmp(input_dev_buf, device_name[i], strlen(device_name[i])) == 0))
+    memset(&sync_event, 0, sizeof(sync_event));
+
+    sync_event.input_event_sec  = cur_time.tv_sec;
+    sync_event.input_event_usec = cur_time.tv_usec;
+
+    switch(role)
+    {
+        case INPUT_ROLE_TOUCHSCREEN:
+            touchpad = &touchpads[0];
+
+            configure_touchscreen();
+
+            if(touchpad->enabled)
             {
-                device_id[i] = event_id;
+                grab_touchpad();
             }
-        }
+            else
+            {
+                set_event_mask(fd, NULL, 0);
+            }
+            break;
+
+        case INPUT_ROLE_BUTTON_0:
+        case INPUT_ROLE_BUTTON_1:
+            ioctl(fd, EVIOCGRAB, 1);
+            resync_volume_keys(fd, &sync_event);
+            resync_forwarded_events(fd);
+            break;
 
-        all_found = true;
+        case INPUT_ROLE_SLIDER:
+            ioctl(fd, EVIOCGRAB, 1);
+            set_event_mask(fd, slider_event_codes, NUM_EVENT_CODES(slider_event_codes));
 
-        for(int i = 0; i < 4; i++)
-        {
-            if(device_required[i] && device_id[i] == -1)
+            if(ioctl(fd, EVIOCGABS(EVENT_CODE_SLIDER), &absinfo) == 0)
             {
-                all_found = false;
+                sync_event.type     = EV_ABS;
+                sync_event.code     = EVENT_CODE_SLIDER;
+                sync_event.value    = absinfo.value;
+
+                process_slider_event(&sync_event);
             }
-        }
+            break;
+    }
+}
 
-        /*-------------------------------------------------*\
-        | Move on to the next event                         |
-        \*-------------------------------------------------*/
-        event_id++;
+/*---------------------------------------------------------*\
+| detach_input_device                                       |
+|                                                           |
+| Take a device that went away out of the event loop.  The  |
+| contacts of a vanished touchscreen can never lift, so     |
+| anything they were holding is let go                      |
+\*---------------------------------------------------------*/
+
+void detach_input_device(int role)
+{
+    input_role_type* input_role = &input_roles[role];
+
+    if(*input_role->fd < 0)
+    {
+        return;
     }
 
-    if(!all_found)
+    printf("Detached %s\r\n", input_role->label);
+
+    remove_event_source(input_role->source);
+    close(*input_role->fd);
+
+    *input_role->fd         = -1;
+    input_role->source->fd  = -1;
+
+    if(role == INPUT_ROLE_TOUCHSCREEN)
     {
-        return false;
+        touchpad = &touchpads[0];
+
+        release_touchpad_contacts();
+        close_uinput(&touchpad->virtual_mouse_fd);
+    }
+    else if(role == INPUT_ROLE_BUTTON_0 || role == INPUT_ROLE_BUTTON_1)
+    {
+        release_volume_button(&volume_buttons[role - INPUT_ROLE_BUTTON_0]);
     }
+}
 
-    /*-----------------------------------------------------*\
-    | Open the touchscreen device                           |
-    \*-----------------------------------------------------*/
-    char touchscreen_dev_path[1024];
+/*---------------------------------------------------------*\
+| probe_input_device                                        |
+|                                                           |
+| Open an event node and attach it if it fills a missing    |
+| role or is another touchscreen to emulate.  Nodes udev    |
+| has not given permissions yet fail to open and are probed |
+| again on their attribute change                           |
+\*---------------------------------------------------------*/
 
-    snprintf(touchscreen_dev_path, 1024, "/dev/input/event%d", device_id[0]);
+void probe_input_device(const char* node)
+{
+    char    path[512];
+    int     fd;
+    int     role;
 
-    touchscreen_fd = open(touchscreen_dev_path, O_RDONLY|O_NONBLOCK);
+    snprintf(path, sizeof(path), INPUT_DEV_PATH "/%s", node);
 
-    /*-----------------------------------------------------*\
-    | Open the button 0 device                              |
-    \*-----------------------------------------------------*/
-    char button_0_dev_path[1024];
+    fd = open(path, O_RDONLY|O_NONBLOCK);
+
+    if(fd < 0)
+    {
+        return;
+    }
 
-    snprintf(button_0_dev_path, 1024, "/dev/input/event%d", device_id[1]);
+    role = match_input_role(fd);
 
-    button_0_fd = open(button_0_dev_path, O_RDONLY|O_NONBLOCK);
+    if(role >= 0)
+    {
+        attach_input_device(role, fd);
+        return;
+    }
 
     /*-----------------------------------------------------*\
-    | Open the button 1 device                              |
+    | With --all-touchscreens, any other touchscreen gets a |
+    | touchpad of its own                                   |
     \*-----------------------------------------------------*/
-    char button_1_dev_path[1024];
+    if(all_touchscreens)
+    {
+        unsigned long capabilities[EV_MAX][NBITS(KEY_MAX)];
 
-    snprintf(button_1_dev_path, 1024, "/dev/input/event%d", device_id[2]);
+        read_input_capabilities(fd, capabilities);
 
-    button_1_fd = open(button_1_dev_path, O_RDONLY|O_NONBLOCK);
-    
-    /*-----------------------------------------------------*\
-    | Open the slider device                                |
-    \*-----------------------------------------------------*/
-    char slider_dev_path[1024];
+        if(is_touchscreen_device(capabilities) && !touchscreen_in_use(fd) && attach_touchpad(fd))
+        {
+            return;
+        }
+    }
 
-    snprintf(slider_dev_path, 1024, "/dev/input/event%d", device_id[3]);
+    close(fd);
+}
 
-    slider_fd = open(slider_dev_path, O_RDONLY|O_NONBLOCK);
-    
-    return true;
+/*---------------------------------------------------------*\
+| rescan_input_devices                                      |
+|                                                           |
+| Probe every event node while a role is missing, for a     |
+| device that came back before its removal was noticed or   |
+| while hotplug notifications were lost.  With              |
+| --all-touchscreens, also finds the other touchscreens     |
+\*---------------------------------------------------------*/
+
+void rescan_input_devices()
+{
+    int     event_ids[MAX_INPUT_DEVICES];
+    int     num_event_ids;
+    char    node[32];
+
+    if(!input_roles_missing() && !all_touchscreens)
+    {
+        return;
+    }
+
+    num_event_ids = list_input_events(event_ids, MAX_INPUT_DEVICES);
+
+    for(int id_idx = 0; id_idx < num_event_ids && (input_roles_missing() || all_touchscreens); id_idx++)
+    {
+        snprintf(node, sizeof(node), "event%d", event_ids[id_idx]);
+
+        probe_input_device(node);
+    }
 }
 
 /*---------------------------------------------------------*\
-| process_button_event                                      |
+| handle_input_removed                                      |
 |                                                           |
-| Process a button event                                    |
+| Called when reading an input device fails with ENODEV     |
 \*---------------------------------------------------------*/
 
-void process_button_event(int event)
+void handle_input_removed(event_source_type* source)
 {
-    switch(event)
+    for(int role = 0; role < NUM_INPUT_ROLES; role++)
     {
-        case BUTTON_EVENT_ENABLE_TOUCHPAD:
-            enable_touchpad();
-            disable_keyboard();
-            break;
+        if(input_roles[role].source == source)
+        {
+            detach_input_device(role);
+        }
+    }
 
-        case BUTTON_EVENT_DISABLE_TOUCHPAD_TOGGLE_KEYBOARD:
-            if(!touchpad_enable)
-            {
-                if(keyboard_enable)
-                {
-                    disable_keyboard();
-                }
-                else
-                {
-                    enable_keyboard();
-                }
-            }
-            
-            disable_touchpad();
-            break;
+    rescan_input_devices();
+}
 
-        case BUTTON_EVENT_DISABLE_TOUCHPAD_DISABLE_KEYBOARD:
-            if(!touchpad_enable)
-            {
-                disable_keyboard();
-            }
-            
-            disable_touchpad();
-            break;
+/*---------------------------------------------------------*\
+| handle_hotplug                                            |
+|                                                           |
+| Probe event nodes created in /dev/input, or whose         |
+| permissions changed, while a role is missing or with      |
+| --all-touchscreens                                        |
+\*---------------------------------------------------------*/
 
-        case BUTTON_EVENT_DISABLE_TOUCHPAD_ENABLE_KEYBOARD:
-            if(!touchpad_enable)
-            {
-                enable_keyboard();
-            }
-            
-            disable_touchpad();
-            break;
+void handle_hotplug(event_source_type* source)
+{
+    char    buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
 
-        case BUTTON_EVENT_CLOSE:
-            close_flag = 1;
-            break;
-        
-        case BUTTON_EVENT_EMIT_VOLUMEUP:
-            emit(virtual_buttons_fd, EV_KEY, KEY_VOLUMEUP, 1);
-            emit(virtual_buttons_fd, EV_SYN, SYN_REPORT,   0);
-            emit(virtual_buttons_fd, EV_KEY, KEY_VOLUMEUP, 0);
-            emit(virtual_buttons_fd, EV_SYN, SYN_REPORT,   0);
-            break;
-            
-        case BUTTON_EVENT_EMIT_VOLUMEDOWN:
-            emit(virtual_buttons_fd, EV_KEY, KEY_VOLUMEDOWN, 1);
-            emit(virtual_buttons_fd, EV_SYN, SYN_REPORT,     0);
-            emit(virtual_buttons_fd, EV_KEY, KEY_VOLUMEDOWN, 0);
-            emit(virtual_buttons_fd, EV_SYN, SYN_REPORT,     0);
-            break;
+    while((len = read(source->fd, buf, sizeof(buf))) > 0)
+    {
+        char* ptr = buf;
 
-        case BUTTON_EVENT_CHANGE_ORIENTATION:
-            rotation += 90;
+        while(ptr < buf + len)
+        {
+            struct inotify_event* event = (struct inotify_event*)ptr;
 
-            if(rotation > 270)
+            if(event->mask & IN_Q_OVERFLOW)
             {
-                rotation = 0;
+                rescan_input_devices();
             }
-            break;
+            else if(event->len > 0 && strncmp(event->name, "event", 5) == 0 && (input_roles_missing() || all_touchscreens))
+            {
+                probe_input_device(event->name);
+            }
+
+            ptr += sizeof(struct inotify_event) + event->len;
+        }
     }
 }
 
 /*---------------------------------------------------------*\
-| drag_timeout                                              |
+| start_hotplug                                             |
 |                                                           |
-| Handle the hold-to-drag timer timeout                     |
+| Remember which roles were opened at startup and start     |
+| watching for their devices going away and coming back     |
 \*---------------------------------------------------------*/
 
-void drag_timeout(union sigval val)
+void start_hotplug()
 {
-    if(check_for_dragging)
+    int fd;
+
+    for(int role = 0; role < NUM_INPUT_ROLES; role++)
+    {
+        input_role_wanted[role]             = (*input_roles[role].fd >= 0);
+        input_roles[role].source->removed   = handle_input_removed;
+    }
+
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if(fd < 0)
+    {
+        return;
+    }
+
+    if(inotify_add_watch(fd, INPUT_DEV_PATH, IN_CREATE | IN_ATTRIB) < 0)
     {
-        dragging = 1;
-        check_for_dragging = 0;
-        emit(virtual_mouse_fd, EV_KEY, BTN_LEFT,   1);
-        emit(virtual_mouse_fd, EV_SYN, SYN_REPORT, 0);
+        close(fd);
+        return;
     }
+
+    add_event_source(&hotplug_source, fd, handle_hotplug);
 }
 
 /*---------------------------------------------------------*\
@@ -911,10 +8150,12 @@ void drag_timeout(union sigval val)
 int main(int argc, char* argv[])
 {
     bool opened             = false;
+    bool accel_speed_set    = false;
+    bool calibration_set    = false;
+    char* device_db_path    = NULL;
     bool rotation_override  = false;
     bool no_buttons         = false;
     bool no_slider          = false;
-    bool force_autorotation = false;
     bool start_disabled     = false;
 
     /*-----------------------------------------------------*\
@@ -932,16 +8173,225 @@ int main(int argc, char* argv[])
             argument    = argv[arg_index + 1];
         }
 
+        /*-------------------------------------------------*\
+        | Pointer acceleration profile and base speed       |
+        \*-------------------------------------------------*/
+        if(strcmp(option, "--accel-profile") == 0)
+        {
+            if(strcmp(argument, "flat") == 0)
+            {
+                touchpad_settings.pointer_accel.profile = ACCEL_PROFILE_FLAT;
+            }
+            else if(strcmp(argument, "adaptive") == 0)
+            {
+                touchpad_settings.pointer_accel.profile = ACCEL_PROFILE_ADAPTIVE;
+            }
+            else
+            {
+                printf("Invalid acceleration profile %s\r\n", argument);
+                exit(1);
+            }
+
+            arg_index++;
+        }
+
+        if(strcmp(option, "--accel-speed") == 0)
+        {
+            touchpad_settings.pointer_accel.speed = strtof(argument, NULL);
+
+            if(!(touchpad_settings.pointer_accel.speed > 0.0f))
+            {
+                printf("Invalid acceleration speed %s\r\n", argument);
+                exit(1);
+            }
+
+            accel_speed_set = true;
+
+            arg_index++;
+        }
+
+        /*-------------------------------------------------*\
+        | Emulate a touchpad on every touchscreen, not just |
+        | the device's own                                  |
+        \*-------------------------------------------------*/
+        if(strcmp(option, "--all-touchscreens") == 0)
+        {
+            all_touchscreens = true;
+        }
+
+        /*-------------------------------------------------*\
+        | Calibration matrix as six numbers "a b c d e f",  |
+        | in the same form as LIBINPUT_CALIBRATION_MATRIX   |
+        \*-------------------------------------------------*/
+        if(strcmp(option, "--calibration-matrix") == 0)
+        {
+            transform_type* cal = &touchpad_settings.calibration_matrix;
+
+            if(sscanf(argument, "%f %f %f %f %f %f", &cal->m[0], &cal->m[1], &cal->m[2], &cal->m[3], &cal->m[4], &cal->m[5]) != 6)
+            {
+                printf("Invalid calibration matrix %s\r\n", argument);
+                exit(1);
+            }
+
+            calibration_set = true;
+
+            arg_index++;
+        }
+
+        /*-------------------------------------------------*\
+        | Device database file, read instead of the default |
+        \*-------------------------------------------------*/
+        if(strcmp(option, "--device-db") == 0)
+        {
+            if(!load_device_database(argument))
+            {
+                printf("Invalid device database %s\r\n", argument);
+                exit(1);
+            }
+
+            device_db_path = argument;
+
+            arg_index++;
+        }
+
+        /*-------------------------------------------------*\
+        | Fixed rotation of the touchscreens added with     |
+        | --all-touchscreens, which do not follow the       |
+        | accelerometer                                     |
+        \*-------------------------------------------------*/
+        if(strcmp(option, "--extra-rotation") == 0)
+        {
+            extra_rotation = atoi(argument);
+
+            if(extra_rotation != 0 && extra_rotation != 90 && extra_rotation != 180 && extra_rotation != 270)
+            {
+                printf("Invalid rotation %s\r\n", argument);
+                exit(1);
+            }
+
+            arg_index++;
+        }
+
+        /*-------------------------------------------------*\
+        | Jitter filter cutoff at rest and its increase     |
+        | with speed                                        |
+        \*-------------------------------------------------*/
+        if(strcmp(option, "--filter-beta") == 0)
+        {
+            jitter_filter.beta = strtof(argument, NULL);
+
+            if(!(jitter_filter.beta >= 0.0f))
+            {
+                printf("Invalid filter beta %s\r\n", argument);
+                exit(1);
+            }
+
+            arg_index++;
+        }
+
+        if(strcmp(option, "--filter-min-cutoff") == 0)
+        {
+            jitter_filter.min_cutoff = strtof(argument, NULL);
+
+            if(!(jitter_filter.min_cutoff > 0.0f))
+            {
+                printf("Invalid filter cutoff %s\r\n", argument);
+                exit(1);
+            }
+
+            arg_index++;
+        }
+
         if(strcmp(option, "--force-autorotation") == 0)
         {
             force_autorotation = true;
         }
 
+        /*-------------------------------------------------*\
+        | Volume key short and long hold thresholds as      |
+        | "short,long" in milliseconds                      |
+        \*-------------------------------------------------*/
+        if(strcmp(option, "--hold-time") == 0)
+        {
+            unsigned int short_ms;
+            unsigned int long_ms;
+
+            if(sscanf(argument, "%u,%u", &short_ms, &long_ms) != 2 || short_ms == 0 || short_ms >= long_ms || long_ms > 60000)
+            {
+                printf("Invalid hold time %s\r\n", argument);
+                exit(1);
+            }
+
+            short_hold_usec = short_ms * 1000;
+            long_hold_usec  = long_ms  * 1000;
+
+            arg_index++;
+        }
+
+        /*-------------------------------------------------*\
+        | Read the IIO accelerometer directly instead of    |
+        | using SensorProxy, optionally from another sysfs  |
+        | tree                                              |
+        \*-------------------------------------------------*/
+        if(strcmp(option, "--iio-accel") == 0)
+        {
+            use_iio_accel = true;
+        }
+
+        if(strcmp(option, "--iio-root") == 0)
+        {
+            if(argument[0] == '\0' || strlen(argument) >= sizeof(iio_root))
+            {
+                printf("Invalid IIO root %s\r\n", argument);
+                exit(1);
+            }
+
+            strcpy(iio_root, argument);
+
+            arg_index++;
+        }
+
+        if(strcmp(option, "--io-uring") == 0)
+        {
+            use_io_uring = true;
+        }
+
+        /*-------------------------------------------------*\
+        | Passed through volume key repeat as "delay,period"|
+        | in milliseconds, a period of 0 disables repeat    |
+        \*-------------------------------------------------*/
+        if(strcmp(option, "--key-repeat") == 0)
+        {
+            unsigned int delay_ms;
+            unsigned int period_ms;
+
+            if(sscanf(argument, "%u,%u", &delay_ms, &period_ms) != 2 || delay_ms == 0 || delay_ms > 60000 || period_ms > 60000)
+            {
+                printf("Invalid key repeat %s\r\n", argument);
+                exit(1);
+            }
+
+            repeat_delay_usec   = delay_ms  * 1000;
+            repeat_period_usec  = period_ms * 1000;
+
+            arg_index++;
+        }
+
         if(strcmp(option, "--no-buttons") == 0)
         {
             no_buttons = true;
         }
 
+        if(strcmp(option, "--no-kinetic-scroll") == 0)
+        {
+            touchpad_settings.scroll.kinetic_enable = false;
+        }
+
+        if(strcmp(option, "--no-jitter-filter") == 0)
+        {
+            jitter_filter.enable = false;
+        }
+
         if(strcmp(option, "--no-keyboard") == 0)
         {
             no_keyboard = true;
@@ -952,6 +8402,60 @@ int main(int argc, char* argv[])
             no_slider = true;
         }
 
+        /*-------------------------------------------------*\
+        | Maximum virtual mouse report rate in Hz           |
+        \*-------------------------------------------------*/
+        if(strcmp(option, "--output-rate") == 0)
+        {
+            touchpad_settings.output_scheduler.rate = atoi(argument);
+
+            if(touchpad_settings.output_scheduler.rate < 0 || touchpad_settings.output_scheduler.rate > 1000)
+            {
+                printf("Invalid output rate %s\r\n", argument);
+                exit(1);
+            }
+
+            if(touchpad_settings.output_scheduler.rate > 0)
+            {
+                touchpad_settings.output_scheduler.period_usec = 1000000 / touchpad_settings.output_scheduler.rate;
+            }
+
+            arg_index++;
+        }
+
+        /*-------------------------------------------------*\
+        | Pointer prediction horizon in milliseconds        |
+        \*-------------------------------------------------*/
+        if(strcmp(option, "--predict") == 0)
+        {
+            touchpad_settings.prediction.horizon = strtof(argument, NULL);
+
+            if(!(touchpad_settings.prediction.horizon >= 0.0f && touchpad_settings.prediction.horizon <= 50.0f))
+            {
+                printf("Invalid prediction horizon %s\r\n", argument);
+                exit(1);
+            }
+
+            arg_index++;
+        }
+
+        /*-------------------------------------------------*\
+        | Touchscreen resolution in units per millimetre,   |
+        | overriding the driver and device database values  |
+        \*-------------------------------------------------*/
+        if(strcmp(option, "--resolution") == 0)
+        {
+            touchpad_settings.resolution_override = strtof(argument, NULL);
+
+            if(!(touchpad_settings.resolution_override > 0.0f))
+            {
+                printf("Invalid resolution %s\r\n", argument);
+                exit(1);
+            }
+
+            arg_index++;
+        }
+
         /*-------------------------------------------------*\
         | If rotation is passed on command line, use fixed  |
         | rotation value                                    |
@@ -960,22 +8464,22 @@ int main(int argc, char* argv[])
         {
             if(strncmp(argument, "0", 1) == 0)
             {
-                rotation = 0;
+                touchpad_settings.rotation = 0;
                 rotation_override = true;
             }
             else if(strncmp(argument, "90", 2) == 0)
             {
-                rotation = 90;
+                touchpad_settings.rotation = 90;
                 rotation_override = true;
             }
             else if(strncmp(argument, "180", 3) == 0)
             {
-                rotation = 180;
+                touchpad_settings.rotation = 180;
                 rotation_override = true;
             }
             else if(strncmp(argument, "270", 3) == 0)
             {
-                rotation = 270;
+                touchpad_settings.rotation = 270;
                 rotation_override = true;
             }
             else
@@ -987,6 +8491,28 @@ int main(int argc, char* argv[])
             arg_index++;
         }
 
+        /*-------------------------------------------------*\
+        | Kinetic scrolling friction, the rate per second   |
+        | at which the scroll velocity decays               |
+        \*-------------------------------------------------*/
+        if(strcmp(option, "--scroll-friction") == 0)
+        {
+            touchpad_settings.scroll.friction = strtof(argument, NULL);
+
+            if(!(touchpad_settings.scroll.friction > 0.0f))
+            {
+                printf("Invalid scroll friction %s\r\n", argument);
+                exit(1);
+            }
+
+            arg_index++;
+        }
+
+        if(strcmp(option, "--scroll-lock-axis") == 0)
+        {
+            touchpad_settings.scroll.lock_axis = true;
+        }
+
         if(strcmp(option, "--start-disabled") == 0)
         {
             start_disabled = true;
@@ -996,118 +8522,134 @@ int main(int argc, char* argv[])
     }
 
     /*-----------------------------------------------------*\
-    | Open touchscreen and button devices by name           |
+    | The device's own touchscreen is the first touchpad    |
+    \*-----------------------------------------------------*/
+    touchpads[0]    = touchpad_settings;
+    num_touchpads   = 1;
+
+    /*-----------------------------------------------------*\
+    | Load the device database, then the built-in devices   |
     \*-----------------------------------------------------*/
-    for(unsigned int device_idx = 0; device_idx < NUM_KNOWN_DEVICES; device_idx++)
+    if(device_db_path == NULL)
     {
-        char * touchscreen  = known_devices[device_idx].touchscreen;
-        char * button_0     = known_devices[device_idx].button_0;
-        char * button_1     = known_devices[device_idx].button_1;
-        char * slider       = known_devices[device_idx].slider;
+        device_db_path = DEVICE_DB_PATH;
 
-        if(no_slider)
-        {
-            slider          = "";
-        }
+        load_device_database(device_db_path);
+    }
+
+    load_builtin_devices();
+
+    /*-----------------------------------------------------*\
+    | Open the devices used last time if they are all still |
+    | there.  Otherwise probe every event node and open the |
+    | first device in the database whose inputs are present |
+    \*-----------------------------------------------------*/
+    find_device_cache_path();
+
+    opened = open_cached_devices(no_buttons, no_slider, device_db_path);
 
-        if((strlen(slider) > 0) || (no_buttons))
+    if(!opened)
+    {
+        build_device_index();
+        probe_input_devices();
+
+        opened = scan_and_open_database(no_buttons, no_slider);
+
+        /*-------------------------------------------------*\
+        | If no device in the database was found, try to    |
+        | detect touchscreen and buttons devices            |
+        | automatically based on input capabilities         |
+        \*-------------------------------------------------*/
+        if(!opened)
         {
-            button_0        = "";
-            button_1        = "";
+            opened = scan_and_open_auto(no_buttons);
         }
 
-        opened = scan_and_open_devices(touchscreen, button_0, button_1, slider);
-        
         if(opened)
         {
-            printf( "Opened device %s with:\r\n", known_devices[device_idx].device);
+            write_device_cache(no_buttons, no_slider, device_db_path);
+        }
 
-            if(strlen(touchscreen) > 0)
-            {
-                printf("    Touchscreen: %s\r\n", touchscreen);
-            }
-            if(strlen(button_0) > 0)
-            {
-                printf("    Buttons:     %s\r\n", button_0);
-            }
-            if(strlen(button_1) > 0)
-            {
-                printf("    Buttons:     %s\r\n", button_1);
-            }
-            if(strlen(slider) > 0)
-            {
-                printf("    Slider:      %s\r\n", slider);
-            }
-            break;
+        release_input_probes();
+    }
+
+    if(opened)
+    {
+        print_opened_devices();
+
+        if(input_device_entry != NULL)
+        {
+            apply_device_tuning(input_device_entry, calibration_set, accel_speed_set);
         }
     }
 
-    /*-----------------------------------------------------*\
-    | If probing known device event names failed, try to    |
-    | detect touchscreen and buttons devices automatically  |
-    | based on input capabilities                           |
-    \*-----------------------------------------------------*/
     if(!opened)
     {
-        opened |= scan_and_open_auto(no_buttons);
+        printf("No supported set of input devices found, exiting.\r\n");
+        exit(1);
     }
 
-    if(!opened)
-    {
-        printf("No supported set of input devices found, exiting.\r\n");
-        exit(1);
-    }
+    /*-----------------------------------------------------*\
+    | Create the event loop.  Termination signals are       |
+    | blocked here, before any threads are started, and     |
+    | delivered to the event loop through a signalfd        |
+    \*-----------------------------------------------------*/
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+    sigset_t signal_mask;
+
+    sigemptyset(&signal_mask);
+    sigaddset(&signal_mask, SIGINT);
+    sigaddset(&signal_mask, SIGTERM);
+    sigaddset(&signal_mask, SIGHUP);
+
+    sigprocmask(SIG_BLOCK, &signal_mask, NULL);
+
+    add_event_source(&signal_source, signalfd(-1, &signal_mask, SFD_NONBLOCK | SFD_CLOEXEC), handle_signal);
 
     /*-----------------------------------------------------*\
-    | Set up default button behaviors                       |
+    | If the io_uring backend was requested, set it up, or  |
+    | fall back to the epoll loop if the kernel lacks it    |
     \*-----------------------------------------------------*/
-    int button_0_long_hold_event   = BUTTON_EVENT_CLOSE;
-    int button_0_short_hold_event  = BUTTON_EVENT_ENABLE_TOUCHPAD;
-    int button_0_click_event       = BUTTON_EVENT_EMIT_VOLUMEUP;
-    int button_1_long_hold_event   = BUTTON_EVENT_CLOSE;
-    int button_1_short_hold_event  = BUTTON_EVENT_DISABLE_TOUCHPAD_TOGGLE_KEYBOARD;
-    int button_1_click_event       = BUTTON_EVENT_EMIT_VOLUMEDOWN;
+    if(use_io_uring)
+    {
+        if(uring_setup())
+        {
+            printf("Using io_uring I/O backend.\r\n");
+        }
+        else
+        {
+            printf("io_uring is not supported by this kernel, using epoll I/O backend.\r\n");
+            use_io_uring = false;
+        }
+    }
 
     /*-----------------------------------------------------*\
     | Otherwise, query rotation from accelerometer and      |
-    | start rotation monitor thread                         |
+    | follow its changes from the event loop                |
     \*-----------------------------------------------------*/
     if(!rotation_override)
     {
         /*-------------------------------------------------*\
-        | Query accelerometer orientation to initialize     |
-        | rotation                                          |
+        | Subscribe to orientation changes and query the    |
+        | accelerometer orientation without waiting for the |
+        | answer, starting at 0 degrees until it comes.     |
+        | Without SensorProxy, read the IIO accelerometer   |
+        | directly                                          |
         \*-------------------------------------------------*/
-        const char* orientation = query_accelerometer_orientation();
-        rotation = rotation_from_accelerometer_orientation(orientation);
+        touchpads[0].rotation = 0;
 
-        if(rotation >= 0 || force_autorotation)
+        if(!use_iio_accel && connect_sensor_proxy())
         {
-            /*---------------------------------------------*\
-            | If force autorotation is active, default to 0 |
-            \*---------------------------------------------*/
-            if(rotation < 0)
-            {
-                rotation = 0;
-            }
-            
-            /*---------------------------------------------*\
-            | Start rotation monitor thread                 |
-            \*---------------------------------------------*/
-            printf("Automatic orientation detection enabled.\r\n");
-            pthread_t thread_id;
-            pthread_create(&thread_id, NULL, monitor_rotation, NULL);
+            start_orientation_query();
+        }
+        else if(open_iio_accelerometer())
+        {
+            resolve_initial_orientation(query_iio_accelerometer_orientation());
         }
         else
         {
-            /*---------------------------------------------*\
-            | Enable manual rotation if automatic rotation  |
-            | could not be enabled                          |
-            \*---------------------------------------------*/
-            printf("Orientation could not be determined from accelerometer, defaulting to 0 degrees.\r\n");
-            printf("Long-press Volume Up button to change orientations manually.\r\n");
-            button_0_long_hold_event = BUTTON_EVENT_CHANGE_ORIENTATION;
-            rotation                 = 0;
+            resolve_initial_orientation("");
         }
     }
 
@@ -1117,15 +8659,9 @@ int main(int argc, char* argv[])
     open_virtual_buttons(&virtual_buttons_fd);
 
     /*-----------------------------------------------------*\
-    | Open the touchscreen device and determine maximums    |
+    | Determine the touchscreen's limits and resolution     |
     \*-----------------------------------------------------*/
-    struct input_absinfo max_x;
-    struct input_absinfo max_y;
-
-    ioctl(touchscreen_fd, EVIOCGABS(ABS_MT_POSITION_X), &max_x);
-    ioctl(touchscreen_fd, EVIOCGABS(ABS_MT_POSITION_Y), &max_y);
-
-    printf("Touchscreen Max X:%d, Max y:%d\r\n", max_x.maximum, max_y.maximum);
+    configure_touchscreen();
 
     /*-----------------------------------------------------*\
     | Open the buttons device and grab exclusive access     |
@@ -1139,80 +8675,66 @@ int main(int argc, char* argv[])
     ioctl(slider_fd, EVIOCGRAB, 1);
 
     /*-----------------------------------------------------*\
-    | Initialize virtual mouse pointer tracking variables   |
-    \*-----------------------------------------------------*/
-    int prev_x              = 0;
-    int prev_y              = 0;
-    int prev_wheel_x        = 0;
-    int prev_wheel_y        = 0;
-
-    int init_prev_x         = 0;
-    int init_prev_y         = 0;
-    int init_prev_wheel_x   = 0;
-    int init_prev_wheel_y   = 0;
-    
-    int touch_active        = 0;
-    int fingers             = 0;
-
-    int active_mt_slot      = 0;
-    int check_for_click     = 0;
-    int check_for_tap_drag  = 0;
-
-    /*-----------------------------------------------------*\
-    | Initialize time tracking variables                    |
+    | Only deliver the events each device is used for.  The |
+    | touchscreen starts out masked off until the touchpad  |
+    | is enabled                                            |
     \*-----------------------------------------------------*/
-    struct timeval time_active;
-    struct timeval time_release;
-    struct timeval time_button;
-    struct timeval two_finger_time_active;
+    set_event_mask(touchpad->touchscreen_fd, NULL, 0);
+    set_event_mask(slider_fd,   slider_event_codes,  NUM_EVENT_CODES(slider_event_codes));
 
     /*-----------------------------------------------------*\
     | Initialize flag variables                             |
     \*-----------------------------------------------------*/
     close_flag              = 0;
-    touchpad_enable         = 0;
+    touchpads[0].enabled    = 0;
     keyboard_enable         = 1;
     
     /*-----------------------------------------------------*\
-    | Set up file descriptor polling structures             |
+    | Register the input devices with the event loop        |
     \*-----------------------------------------------------*/
-    struct pollfd fds[4];
-    
-    fds[0].fd               = touchscreen_fd;
-    fds[1].fd               = button_0_fd;
-    fds[2].fd               = button_1_fd;
-    fds[3].fd               = slider_fd;
-    
-    fds[0].events           = POLLIN;
-    fds[1].events           = POLLIN;
-    fds[2].events           = POLLIN;
-    fds[3].events           = POLLIN;
+    add_input_source(&touchpad->touchscreen_source, touchpad->touchscreen_fd, process_touchscreen_events);
+    add_input_source(&button_0_source,    button_0_fd,    process_buttons_events);
+    add_input_source(&button_1_source,    button_1_fd,    process_buttons_events);
+    add_input_source(&slider_source,      slider_fd,      process_slider_events);
 
     /*-----------------------------------------------------*\
-    | Create a timer to handle hold-to-drag                 |
+    | Reattach devices that are unplugged or reset while    |
+    | running                                               |
     \*-----------------------------------------------------*/
-    timer_t timer;
-    
-    struct sigevent ev;
-    ev.sigev_notify                 = SIGEV_THREAD;
-    ev.sigev_signo                  = 0;
-    ev.sigev_value.sival_ptr        = NULL;
-    ev.sigev_notify_function        = &drag_timeout;
-    ev.sigev_notify_attributes      = 0;
+    start_hotplug();
+
+    /*-----------------------------------------------------*\
+    | Create the volume key hold and repeat timers          |
+    \*-----------------------------------------------------*/
+    create_timer(&volume_buttons[0].timer, volume_button_timeout);
+    create_timer(&volume_buttons[1].timer, volume_button_timeout);
 
-    timer_create(CLOCK_MONOTONIC, &ev, &timer);
+    /*-----------------------------------------------------*\
+    | Create the hold-to-drag, tap-to-drag, kinetic         |
+    | scrolling, output scheduler and prediction timers     |
+    \*-----------------------------------------------------*/
+    create_timer(&touchpad->drag_timer,       drag_timeout);
+    create_timer(&touchpad->tap_timer,        tap_timeout);
+    create_timer(&touchpad->kinetic_timer,    kinetic_timeout);
+    create_timer(&touchpad->output_timer,     output_timeout);
+    create_timer(&touchpad->prediction_timer, prediction_timeout);
 
-    struct itimerspec itime_start;
-    itime_start.it_value.tv_sec     = 1;
-    itime_start.it_value.tv_nsec    = 0;
-    itime_start.it_interval.tv_sec  = 0;
-    itime_start.it_interval.tv_nsec = 0;
+    /*-----------------------------------------------------*\
+    | With --all-touchscreens, give every other touchscreen |
+    | a touchpad of its own                                 |
+    \*-----------------------------------------------------*/
+    if(all_touchscreens)
+    {
+        rescan_input_devices();
+    }
 
-    struct itimerspec itime_stop;
-    itime_stop.it_value.tv_sec      = 0;
-    itime_stop.it_value.tv_nsec     = 0;
-    itime_stop.it_interval.tv_sec   = 0;
-    itime_stop.it_interval.tv_nsec  = 0;
+    /*-----------------------------------------------------*\
+    | Connect to the session bus for keyboard control       |
+    \*-----------------------------------------------------*/
+    if(!no_keyboard)
+    {
+        connect_session_bus();
+    }
 
     /*-----------------------------------------------------*\
     | Determine initial state                               |
@@ -1251,543 +8773,45 @@ int main(int argc, char* argv[])
     /*-----------------------------------------------------*\
     | Main loop                                             |
     \*-----------------------------------------------------*/
-    while(!close_flag)
+    if(use_io_uring)
     {
-        /*-------------------------------------------------*\
-        | Poll until an input event occurs                  |
-        \*-------------------------------------------------*/
-        int ret = poll(fds, 4, 5000);
-        
-        if(ret <= 0) continue;
-
-        if(!touchpad_enable)
-        {
-            fingers = 0;
-        }
-
-        /*-------------------------------------------------*\
-        | Read the touchscreen event                        |
-        \*-------------------------------------------------*/
-        struct input_event touchscreen_event;
-
-        ret = read(touchscreen_fd, &touchscreen_event, sizeof(touchscreen_event));
-
-        if(ret > 0 && touchpad_enable)
-        {
-            /*---------------------------------------------*\
-            | Touchscreen pressed                           |
-            \*---------------------------------------------*/
-            if(touchscreen_event.type == EV_KEY && touchscreen_event.value == 1 && touchscreen_event.code == BTN_TOUCH)
-            {
-                /*-----------------------------------------*\
-                | Set touch active flag                     |
-                \*-----------------------------------------*/
-                touch_active = 1;
-
-                /*-----------------------------------------*\
-                | Record the activated time                 |
-                \*-----------------------------------------*/
-                struct timeval cur_time;
-                cur_time.tv_sec = touchscreen_event.input_event_sec;
-                cur_time.tv_usec = touchscreen_event.input_event_usec;
-                time_active = cur_time;
-
-                /*-----------------------------------------*\
-                | If there has been less than 150000 usec   |
-                | since the last tap, activate dragging     |
-                \*-----------------------------------------*/
-                struct timeval ret_time;
-                timersub(&cur_time, &time_release, &ret_time);
-
-                if(check_for_tap_drag && ret_time.tv_sec == 0 && ret_time.tv_usec < 150000)
-                {
-                    dragging = 1;
-                    check_for_tap_drag = 0;
-                    emit(virtual_mouse_fd, EV_KEY, BTN_LEFT,   1);
-                    emit(virtual_mouse_fd, EV_SYN, SYN_REPORT, 0);
-                }
-
-                /*-----------------------------------------*\
-                | Otherwise, start a 1 second timer.  If no |
-                | movement has occurred when the timer      |
-                | expires, activate dragging                |
-                \*-----------------------------------------*/
-                else if(fingers <= 1)
-                {
-                    check_for_dragging = 1;
-                    timer_settime(timer, 0, &itime_start, NULL);
-                }
-
-                /*-----------------------------------------*\
-                | Set the initialize previous x and y flags |
-                \*-----------------------------------------*/
-                init_prev_x = 1;
-                init_prev_y = 1;
-
-                check_for_click = 1;
-                check_for_tap_drag = 1;
-            }
-
-            /*---------------------------------------------*\
-            | Touchscreen released                          |
-            \*---------------------------------------------*/
-            if(touchscreen_event.type == EV_KEY && touchscreen_event.value == 0 && touchscreen_event.code == BTN_TOUCH)
-            {
-                /*-----------------------------------------*\
-                | Clear touch active flag                   |
-                \*-----------------------------------------*/
-                touch_active = 0;
-
-                /*-----------------------------------------*\
-                | Record the released time                  |
-                \*-----------------------------------------*/
-                struct timeval cur_time;
-                cur_time.tv_sec = touchscreen_event.input_event_sec;
-                cur_time.tv_usec = touchscreen_event.input_event_usec;
-                time_release = cur_time;
-                
-                /*-----------------------------------------*\
-                | If there has been less than 150000 usec   |
-                | since touch was activated, produce click  |
-                \*-----------------------------------------*/
-                struct timeval ret_time;
-                timersub(&cur_time, &time_active, &ret_time);
-
-                if(check_for_click == 1 && ret_time.tv_sec == 0 && ret_time.tv_usec < 150000)
-                {
-                    check_for_click = 0;
-                    emit(virtual_mouse_fd, EV_KEY, BTN_LEFT,   1);
-                    emit(virtual_mouse_fd, EV_SYN, SYN_REPORT, 0);
-                    emit(virtual_mouse_fd, EV_KEY, BTN_LEFT,   0);
-                }
-
-                /*-----------------------------------------*\
-                | If dragging is active, release button and |
-                | stop dragging                             |
-                \*-----------------------------------------*/
-                if(dragging)
-                {
-                    emit(virtual_mouse_fd, EV_KEY, BTN_LEFT, 0);
-                    dragging = 0;
-                }
-
-                /*-----------------------------------------*\
-                | If touch has been released, cancel hold   |
-                | to drag check                             |
-                \*-----------------------------------------*/
-                check_for_dragging = 0;
-                timer_settime(timer, 0, &itime_stop, NULL);
-            }
-            
-            /*---------------------------------------------*\
-            | Finger pressed                                |
-            \*---------------------------------------------*/
-            if(touchscreen_event.type == EV_ABS && touchscreen_event.code == ABS_MT_TRACKING_ID && touchscreen_event.value >= 0)
-            {
-                /*-----------------------------------------*\
-                | Increment finger count                    |
-                \*-----------------------------------------*/
-                fingers++;
-
-                /*-----------------------------------------*\
-                | If more than one finger touched since     |
-                | touch activated, cancel hold to drag check|
-                \*-----------------------------------------*/
-                if(fingers > 1)
-                {
-                    check_for_dragging  = 0;
-                    timer_settime(timer, 0, &itime_stop, NULL);
-
-                    check_for_click     = 0;
-                    check_for_tap_drag  = 0;
-                }
-
-                /*-----------------------------------------*\
-                | If there are two fingers active, record   |
-                | two finger active time and set previous   |
-                | wheel x and y initialization flags        |
-                \*-----------------------------------------*/
-                if(fingers == 2)
-                {
-                    two_finger_time_active.tv_sec = touchscreen_event.input_event_sec;
-                    two_finger_time_active.tv_usec = touchscreen_event.input_event_usec;
-                    init_prev_wheel_x = 1;
-                    init_prev_wheel_y = 1;
-                }
-            }
-            
-            /*---------------------------------------------*\
-            | Finger released                               |
-            \*---------------------------------------------*/
-            if(touchscreen_event.type == EV_ABS && touchscreen_event.code == ABS_MT_TRACKING_ID && touchscreen_event.value == -1)
-            {
-                if(fingers == 2)
-                {
-                    /*-------------------------------------*\
-                    | Read the two finger released time     |
-                    \*-------------------------------------*/
-                    struct timeval cur_time;
-                    cur_time.tv_sec = touchscreen_event.input_event_sec;
-                    cur_time.tv_usec = touchscreen_event.input_event_usec;
-
-                    /*-------------------------------------*\
-                    | If there has been less than 150000    |
-                    | usec since two fingers were activated,|
-                    | produce right click                   |
-                    \*-------------------------------------*/
-                    struct timeval ret_time;
-                    timersub(&cur_time, &two_finger_time_active, &ret_time);
-
-                    if(ret_time.tv_sec == 0 && ret_time.tv_usec < 150000)
-                    {
-                        emit(virtual_mouse_fd, EV_KEY, BTN_RIGHT,  1);
-                        emit(virtual_mouse_fd, EV_SYN, SYN_REPORT, 0);
-                        emit(virtual_mouse_fd, EV_KEY, BTN_RIGHT,  0);
-                    }
-                    
-                    /*-------------------------------------*\
-                    | Set the initialize previous x and y   |
-                    | flags                                 |
-                    \*-------------------------------------*/
-                    init_prev_x = 1;
-                    init_prev_y = 1;
-                }
-
-                /*-----------------------------------------*\
-                | If number of fingers has changed since    |
-                | touch activated, cancel hold to drag check|
-                \*-----------------------------------------*/
-                check_for_dragging = 0;
-                timer_settime(timer, 0, &itime_stop, NULL);
-
-                if(fingers > 1)
-                {
-                    check_for_click = 0;
-                    check_for_tap_drag = 0;
-                }
-
-                /*-----------------------------------------*\
-                | Decrement finger count                    |
-                \*-----------------------------------------*/
-                fingers--;
-
-                /*-----------------------------------------*\
-                | Sanity check, fingers on screen cannot be |
-                | less than zero                            |
-                \*-----------------------------------------*/
-                if(fingers < 0)
-                {
-                    fingers = 0;
-                }
-            }
-            
-            /*---------------------------------------------*\
-            | X-position of touch                           |
-            \*---------------------------------------------*/
-            if(touchscreen_event.type == EVENT_TYPE && (touchscreen_event.code == EVENT_CODE_X || touchscreen_event.code == EVENT_CODE_ALT_X))
-            {
-                if(!(active_mt_slot > 0 && touchscreen_event.code == EVENT_CODE_ALT_X))
-                {
-                    /*-------------------------------------*\
-                    | If X position has changed since touch |
-                    | activated, cancel hold to drag check  |
-                    \*-------------------------------------*/
-                    if(touch_active && (!init_prev_x && touchscreen_event.value != prev_x))
-                    {
-                        check_for_dragging = 0;
-                        timer_settime(timer, 0, &itime_stop, NULL); 
-
-                        check_for_click    = 0;
-                        check_for_tap_drag = 0;
-                    }
-                    
-                    /*-------------------------------------*\
-                    | Handle orientations where X axis is   |
-                    | mirrored                              |
-                    \*-------------------------------------*/
-                    if(rotation == 90 || rotation == 180)
-                    {
-                        touchscreen_event.value = max_x.maximum - touchscreen_event.value;
-                    }
-                    
-                    if(touch_active)
-                    {
-                        /*---------------------------------*\
-                        | If one finger is on the screen,   |
-                        | move the mouse cursor             |
-                        \*---------------------------------*/
-                        if(fingers == 1)
-                        {
-                            if(!init_prev_x)
-                            {
-                                if(rotation == 0 || rotation == 180)
-                                {
-                                    emit(virtual_mouse_fd, EV_REL, REL_X, touchscreen_event.value - prev_x);
-                                }
-                                else if(rotation == 90 || rotation == 270)
-                                {
-                                    emit(virtual_mouse_fd, EV_REL, REL_Y, touchscreen_event.value - prev_x);
-                                }
-                            }
-                                
-                            prev_x = touchscreen_event.value;
-                            init_prev_x = 0;
-                        }
-
-                        /*---------------------------------*\
-                        | Otherwise, if two fingers are on  |
-                        | the screen, move the scroll wheel |
-                        \*---------------------------------*/
-                        else if(fingers == 2)
-                        {
-                            if(init_prev_wheel_x)
-                            {
-                                prev_wheel_x = touchscreen_event.value;
-                                init_prev_wheel_x = 0;
-                            }
-                            else
-                            {
-                                if(rotation == 90 || rotation == 270)
-                                {
-                                    int accumulator_wheel_x = touchscreen_event.value;
-                                    
-                                    if(abs(accumulator_wheel_x - prev_wheel_x) > 15)
-                                    {
-                                        emit(virtual_mouse_fd, EV_REL, REL_WHEEL, (accumulator_wheel_x - prev_wheel_x) / 10);
-                                        prev_wheel_x = accumulator_wheel_x;
-                                    }
-                                }
-                            }
-                        }
-                    }    
-                }
-            }
-            
-            /*---------------------------------------------*\
-            | Y-position of touch                           |
-            \*---------------------------------------------*/
-            if(touchscreen_event.type == EVENT_TYPE && (touchscreen_event.code == EVENT_CODE_Y || touchscreen_event.code == EVENT_CODE_ALT_Y))
-            {
-                if(!(active_mt_slot > 0 && touchscreen_event.code == EVENT_CODE_ALT_Y))
-                {
-                    /*-------------------------------------*\
-                    | If Y position has changed since touch |
-                    | activated, cancel hold to drag check  |
-                    \*-------------------------------------*/
-                    if(touch_active && (!init_prev_y && touchscreen_event.value != prev_y))
-                    {
-                        check_for_dragging = 0;
-                        timer_settime(timer, 0, &itime_stop, NULL); 
-
-                        check_for_click    = 0;
-                        check_for_tap_drag = 0;                 
-                    }
-                    
-                    /*-------------------------------------*\
-                    | Handle orientations where Y axis is   |
-                    | mirrored                              |
-                    \*-------------------------------------*/
-                    if(rotation == 180 || rotation == 270)
-                    {
-                        touchscreen_event.value = max_y.maximum - touchscreen_event.value;
-                    }
-
-                    if(touch_active)
-                    {
-                        /*---------------------------------*\
-                        | If one finger is on the screen,   |
-                        | move the mouse cursor             |
-                        \*---------------------------------*/
-                        if(fingers == 1)
-                        {
-                            if(!init_prev_y)
-                            {
-                                if(rotation == 0 || rotation == 180)
-                                {
-                                    emit(virtual_mouse_fd, EV_REL, REL_Y, touchscreen_event.value - prev_y);
-                                }
-                                else if(rotation == 90 || rotation == 270)
-                                {
-                                    emit(virtual_mouse_fd, EV_REL, REL_X, touchscreen_event.value - prev_y);
-                                }
-                            }
-            
-                            prev_y = touchscreen_event.value;
-                            init_prev_y = 0;
-                        }
-
-                        /*---------------------------------*\
-                        | Otherwise, if two fingers are on  |
-                        | the screen, move the scroll wheel |
-                        \*---------------------------------*/
-                        else if(fingers == 2)
-                        {
-                            if(init_prev_wheel_y)
-                            {
-                                prev_wheel_y = touchscreen_event.value;
-                                init_prev_wheel_y = 0;
-                            }
-                            else
-                            {
-                                if(rotation == 0 || rotation == 180)
-                                {
-                                    int accumulator_wheel_y = touchscreen_event.value;
-                                    
-                                    if(abs(accumulator_wheel_y - prev_wheel_y) > 15)
-                                    {
-                                        emit(virtual_mouse_fd, EV_REL, REL_WHEEL, (accumulator_wheel_y - prev_wheel_y) / 10);
-                                        prev_wheel_y = accumulator_wheel_y;
-                                    }
-                                }
-                            }
-                        }
-                    }
-                }
-            }
-
-            /*---------------------------------------------*\
-            | Sync event                                    |
-            \*---------------------------------------------*/
-            if(touchscreen_event.type == EV_SYN && touchscreen_event.code == SYN_REPORT)
-            {
-                emit(virtual_mouse_fd, EV_SYN, SYN_REPORT, 0);
-            }
-
-            /*---------------------------------------------*\
-            | Slot event                                    |
-            \*---------------------------------------------*/
-            if(touchscreen_event.type == EVENT_TYPE && touchscreen_event.code == ABS_MT_SLOT)
-            {
-                active_mt_slot = touchscreen_event.value;
-            }
-        }
-
-        /*-------------------------------------------------*\
-        | Read the buttons event                            |
-        \*-------------------------------------------------*/
-        struct input_event buttons_event;
-
-        ret = read(button_0_fd, &buttons_event, sizeof(buttons_event));
-        
-        if(ret <= 0)
-        {
-            ret = read(button_1_fd, &buttons_event, sizeof(buttons_event));
-        }
-
-        if(ret > 0)
-        {
-            /*---------------------------------------------*\
-            | Handle volume up key events                   |
-            \*---------------------------------------------*/
-            if(buttons_event.type == EV_KEY && buttons_event.code == KEY_VOLUMEUP)
-            {
-                if(buttons_event.value == 1)
-                {
-                    time_button.tv_sec = buttons_event.input_event_sec;
-                    time_button.tv_usec = buttons_event.input_event_usec;
-                }
-                else if(buttons_event.value == 0)
-                {
-                    struct timeval cur_time;
-                    cur_time.tv_sec = buttons_event.input_event_sec;
-                    cur_time.tv_usec = buttons_event.input_event_usec;
-                    struct timeval ret_time;
-                    timersub(&cur_time, &time_button, &ret_time);
-
-                    unsigned int usec = (ret_time.tv_sec * 1000000) + ret_time.tv_usec;
-                    if(usec > 4000000)
-                    {
-                        process_button_event(button_0_long_hold_event);
-                    }
-                    else if(usec > 500000)
-                    {
-                    	process_button_event(button_0_short_hold_event);
-                    }
-                    else
-                    {
-                        process_button_event(button_0_click_event);
-                    }
-                }
-            }
-
-            /*---------------------------------------------*\
-            | Handle volume down key events                 |
-            \*---------------------------------------------*/
-            if(buttons_event.type == EV_KEY && buttons_event.code == KEY_VOLUMEDOWN)
-            {
-                if(buttons_event.value == 1)
-                {
-                    time_button.tv_sec = buttons_event.input_event_sec;
-                    time_button.tv_usec = buttons_event.input_event_usec;
-                }
-                else if(buttons_event.value == 0)
-                {
-                    struct timeval cur_time;
-                    cur_time.tv_sec = buttons_event.input_event_sec;
-                    cur_time.tv_usec = buttons_event.input_event_usec;
-                    struct timeval ret_time;
-                    timersub(&cur_time, &time_button, &ret_time);
-
-                    unsigned int usec = (ret_time.tv_sec * 1000000) + ret_time.tv_usec;
-                    if(usec > 4000000)
-                    {
-                        process_button_event(button_1_long_hold_event);
-                    }
-                    else if(usec > 500000)
-                    {
-                    	process_button_event(button_1_short_hold_event);
-                    }
-                    else
-                    {
-                        process_button_event(button_1_click_event);
-                    }
-                }
-            }
-        }
+        run_uring_loop();
+    }
 
+    while(!close_flag)
+    {
         /*-------------------------------------------------*\
-        | Read the slider event                             |
+        | Wait for input events, timers and signals, then   |
+        | dispatch each ready source to its handler         |
         \*-------------------------------------------------*/
-        struct input_event slider_event;
-
-        ret = read(slider_fd, &slider_event, sizeof(slider_event));
-        
-        if(ret > 0)
-        {
-            /*---------------------------------------------*\
-            | Handle slider events                          |
-            \*---------------------------------------------*/
-            if((slider_event.type == EV_ABS) && (slider_event.code == EVENT_CODE_SLIDER))
-            {
-                switch(slider_event.value)
-                {
-                    case 0:
-                        process_button_event(BUTTON_EVENT_ENABLE_TOUCHPAD);
-                        break;
-                        
-                    case 1:
-                        process_button_event(BUTTON_EVENT_DISABLE_TOUCHPAD_DISABLE_KEYBOARD);
-                        break;
-                        
-                    case 2:
-                        process_button_event(BUTTON_EVENT_DISABLE_TOUCHPAD_ENABLE_KEYBOARD);
-                        break;
-                }
-            }
-        }
+        dispatch_events(-1);
     }
 
     sleep(1);
 
     /*-----------------------------------------------------*\
-    | Close the virtual mouse                               |
+    | Close the virtual mice                                |
     \*-----------------------------------------------------*/
-    close_uinput(&virtual_mouse_fd);
+    for(int touchpad_idx = 0; touchpad_idx < num_touchpads; touchpad_idx++)
+    {
+        close_uinput(&touchpads[touchpad_idx].virtual_mouse_fd);
+    }
+
+    release_accelerometer();
+    close_iio_accelerometer();
     
     /*-----------------------------------------------------*\
     | Enable the on-screen keyboard                         |
     \*-----------------------------------------------------*/
     enable_keyboard();
 
+    /*-----------------------------------------------------*\
+    | Make sure the keyboard calls go out before exiting    |
+    \*-----------------------------------------------------*/
+    if(session_bus != NULL)
+    {
+        dbus_connection_flush(session_bus);
+    }
+
     return 0;
 }